@@ -57,30 +57,442 @@
 #define BLOCKS          (ARENASIZE/FACTOR)            // Blocks which
 #define BITMAP          32
 #define MAPBLOCKS       BLOCKS/BITMAP
+#define SUMMARYWORDS    ((MAPBLOCKS+BITMAP-1)/BITMAP) // One summary bit per bitmap word
 
-#define ROR(X, N)( (X >> N) | (X << (BITMAP-N)) )
-#define ROL(X, N)( (X << N) | (X >> (BITMAP-N)) )
+#define CTZ(X)          __builtin_ctz(X)              // Free blocks below the lowest reserved one (X != 0)
+#define CLZ(X)          __builtin_clz(X)              // Free blocks above the highest reserved one (X != 0)
 
+// N (1..32) consecutive bits starting at bit S of a bitmap word.
+#define RUN_MASK(S, N)  ( ((N) == BITMAP ? 0xFFFFFFFFu : ((1u << (N)) - 1)) << (S) )
 
-static uint32_t arena_b[ARENASIZE/4];
+#ifdef __BIT_CONCURRENT__
+// Map words are shared between threads: every read is an acquire load, and every change an
+// atomic read-modify-write.
+#define MAP_LOAD(P)           __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define MAP_OR(P, M)          __atomic_fetch_or((P), (M), __ATOMIC_ACQ_REL)
+#define MAP_AND(P, M)         __atomic_fetch_and((P), (M), __ATOMIC_ACQ_REL)
+#define MAP_CAS(P, OLD, NEW)  __atomic_compare_exchange_n((P), &(OLD), (NEW), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define MAP_LOAD(P)           (*(P))
+#endif
+
+#if defined(__BIT_CONCURRENT__) && defined(__BIT_REGION_LOCKS__)
+#error "__BIT_CONCURRENT__ and __BIT_REGION_LOCKS__ are alternatives."
+#endif
+#if defined(__BIT_CONCURRENT__) || defined(__BIT_REGION_LOCKS__)
+#define BIT_THREADED                                  // callable from several threads; no lazy-free cache
+#endif
+
+
+// The state of one heap. The default heap points these at static arrays of ARENA_BYTES;
+// bit_heap_init carves them out of the caller's region instead.
+struct bit_heap {
+   char *      arena;
+   uint32_t *  bitmap;
+   // Allocation lengths are not stored: endmap has a bit set on the last block of every
+   // live allocation, and the length is the distance from the start block to that marker.
+   uint32_t *  endmap;
+   // Summary layer: fullmap has a bit set for every bitmap word with no free block, and
+   // maxrun holds the longest free run inside each word. Both are refreshed for exactly the
+   // words a claim or release writes, so they cost one extra write per touched word.
+   uint32_t *  fullmap;
+   uint8_t *   maxrun;
+   uint32_t    mapblocks;
+   uint32_t    summarywords;
+   uint8_t     summary_ready;
+#ifdef __BIT_NEXT_FIT__
+   uint32_t    next_fit_word;       // word the last allocation ended in
+#endif
+#ifdef __BIT_REGION_LOCKS__
+   // One lock per BIT_REGION_WORDS bitmap words (and their endmap, maxrun and fullmap bits).
+   // Runs that fit in a region are searched and claimed under its lock alone.
+   fine_lock_t * region_lock;
+   uint32_t    regions;
+#endif
+   /* For lazy free, keep up to LAZY_DEPTH freed runs of each length from 1 to LAZY_CLASSES blocks */
+   void *      lazyhold[LAZY_CLASSES][LAZY_DEPTH];
+   uint8_t     lazyreserved[LAZY_CLASSES];
+#ifdef __ALLOC_STATS__
+   mem_stats_t stats;
+#endif
+#ifdef __ACCESS_COUNT__
+   mem_cost_t  cost;
+#endif
+};
+_Static_assert(sizeof(bit_heap_t) <= HEAP_STATE_BYTES, "bit_heap_t outgrew HEAP_STATE_BYTES");
+
+static uint32_t arena_b[ARENASIZE/4] __attribute__ ((aligned(ARENA_ALIGN)));
 static uint32_t bitmap[MAPBLOCKS] = {0};
-static uint16_t bitsize[BLOCKS] = {0};
+static uint32_t endmap[MAPBLOCKS] = {0};
+static uint32_t fullmap[SUMMARYWORDS] = {0};
+static uint8_t  maxrun[MAPBLOCKS];
+#ifdef __BIT_REGION_LOCKS__
+#define REGIONS         ((MAPBLOCKS + BIT_REGION_WORDS - 1) / BIT_REGION_WORDS)
+static fine_lock_t region_lock[REGIONS];
+static bit_heap_t default_heap = { (char *)arena_b, bitmap, endmap, fullmap, maxrun, MAPBLOCKS, SUMMARYWORDS, 0,
+#ifdef __BIT_NEXT_FIT__
+                                   0,
+#endif
+                                   region_lock, REGIONS };
+#else
+static bit_heap_t default_heap = { (char *)arena_b, bitmap, endmap, fullmap, maxrun, MAPBLOCKS, SUMMARYWORDS };
+#endif
 
-/* For lazy free, store 32, 32-bit addresses */
-static uint32_t lazyhold[32];
-static uint8_t  lazyreserved = 0;
 
+#ifndef __BIT_CONCURRENT__
+// The summary layer and the word-at-a-time search over it. The concurrent build does
+// without both and searches a snapshot of the bitmap instead.
+static void init_summary(bit_heap_t * h) {
+   uint32_t cur_map_idx;
 
-#ifdef __DO_NOT_INLINE__ 
-   void * __attribute__ ((noinline)) bit_malloc(unsigned nbytes)
+   COST_META_STORE(&h->cost, h->mapblocks);
+   for(cur_map_idx = 0; cur_map_idx < h->mapblocks; ++cur_map_idx) {
+      h->maxrun[cur_map_idx] = BITMAP;
+   }
+#ifdef __BIT_REGION_LOCKS__
+   __atomic_store_n(&h->summary_ready, 1, __ATOMIC_RELEASE);
 #else
-   void * bit_malloc(unsigned nbytes)
+   h->summary_ready = 1;
+#endif
+}
+
+static void summarize(bit_heap_t * h, uint32_t cur_map_idx) {
+   uint32_t current_map = h->bitmap[cur_map_idx];
+   uint32_t free_map = ~current_map;
+   uint32_t len = 0;
+
+   // The bitmap word and the fullmap word are read; the fullmap word and the maxrun byte written.
+   COST_META_LOAD(&h->cost, 2);
+   COST_META_STORE(&h->cost, 2);
+   if(current_map == 0xFFFFFFFFu) {
+      h->fullmap[cur_map_idx >> 5] |= 1u << (cur_map_idx & 0x1F);
+   } else {
+      h->fullmap[cur_map_idx >> 5] &= ~(1u << (cur_map_idx & 0x1F));
+   }
+
+   if(current_map == 0) {
+      len = BITMAP;
+   } else {
+      // Each step shortens every free run by one; the longest survives the most steps.
+      while(free_map) {
+         free_map &= free_map >> 1;
+         ++len;
+      }
+   }
+   h->maxrun[cur_map_idx] = len;
+}
+
+// First bitmap word at or after cur_map_idx, and before end, that still has a free block
+// (or end).
+static uint32_t next_open_word(bit_heap_t * h, uint32_t cur_map_idx, uint32_t end) {
+   uint32_t group = cur_map_idx >> 5;
+   uint32_t open = ~h->fullmap[group] & (0xFFFFFFFFu << (cur_map_idx & 0x1F));
+
+   COST_META_LOAD(&h->cost, 1);
+   while(open == 0) {
+      if(++group >= ((end + BITMAP - 1) >> 5)) {
+         return end;
+      }
+      COST_META_LOAD(&h->cost, 1);
+      open = ~h->fullmap[group];
+   }
+   cur_map_idx = (group << 5) + CTZ(open);
+   return (cur_map_idx < end) ? cur_map_idx : end;
+}
+
+// Searches the bitmap one word at a time, from word first up to (not including) word end,
+// for the first run of n free blocks and returns the block index it starts at (or -1). A run may carry over from
+// the free high bits of one word into the free low bits of the next; runs inside a single
+// word are found with a shift-and-AND reduction of the free mask, which is only attempted
+// when the summary says the word holds a long enough run. Full words end any run and are
+// skipped 32 at a time through fullmap.
+static int32_t find_run(bit_heap_t * h, uint32_t first, uint32_t end, uint32_t n) {
+   uint32_t cur_map_idx, current_map, free_map, len;
+   uint32_t run = 0, run_start = 0;
+
+   cur_map_idx = first;
+   while(cur_map_idx < end) {
+      STAT_STEP(&h->stats);
+      COST_META_LOAD(&h->cost, 1);
+      if(h->maxrun[cur_map_idx] == 0) {
+         cur_map_idx = next_open_word(h, cur_map_idx, end);
+         run = 0;
+         continue;
+      }
+
+      COST_META_LOAD(&h->cost, 1);
+      current_map = h->bitmap[cur_map_idx];
+      if(run == 0) {
+         run_start = cur_map_idx << 5;
+      }
+
+      if(current_map == 0) {
+         run += BITMAP;
+         if(run >= n) {
+            return run_start;
+         }
+         ++cur_map_idx;
+         continue;
+      }
+
+      if(run + CTZ(current_map) >= n) {
+         return run_start;
+      }
+
+      if(n < BITMAP && h->maxrun[cur_map_idx] >= n) {
+         // bit i of free_map ends up set iff blocks i .. i+n-1 are all free.
+         free_map = ~current_map;
+         for(len = 1; (len << 1) <= n; len <<= 1) {
+            free_map &= free_map >> len;
+         }
+         if(len < n) {
+            free_map &= free_map >> (n - len);
+         }
+         return (cur_map_idx << 5) + CTZ(free_map);
+      }
+
+      run = CLZ(current_map);
+      run_start = (cur_map_idx << 5) + BITMAP - run;
+      ++cur_map_idx;
+   }
+   return -1;
+}
+
+// Sets (claim != 0) or clears n blocks starting at block start, one masked write per word.
+static void mark_run(bit_heap_t * h, uint32_t start, uint32_t n, int claim) {
+   uint32_t cur_map_idx = start >> 5;
+   uint32_t bit = start & 0x1F;
+   uint32_t take, mask;
+
+   while(n > 0) {
+      take = (n < BITMAP - bit) ? n : BITMAP - bit;
+      mask = RUN_MASK(bit, take);
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      h->bitmap[cur_map_idx] = claim ? (h->bitmap[cur_map_idx] | mask) : (h->bitmap[cur_map_idx] & ~mask);
+      summarize(h, cur_map_idx);
+      n -= take;
+      bit = 0;
+      ++cur_map_idx;
+   }
+}
 #endif
+
+// Number of blocks in the allocation starting at block start, found by scanning endmap
+// a word at a time for the first end marker at or after start.
+static uint32_t run_length(bit_heap_t * h, uint32_t start) {
+   uint32_t cur_map_idx = start >> 5;
+   uint32_t ends = MAP_LOAD(&h->endmap[cur_map_idx]) & (0xFFFFFFFFu << (start & 0x1F));
+
+   COST_META_LOAD(&h->cost, 1);
+   while(ends == 0) {
+      COST_META_LOAD(&h->cost, 1);
+      ends = MAP_LOAD(&h->endmap[++cur_map_idx]);
+   }
+   return (cur_map_idx << 5) + CTZ(ends) - start + 1;
+}
+
+#ifdef __BIT_REGION_LOCKS__
+
+// Region-locked mode: the bitmap is split into regions of BIT_REGION_WORDS words, each
+// with its own lock. Every thread starts its searches in a region of its own (handed out
+// round robin) and moves on to the next region only when its own cannot serve a request,
+// so threads contend only when a region fills up. Runs larger than a region, or that no
+// single region can hold, are searched across region boundaries with every lock taken in
+// order.
+
+static uint32_t           next_home = 0;
+static __thread int32_t   home_region = -1;
+
+static void lock_all(bit_heap_t * h) {
+   uint32_t r;
+
+   for(r = 0; r < h->regions; ++r) {
+      FINE_LOCK(&h->region_lock[r]);
+   }
+}
+
+static void unlock_all(bit_heap_t * h) {
+   uint32_t r;
+
+   for(r = h->regions; r > 0; --r) {
+      FINE_UNLOCK(&h->region_lock[r - 1]);
+   }
+}
+
+// Length of the allocation starting at block start, read under the lock of its region;
+// 0 when its end marker lies beyond that region (the caller then takes every lock).
+static uint32_t region_run_length(bit_heap_t * h, uint32_t start) {
+   uint32_t region = (start >> 5) / BIT_REGION_WORDS;
+   uint32_t end = (region + 1) * BIT_REGION_WORDS;
+   uint32_t cur_map_idx = start >> 5;
+   uint32_t ends = h->endmap[cur_map_idx] & (0xFFFFFFFFu << (start & 0x1F));
+
+   COST_META_LOAD(&h->cost, 1);
+   while(ends == 0) {
+      if(++cur_map_idx >= end || cur_map_idx >= h->mapblocks) {
+         return 0;
+      }
+      COST_META_LOAD(&h->cost, 1);
+      ends = h->endmap[cur_map_idx];
+   }
+   return (cur_map_idx << 5) + CTZ(ends) - start + 1;
+}
+
+// run_length for a block the caller owns, taking whichever locks its run needs.
+static uint32_t owned_run_length(bit_heap_t * h, uint32_t start) {
+   uint32_t region = (start >> 5) / BIT_REGION_WORDS;
+   uint32_t n;
+
+   FINE_LOCK(&h->region_lock[region]);
+   n = region_run_length(h, start);
+   FINE_UNLOCK(&h->region_lock[region]);
+   if(n == 0) {
+      lock_all(h);
+      n = run_length(h, start);
+      unlock_all(h);
+   }
+   return n;
+}
+
+#define RUN_LENGTH(h, start)  owned_run_length(h, start)
+#else
+#define RUN_LENGTH(h, start)  run_length(h, start)
+#endif /* __BIT_REGION_LOCKS__ */
+
+// Bytes of the allocation at p, for the statistics.
+#define BLOCK_BYTES(h, p)     (RUN_LENGTH(h, (uint32_t)(((char *)(p) - (h)->arena) >> SHFTFACTOR)) << SHFTFACTOR)
+
+#ifdef __BIT_CONCURRENT__
+
+// Concurrent mode: threads share the bitmap without a lock. A search reads each word once
+// and claims what it found with compare-and-swap, so a run inside one word costs a single
+// CAS. Runs spanning words are claimed word by word, low to high, and rolled back if another
+// thread got to one of the words first. The summary layer and the lazy-free cache are
+// per-thread state in disguise, so this mode does without them.
+
+// Sets the bits of mask in one map word, provided none of them is set yet. A CAS that
+// loses a race is retried for as long as the bits stay clear.
+static int claim_bits(bit_heap_t * h, uint32_t * word, uint32_t mask) {
+   uint32_t old = MAP_LOAD(word);
+
+   COST_META_LOAD(&h->cost, 1);
+   while(!(old & mask)) {
+      COST_META_STORE(&h->cost, 1);
+      if(MAP_CAS(word, old, old | mask)) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+static void release_run(bit_heap_t * h, uint32_t start, uint32_t n) {
+   uint32_t cur_map_idx = start >> 5;
+   uint32_t bit = start & 0x1F;
+   uint32_t take;
+
+   while(n > 0) {
+      take = (n < BITMAP - bit) ? n : BITMAP - bit;
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      MAP_AND(&h->bitmap[cur_map_idx], ~RUN_MASK(bit, take));
+      n -= take;
+      bit = 0;
+      ++cur_map_idx;
+   }
+}
+
+// Claims n blocks starting at block start; 0 (with nothing claimed) if any was taken.
+static int claim_run(bit_heap_t * h, uint32_t start, uint32_t n) {
+   uint32_t cur_map_idx = start >> 5;
+   uint32_t bit = start & 0x1F;
+   uint32_t left = n, take;
+
+   while(left > 0) {
+      take = (left < BITMAP - bit) ? left : BITMAP - bit;
+      if(!claim_bits(h, &h->bitmap[cur_map_idx], RUN_MASK(bit, take))) {
+         release_run(h, start, n - left);
+         return 0;
+      }
+      left -= take;
+      bit = 0;
+      ++cur_map_idx;
+   }
+   return 1;
+}
+
+// find_run over a snapshot of the bitmap, without the summary layer.
+static int32_t find_run_snapshot(bit_heap_t * h, uint32_t first, uint32_t n) {
+   uint32_t cur_map_idx, current_map, free_map, len;
+   uint32_t run = 0, run_start = 0;
+
+   for(cur_map_idx = first; cur_map_idx < h->mapblocks; ++cur_map_idx) {
+      STAT_STEP(&h->stats);
+      COST_META_LOAD(&h->cost, 1);
+      current_map = MAP_LOAD(&h->bitmap[cur_map_idx]);
+      if(run == 0) {
+         run_start = cur_map_idx << 5;
+      }
+
+      if(current_map == 0) {
+         run += BITMAP;
+         if(run >= n) {
+            return run_start;
+         }
+         continue;
+      }
+
+      if(run + CTZ(current_map) >= n) {
+         return run_start;
+      }
+
+      if(n < BITMAP) {
+         free_map = ~current_map;
+         for(len = 1; (len << 1) <= n; len <<= 1) {
+            free_map &= free_map >> len;
+         }
+         if(len < n) {
+            free_map &= free_map >> (n - len);
+         }
+         if(free_map) {
+            return (cur_map_idx << 5) + CTZ(free_map);
+         }
+      }
+
+      run = CLZ(current_map);
+      run_start = (cur_map_idx << 5) + BITMAP - run;
+   }
+   return -1;
+}
+
+// Searches and claims until a claim sticks. A failed claim means another thread made
+// progress, so the search restarts from the same place on a fresh snapshot.
+static int32_t claim_first_fit(bit_heap_t * h, uint32_t n) {
+   int32_t start;
+#ifdef __BIT_NEXT_FIT__
+   uint32_t first = __atomic_load_n(&h->next_fit_word, __ATOMIC_RELAXED);
+#else
+   uint32_t first = 0;
+#endif
+
+   for(;;) {
+      start = find_run_snapshot(h, first, n);
+      if(start < 0 && first > 0) {
+         first = 0;
+         continue;
+      }
+      if(start < 0 || claim_run(h, (uint32_t)start, n)) {
+         return start;
+      }
+   }
+}
+
+#endif /* __BIT_CONCURRENT__ */
+
+static void * bit_alloc_run(bit_heap_t * h, unsigned nbytes)
    {
   
-   uint32_t current_map;
-   uint32_t * addr;
-   uint32_t last_block = 0, cur_map_idx;
+   int32_t bitmap_start_bit;
 
    // Force at least one byte req.
    nbytes = (nbytes <=MIN_REQ_SIZE) ? MIN_REQ_SIZE : nbytes;
@@ -88,7 +500,7 @@ static uint8_t  lazyreserved = 0;
    // Begin Searching the bitmap.
    // --------------------------------------
    // First, find req'd number of bits.
-   uint16_t num_reqd_bits;
+   uint32_t num_reqd_bits;
 
    // check if we need to add an extra bit for nbytes with values inbetween mod 16.
    // See if we wrap over div FACTOR... if so, add an extra bit (partially waste a block of 16 bytes)
@@ -97,118 +509,631 @@ static uint8_t  lazyreserved = 0;
    // if we wrap, add the extra FACTOR bytes to the div of nbytes.
    num_reqd_bits = (mod_res==0) ? nbytes >> SHFTFACTOR : ((nbytes - mod_res)>>SHFTFACTOR) +1;
 
-   uint16_t cur_bits_aqd      = 0; //Store bits acquired.
-   uint16_t bitmap_start_bit  = 0; //Where to begin the mapping.
-   uint16_t bitmap_end_bit    = 0;
-   uint16_t real_bit_mod_res;
-   uint16_t map_index;
+#ifdef __BIT_CONCURRENT__
+   bitmap_start_bit = claim_first_fit(h, num_reqd_bits);
+   if(bitmap_start_bit < 0) {
+      return NULL;
+   }
+
+   uint32_t end_bit = bitmap_start_bit + num_reqd_bits - 1;
+
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   MAP_OR(&h->endmap[end_bit >> 5], 1u << (end_bit & 0x1F));
+#ifdef __BIT_NEXT_FIT__
+   __atomic_store_n(&h->next_fit_word, end_bit >> 5, __ATOMIC_RELAXED);
+#endif
+#elif defined(__BIT_REGION_LOCKS__)
+   uint32_t region, tried, first, end;
+
+   if(!__atomic_load_n(&h->summary_ready, __ATOMIC_ACQUIRE)) {
+      lock_all(h);
+      if(!h->summary_ready) {
+         init_summary(h);
+      }
+      unlock_all(h);
+   }
+   if(home_region < 0) {
+      home_region = (int32_t)__atomic_fetch_add(&next_home, 1, __ATOMIC_RELAXED);
+   }
+
+   bitmap_start_bit = -1;
+   if(num_reqd_bits <= BIT_REGION_WORDS * BITMAP) {
+      for(tried = 0; tried < h->regions && bitmap_start_bit < 0; ++tried) {
+         region = ((uint32_t)home_region + tried) % h->regions;
+         first = region * BIT_REGION_WORDS;
+         end = (first + BIT_REGION_WORDS < h->mapblocks) ? first + BIT_REGION_WORDS : h->mapblocks;
+
+         FINE_LOCK(&h->region_lock[region]);
+         bitmap_start_bit = find_run(h, first, end, num_reqd_bits);
+         if(bitmap_start_bit >= 0) {
+            uint32_t end_bit = bitmap_start_bit + num_reqd_bits - 1;
+            mark_run(h, bitmap_start_bit, num_reqd_bits, 1);
+            COST_META_LOAD(&h->cost, 1);
+            COST_META_STORE(&h->cost, 1);
+            h->endmap[end_bit >> 5] |= 1u << (end_bit & 0x1F);
+         }
+         FINE_UNLOCK(&h->region_lock[region]);
+      }
+   }
+   if(bitmap_start_bit < 0) {
+      lock_all(h);
+      bitmap_start_bit = find_run(h, 0, h->mapblocks, num_reqd_bits);
+      if(bitmap_start_bit >= 0) {
+         uint32_t end_bit = bitmap_start_bit + num_reqd_bits - 1;
+         mark_run(h, bitmap_start_bit, num_reqd_bits, 1);
+         COST_META_LOAD(&h->cost, 1);
+         COST_META_STORE(&h->cost, 1);
+         h->endmap[end_bit >> 5] |= 1u << (end_bit & 0x1F);
+      }
+      unlock_all(h);
+   }
+   if(bitmap_start_bit < 0) {
+      return NULL;
+   }
+#else
+   if(!h->summary_ready) {
+      init_summary(h);
+   }
 
    // Searching for free space within the bitmap.
-   for(cur_map_idx = 0; cur_map_idx < MAPBLOCKS; ++cur_map_idx) {
-      current_map = bitmap[cur_map_idx];
-      for(int bit = 0; bit < 32; ++bit) {
-         // Check each bit by ROL the bit map.
-         cur_bits_aqd = !(ROL(0x01,bit)&(current_map)) ? cur_bits_aqd+1 : 0;
-         // Maintain State of which bit we end on.
-         ++bitmap_end_bit;
+#ifdef __BIT_NEXT_FIT__
+   bitmap_start_bit = find_run(h, h->next_fit_word, h->mapblocks, num_reqd_bits);
+   if(bitmap_start_bit < 0 && h->next_fit_word > 0) {
+      bitmap_start_bit = find_run(h, 0, h->mapblocks, num_reqd_bits);
+   }
+#else
+   bitmap_start_bit = find_run(h, 0, h->mapblocks, num_reqd_bits);
+#endif
+   if(bitmap_start_bit < 0) {
+      return NULL;
+   }
+
+   uint32_t end_bit = bitmap_start_bit + num_reqd_bits - 1;
+
+   mark_run(h, bitmap_start_bit, num_reqd_bits, 1);
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   h->endmap[end_bit >> 5] |= 1u << (end_bit & 0x1F);
+#ifdef __BIT_NEXT_FIT__
+   h->next_fit_word = end_bit >> 5;
+#endif
+#endif
 
-         if(cur_bits_aqd == num_reqd_bits) {
-            bitmap_start_bit = bitmap_end_bit - num_reqd_bits;
-            goto BLOCK_CLAIM;
+   return (void *)(h->arena + ((uint32_t)bitmap_start_bit << SHFTFACTOR));
+}
+
+// Searches for n free blocks starting at one of the blocks first, first + step, ... (the
+// blocks with the alignment asked for) and returns that block (or -1). A candidate that
+// runs into a reserved block moves on to the first candidate past the last reserved block
+// of that word, so no word is read twice for the same reserved blocks.
+static int32_t find_aligned_run(bit_heap_t * h, uint32_t first, uint32_t step, uint32_t n) {
+   uint32_t blocks = h->mapblocks * BITMAP;
+   uint32_t start = first, pos, bit, take, used = 0;
+
+   while(start < blocks && n <= blocks - start) {
+      for(pos = start; pos < start + n; pos += take) {
+         bit = pos & 0x1F;
+         take = (start + n - pos < BITMAP - bit) ? start + n - pos : BITMAP - bit;
+         STAT_STEP(&h->stats);
+         COST_META_LOAD(&h->cost, 1);
+         used = MAP_LOAD(&h->bitmap[pos >> 5]) & RUN_MASK(bit, take);
+         if(used) {
+            break;
          }
       }
+      if(!used) {
+         return start;
+      }
+      pos = (pos & ~0x1Fu) + BITMAP - CLZ(used);
+      start = first + ((pos - first + step - 1) & ~(step - 1));
+   }
+   return -1;
+}
+
+// bit_alloc_run for a block whose address is a multiple of alignment (a power of two). The
+// arena is aligned to ARENA_ALIGN, so for alignments up to FACTOR every block qualifies,
+// and beyond that every (alignment/FACTOR)-th block from the first aligned one.
+static void * bit_alloc_aligned(bit_heap_t * h, unsigned alignment, unsigned nbytes)
+   {
+   int32_t bitmap_start_bit;
+   // Rounded up as bit_alloc_run does, so sizes near 2^32 cannot wrap to a short run.
+   uint32_t num_reqd_bits = (nbytes <= MIN_REQ_SIZE) ? MIN_REQ_SIZE >> SHFTFACTOR :
+                            (nbytes >> SHFTFACTOR) + ((nbytes & (LT_FAC)) != 0);
+   uint32_t first, step, end_bit;
+
+   if(num_reqd_bits > h->mapblocks * BITMAP) {
+      return NULL;
+   }
+   if(alignment < FACTOR) {
+      alignment = FACTOR;
+   }
+   first = (uint32_t)((alignment - ((uintptr_t)h->arena & (alignment - 1))) & (alignment - 1)) >> SHFTFACTOR;
+   step = alignment >> SHFTFACTOR;
+
+#ifdef __BIT_CONCURRENT__
+   do {
+      bitmap_start_bit = find_aligned_run(h, first, step, num_reqd_bits);
+   } while(bitmap_start_bit >= 0 && !claim_run(h, (uint32_t)bitmap_start_bit, num_reqd_bits));
+   if(bitmap_start_bit < 0) {
+      return NULL;
+   }
+   end_bit = bitmap_start_bit + num_reqd_bits - 1;
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   MAP_OR(&h->endmap[end_bit >> 5], 1u << (end_bit & 0x1F));
+#else
+   // Aligned requests are rare enough that region-locked heaps take every lock for them.
+#ifdef __BIT_REGION_LOCKS__
+   lock_all(h);
+#endif
+   if(!h->summary_ready) {
+      init_summary(h);
+   }
+   bitmap_start_bit = find_aligned_run(h, first, step, num_reqd_bits);
+   if(bitmap_start_bit >= 0) {
+      end_bit = bitmap_start_bit + num_reqd_bits - 1;
+      mark_run(h, bitmap_start_bit, num_reqd_bits, 1);
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      h->endmap[end_bit >> 5] |= 1u << (end_bit & 0x1F);
+   }
+#ifdef __BIT_REGION_LOCKS__
+   unlock_all(h);
+#endif
+   if(bitmap_start_bit < 0) {
+      return NULL;
    }
+#endif
 
-   printf("No available memory.\n");
-   return NULL;
+   return (void *)(h->arena + ((uint32_t)bitmap_start_bit << SHFTFACTOR));
+}
 
-   BLOCK_CLAIM:
+#ifndef __BIT_CONCURRENT__
+// Searches the bitmap from word first up to (not including) word end for up to count runs of
+// n free blocks, in one pass: every maximal run of free blocks is cut into as many n-block
+// runs as it holds, end to end, before the search moves on, so no word is read twice. Their
+// addresses go to out[]; returns how many were found. Nothing is claimed (see mark_runs).
+static uint32_t find_runs(bit_heap_t * h, uint32_t first, uint32_t end, uint32_t n, uint32_t count, void ** out) {
+   uint32_t cur_map_idx, current_map, rest, bit, len;
+   uint32_t run = 0, run_start = 0, got = 0;
 
-      real_bit_mod_res = bitmap_start_bit&(0x1F);      
-      map_index = (real_bit_mod_res==0) ? bitmap_start_bit>>5 : (bitmap_start_bit - real_bit_mod_res)>>5;
+   cur_map_idx = first;
+   while(cur_map_idx < end && got < count) {
+      STAT_STEP(&h->stats);
+      COST_META_LOAD(&h->cost, 1);
+      if(h->maxrun[cur_map_idx] == 0) {
+         cur_map_idx = next_open_word(h, cur_map_idx, end);
+         run = 0;
+         continue;
+      }
 
-      addr = arena_b + (bitmap_start_bit << SHFTFACTOR);
-      bitsize[bitmap_start_bit] = num_reqd_bits;
-      
-      cur_bits_aqd = 0;
+      COST_META_LOAD(&h->cost, 1);
+      current_map = h->bitmap[cur_map_idx];
+      for(bit = 0; bit < BITMAP && got < count; bit += len) {
+         rest = current_map >> bit;
+         if(rest & 0x1) {
+            len = (~rest) ? CTZ(~rest) : BITMAP;
+            run = 0;
+            continue;
+         }
+         len = rest ? CTZ(rest) : BITMAP - bit;
+         if(run == 0) {
+            run_start = (cur_map_idx << 5) + bit;
+         }
+         for(run += len; run >= n && got < count; run -= n) {
+            out[got++] = (void *)(h->arena + (run_start << SHFTFACTOR));
+            run_start += n;
+         }
+      }
+      ++cur_map_idx;
+   }
+   return got;
+}
+
+// Sets (claim != 0) or clears the runs at ptrs[0 .. count), skipping NULL entries, and their
+// end markers. Claimed runs are n blocks long; released ones (n == 0) as long as their end
+// marker says. The masks of consecutive runs that share a bitmap or endmap word are merged,
+// so that word is written, and summarized, once: a batch laid out end to end costs one write
+// per word it covers instead of one per run.
+static void mark_runs(bit_heap_t * h, void ** ptrs, uint32_t count, uint32_t n, int claim) {
+   uint32_t i, start, len, pos, bit, take, end_bit;
+   uint32_t map_idx = 0, mask = 0, end_idx = 0, ends = 0;
+
+   for(i = 0; i < count; ++i) {
+      if(!ptrs[i]) {
+         continue;
+      }
+      start = (uint32_t)(((char *)ptrs[i] - h->arena) >> SHFTFACTOR);
+      len = claim ? n : run_length(h, start);
 
-      for(cur_map_idx = map_index; cur_map_idx < MAPBLOCKS; ++cur_map_idx) {
-         current_map = bitmap[cur_map_idx];
-         for(int bit = real_bit_mod_res; bit < 32; ++bit) {
-            current_map |= 1<<bit;
-            ++cur_bits_aqd;
-            if(cur_bits_aqd == num_reqd_bits) {
-               bitmap[cur_map_idx] = current_map;
-               goto RET_ADDR;
-            }
+      for(pos = start; pos < start + len; pos += take) {
+         bit = pos & 0x1F;
+         take = (start + len - pos < BITMAP - bit) ? start + len - pos : BITMAP - bit;
+         if(mask && (pos >> 5) != map_idx) {
+            COST_META_LOAD(&h->cost, 1);
+            COST_META_STORE(&h->cost, 1);
+            h->bitmap[map_idx] = claim ? (h->bitmap[map_idx] | mask) : (h->bitmap[map_idx] & ~mask);
+            summarize(h, map_idx);
+            mask = 0;
          }
-         bitmap[cur_map_idx] = current_map;
-         real_bit_mod_res = 0;
+         map_idx = pos >> 5;
+         mask |= RUN_MASK(bit, take);
       }
 
-   RET_ADDR:
-      return (void *)addr;
+      end_bit = start + len - 1;
+      if(ends && (end_bit >> 5) != end_idx) {
+         COST_META_LOAD(&h->cost, 1);
+         COST_META_STORE(&h->cost, 1);
+         h->endmap[end_idx] = claim ? (h->endmap[end_idx] | ends) : (h->endmap[end_idx] & ~ends);
+         ends = 0;
+      }
+      end_idx = end_bit >> 5;
+      ends |= 1u << (end_bit & 0x1F);
+   }
+   if(mask) {
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      h->bitmap[map_idx] = claim ? (h->bitmap[map_idx] | mask) : (h->bitmap[map_idx] & ~mask);
+      summarize(h, map_idx);
+   }
+   if(ends) {
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      h->endmap[end_idx] = claim ? (h->endmap[end_idx] | ends) : (h->endmap[end_idx] & ~ends);
+   }
 }
+#endif
 
-#ifdef __DO_NOT_INLINE__ 
-   void __attribute__ ((noinline)) bit_free(void * p) 
+// bit_alloc_run for up to count runs of n blocks, stored to out[]; returns how many. The
+// search is made once for the whole batch (find_runs), and the runs found are claimed
+// together (mark_runs). Region-locked heaps take every lock for a batch. Concurrent heaps
+// claim run by run, as a CAS has to, but each search resumes where the last run ended.
+static uint32_t bit_alloc_runs(bit_heap_t * h, uint32_t n, uint32_t count, void ** out)
+   {
+   uint32_t got = 0;
+#ifdef __BIT_CONCURRENT__
+   uint32_t first = 0, end_bit;
+   int32_t start;
+
+   while(got < count) {
+      do {
+         start = find_run_snapshot(h, first, n);
+      } while(start >= 0 && !claim_run(h, (uint32_t)start, n));
+      if(start < 0) {
+         break;
+      }
+      end_bit = start + n - 1;
+      COST_META_LOAD(&h->cost, 1);
+      COST_META_STORE(&h->cost, 1);
+      MAP_OR(&h->endmap[end_bit >> 5], 1u << (end_bit & 0x1F));
+      out[got++] = (void *)(h->arena + ((uint32_t)start << SHFTFACTOR));
+      first = end_bit >> 5;
+   }
 #else
-   void bit_free(void * p) 
+#ifdef __BIT_REGION_LOCKS__
+   lock_all(h);
+#endif
+   if(!h->summary_ready) {
+      init_summary(h);
+   }
+#ifdef __BIT_NEXT_FIT__
+   got = find_runs(h, h->next_fit_word, h->mapblocks, n, count, out);
+   mark_runs(h, out, got, n, 1);
+   if(got < count && h->next_fit_word > 0) {
+      // Wrap around; the runs claimed above are no longer free, so they are not found twice.
+      uint32_t more = find_runs(h, 0, h->mapblocks, n, count - got, out + got);
+
+      mark_runs(h, out + got, more, n, 1);
+      got += more;
+   }
+   if(got > 0) {
+      h->next_fit_word = (uint32_t)((((char *)out[got - 1] - h->arena) >> SHFTFACTOR) + n - 1) >> 5;
+   }
+#else
+   got = find_runs(h, 0, h->mapblocks, n, count, out);
+   mark_runs(h, out, got, n, 1);
+#endif
+#ifdef __BIT_REGION_LOCKS__
+   unlock_all(h);
+#endif
+#endif
+   return got;
+}
+
+static void bit_release(bit_heap_t * h, void * p);
+
+#ifndef BIT_THREADED
+// Returns every run held by the lazy-free cache to the bitmap; nonzero if there were any.
+static uint8_t lazy_flush(bit_heap_t * h) {
+   uint8_t flushed = 0;
+
+   for(int c = 0; c < LAZY_CLASSES; ++c) {
+      while(h->lazyreserved[c] > 0) {
+         COST_META_LOAD(&h->cost, 1);
+         bit_release(h, h->lazyhold[c][--h->lazyreserved[c]]);
+         flushed = 1;
+      }
+   }
+   return flushed;
+}
+#endif
+
+// Lays a heap out over [base, base+bytes): the heap state and its maps first, then the
+// arena (aligned to ARENA_ALIGN), which gets as many whole 32-block bitmap words as fit. Returns NULL when the
+// region cannot hold a single word.
+bit_heap_t * bit_heap_init(void * base, size_t bytes) {
+   uintptr_t start = ((uintptr_t)base + 7) & ~(uintptr_t)7;
+   uintptr_t end = (uintptr_t)base + bytes;
+   uintptr_t meta = start + ((sizeof(bit_heap_t) + 7) & ~(size_t)7);
+   bit_heap_t * h = (bit_heap_t *)start;
+   uint64_t words, summary, need, regions = 0;
+
+   if(!base || end < meta) {
+      return NULL;
+   }
+   // Each bitmap word costs BITMAP blocks of arena, two map words, a maxrun byte and a
+   // fullmap bit; start from that estimate and back off until the rounded layout fits.
+   words = (end - meta) / (BITMAP * FACTOR + 2 * sizeof(uint32_t) + 1 + 1);
+   for(;;) {
+      if(words == 0) {
+         return NULL;
+      }
+      summary = (words + BITMAP - 1) / BITMAP;
+#ifdef __BIT_REGION_LOCKS__
+      regions = (words + BIT_REGION_WORDS - 1) / BIT_REGION_WORDS;
+#endif
+      need = ((meta + (words * 2 + summary) * sizeof(uint32_t) + words + regions * sizeof(uint8_t) + ARENA_ALIGN - 1) & ~(uint64_t)(ARENA_ALIGN - 1)) - meta + words * BITMAP * FACTOR;
+      if(need <= end - meta) {
+         break;
+      }
+      --words;
+   }
+
+   memset(h, 0, sizeof(bit_heap_t));
+   h->bitmap       = (uint32_t *)meta;
+   h->endmap       = h->bitmap + words;
+   h->fullmap      = h->endmap + words;
+   h->maxrun       = (uint8_t *)(h->fullmap + summary);
+   h->arena        = (char *)(((uintptr_t)(h->maxrun + words + regions) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+   h->mapblocks    = (uint32_t)words;
+   h->summarywords = (uint32_t)summary;
+   memset(h->bitmap, 0, (words * 2 + summary) * sizeof(uint32_t));
+#ifdef __BIT_REGION_LOCKS__
+   h->region_lock  = (fine_lock_t *)(h->maxrun + words);
+   h->regions      = (uint32_t)regions;
+   memset(h->region_lock, 0, regions * sizeof(fine_lock_t));
+#endif
+#ifndef __BIT_CONCURRENT__
+   init_summary(h);
+#endif
+   return h;
+}
+
+// A request for a run length that has a block waiting in the lazy-free cache is served
+// from there. Otherwise the bitmap is searched, and on failure the cache is flushed and
+// the search retried once.
+static void * bit_serve(bit_heap_t * h, unsigned nbytes)
+   {
+   void * vp;
+#ifdef BIT_THREADED
+   vp = bit_alloc_run(h, nbytes);
+#else
+   uint32_t lclass = ((((nbytes <= MIN_REQ_SIZE) ? MIN_REQ_SIZE : nbytes) + (LT_FAC)) >> SHFTFACTOR) - 1;
+
+   if(lclass < LAZY_CLASSES && h->lazyreserved[lclass] > 0) {
+      COST_META_LOAD(&h->cost, 1);
+      return h->lazyhold[lclass][--h->lazyreserved[lclass]];
+   }
+
+   vp = bit_alloc_run(h, nbytes);
+   if(!vp && lazy_flush(h)) {
+      vp = bit_alloc_run(h, nbytes);
+   }
 #endif
+#ifdef __DEBUG__
+   if(!vp) {
+      printf("No available memory.\n");
+   }
+#endif
+   return vp;
+}
+
+// bit_serve for count runs of n blocks: the lazy-free cache of that length is emptied first,
+// the rest comes from one batch search of the bitmap, retried once after a flush.
+static uint32_t bit_serve_batch(bit_heap_t * h, uint32_t n, uint32_t count, void ** out)
+   {
+   uint32_t got = 0;
+#ifndef BIT_THREADED
+   uint32_t lclass = n - 1;
+
+   while(got < count && lclass < LAZY_CLASSES && h->lazyreserved[lclass] > 0) {
+      COST_META_LOAD(&h->cost, 1);
+      out[got++] = h->lazyhold[lclass][--h->lazyreserved[lclass]];
+   }
+#endif
+   got += bit_alloc_runs(h, n, count - got, out + got);
+#ifndef BIT_THREADED
+   if(got < count && lazy_flush(h)) {
+      got += bit_alloc_runs(h, n, count - got, out + got);
+   }
+#endif
+   return got;
+}
+
+void * bit_heap_malloc(bit_heap_t * h, unsigned nbytes)
 {
-   uint16_t bitmap_start_bit = (uint16_t)(((uint32_t *)p - arena_b) >> SHFTFACTOR);
-   uint16_t real_bit_mod_res = bitmap_start_bit&(0x1F);      
-   uint16_t map_index = (real_bit_mod_res==0) ? bitmap_start_bit>>5 : (bitmap_start_bit - real_bit_mod_res)>>5;
+   COST_CALL(&h->cost, COST_MALLOC);
+   void * vp = bit_serve(h, nbytes);
 
-   uint16_t bits_to_free = bitsize[bitmap_start_bit];   
-   for(int cur_map_idx = map_index; cur_map_idx < MAPBLOCKS; ++cur_map_idx) {
-      uint32_t current_map = bitmap[cur_map_idx];
-      for(int bit = real_bit_mod_res; bit < 32; ++bit) {
-         current_map &= ROL(0xFFFFFFFE, (bit));
-         --bits_to_free;
-         if(bits_to_free == 0) {
-            bitmap[cur_map_idx] = current_map;
-            return;
-         }
+   STAT_MALLOC(&h->stats, nbytes, vp, BLOCK_BYTES(h, vp));
+   return vp;
+}
+
+// Aligned requests go straight to the bitmap (the lazy-free cache holds runs of a length,
+// not of an alignment); on failure the cache is flushed and the search retried once.
+void * bit_heap_memalign(bit_heap_t * h, unsigned alignment, unsigned nbytes)
+{
+   COST_CALL(&h->cost, COST_MALLOC);
+   void * vp = NULL;
+
+   if(alignment != 0 && (alignment & (alignment - 1)) == 0) {
+      vp = bit_alloc_aligned(h, alignment, nbytes);
+#ifndef BIT_THREADED
+      if(!vp && lazy_flush(h)) {
+         vp = bit_alloc_aligned(h, alignment, nbytes);
       }
-      bitmap[cur_map_idx] = current_map;
+#endif
    }
+   STAT_MALLOC(&h->stats, nbytes, vp, BLOCK_BYTES(h, vp));
+   return vp;
 }
 
-void * bit_calloc(unsigned nelem, unsigned elsize) {
+// Clears the run at p and its end marker (the statistics are left to the callers).
+static void bit_release(bit_heap_t * h, void * p) 
+{
+   uint32_t bitmap_start_bit, num_bits, end_bit;
+
+   bitmap_start_bit = (uint32_t)(((char *)p - h->arena) >> SHFTFACTOR);
+#ifdef __BIT_REGION_LOCKS__
+   uint32_t region = (bitmap_start_bit >> 5) / BIT_REGION_WORDS;
+
+   FINE_LOCK(&h->region_lock[region]);
+   num_bits = region_run_length(h, bitmap_start_bit);
+   if(num_bits == 0) {
+      // The run leaves its region: release it with every lock held.
+      FINE_UNLOCK(&h->region_lock[region]);
+      lock_all(h);
+      num_bits = run_length(h, bitmap_start_bit);
+   }
+   end_bit = bitmap_start_bit + num_bits - 1;
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   h->endmap[end_bit >> 5] &= ~(1u << (end_bit & 0x1F));
+   mark_run(h, bitmap_start_bit, num_bits, 0);
+   if(end_bit >> 5 < (region + 1) * BIT_REGION_WORDS) {
+      FINE_UNLOCK(&h->region_lock[region]);
+   } else {
+      unlock_all(h);
+   }
+   return;
+#endif
+   num_bits = run_length(h, bitmap_start_bit);
+   end_bit = bitmap_start_bit + num_bits - 1;
+
+#ifdef __BIT_CONCURRENT__
+   // The end marker goes first, so whoever claims these blocks next starts from a clean endmap.
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   MAP_AND(&h->endmap[end_bit >> 5], ~(1u << (end_bit & 0x1F)));
+   release_run(h, bitmap_start_bit, num_bits);
+#else
+   COST_META_LOAD(&h->cost, 1);
+   COST_META_STORE(&h->cost, 1);
+   h->endmap[end_bit >> 5] &= ~(1u << (end_bit & 0x1F));
+   mark_run(h, bitmap_start_bit, num_bits, 0);
+#endif
+}
+
+void bit_heap_free(bit_heap_t * h, void * p) 
+{
+   COST_CALL(&h->cost, COST_FREE);
+   if(!p) {
+      return;
+   }
+   STAT_FREE(&h->stats, p, BLOCK_BYTES(h, p));
+   bit_release(h, p);
+}
+
+// count blocks of nbytes each, as count calls of bit_heap_malloc would hand them out but for
+// one search and one write per bitmap word (see bit_alloc_runs). Returns how many were
+// allocated; out[] past them is NULL.
+unsigned bit_heap_malloc_batch(bit_heap_t * h, unsigned count, unsigned nbytes, void ** out)
+{
+   COST_CALL(&h->cost, COST_MALLOC);
+   uint32_t n = (nbytes <= MIN_REQ_SIZE) ? MIN_REQ_SIZE >> SHFTFACTOR :
+                (nbytes >> SHFTFACTOR) + ((nbytes & (LT_FAC)) != 0);
+   uint32_t got = (n <= h->mapblocks * BITMAP) ? bit_serve_batch(h, n, count, out) : 0, i;
+
+   for(i = got; i < count; ++i) {
+      out[i] = NULL;
+   }
+#ifdef __ALLOC_STATS__
+   for(i = 0; i < count; ++i) {
+      STAT_MALLOC(&h->stats, nbytes, out[i], n << SHFTFACTOR);
+   }
+#endif
+   return got;
+}
+
+// Frees every non-NULL block of ptrs[]. Blocks next to each other in ptrs[] and in the
+// arena share their bitmap and endmap writes (see mark_runs), so a batch handed out by
+// bit_heap_malloc_batch goes back for one write per word. Region-locked heaps take every
+// lock for a batch; concurrent ones release block by block.
+void bit_heap_free_batch(bit_heap_t * h, void ** ptrs, unsigned count)
+{
+   COST_CALL(&h->cost, COST_FREE);
+#ifdef __ALLOC_STATS__
+   for(unsigned i = 0; i < count; ++i) {
+      STAT_FREE(&h->stats, ptrs[i], BLOCK_BYTES(h, ptrs[i]));
+   }
+#endif
+#ifdef __BIT_CONCURRENT__
+   for(unsigned i = 0; i < count; ++i) {
+      if(ptrs[i]) {
+         bit_release(h, ptrs[i]);
+      }
+   }
+#else
+#ifdef __BIT_REGION_LOCKS__
+   lock_all(h);
+#endif
+   mark_runs(h, ptrs, count, 0, 0);
+#ifdef __BIT_REGION_LOCKS__
+   unlock_all(h);
+#endif
+#endif
+}
+
+void * bit_heap_calloc(bit_heap_t * h, unsigned nelem, unsigned elsize) {
+   COST_CALL(&h->cost, COST_CALLOC);
    unsigned nbytes;
    unsigned char * cvp;
    unsigned int i = 0;
 
    nbytes = nelem * elsize;
-   cvp = (unsigned char *)bit_malloc(nbytes);
+   cvp = (unsigned char *)bit_heap_malloc(h, nbytes);
    if (!cvp){
       return NULL;
    }
 
+   COST_ARENA_STORE(&h->cost, (nbytes + 3) >> 2);
    for(i=0; i< nbytes; ++i) {
       cvp[i]='\0';
    }
    return (void *)cvp;
 }
 
-void * bit_realloc(void * vp, unsigned newbytes) {
-   char *cnewp, *cvp;
-   uint16_t starting_bit_num = ((uint16_t)((uint32_t *)vp - arena_b) >> SHFTFACTOR);
-   uint16_t bits_to_free = bitsize[starting_bit_num];   
+void * bit_heap_realloc(bit_heap_t * h, void * vp, unsigned newbytes) {
+   COST_CALL(&h->cost, COST_REALLOC);
+   char *cnewp = NULL, *cvp;
+   uint32_t starting_bit_num, bits_to_free;
 
    int idx = 0;
    /* behavior on corner cases conforms to SUSv2 */
    cvp = (char *)vp;
 
    if (!cvp) {
-      return bit_malloc(newbytes);
+      return bit_heap_malloc(h, newbytes);
    }
 
+   starting_bit_num = (uint32_t)((cvp - h->arena) >> SHFTFACTOR);
+   bits_to_free = RUN_LENGTH(h, starting_bit_num);
+
    if (newbytes != 0) {
       uint64_t bytes;
 
-      cnewp = (char *)bit_malloc(newbytes);
+      cnewp = (char *)bit_heap_malloc(h, newbytes);
       if(!cnewp) {
          return NULL;
       }
@@ -218,29 +1143,169 @@ void * bit_realloc(void * vp, unsigned newbytes) {
       if (bytes > newbytes){
          bytes = newbytes;
       }
+      COST_ARENA_LOAD(&h->cost, (bytes + 3) >> 2);
+      COST_ARENA_STORE(&h->cost, (bytes + 3) >> 2);
 
       for(idx = 0; idx < bytes; ++ idx) {
          cnewp[idx]=cvp[idx];
       }
    }
 
-   bit_free(cvp);
+   bit_heap_free(h, cvp);
    return (void *)cnewp;
 }
 
+void bit_heap_lazyfree(bit_heap_t * h, void * vp) {
+  COST_CALL(&h->cost, COST_FREE);
+  if(!vp) {
+    return;
+  }
+
+#ifndef BIT_THREADED
+  uint32_t lclass = run_length(h, (uint32_t)(((char *)vp - h->arena) >> SHFTFACTOR)) - 1;
+
+  if(lclass < LAZY_CLASSES && h->lazyreserved[lclass] < LAZY_DEPTH) {
+    STAT_FREE(&h->stats, vp, (lclass + 1) << SHFTFACTOR);
+    COST_META_STORE(&h->cost, 1);
+    h->lazyhold[lclass][h->lazyreserved[lclass]++] = vp;
+    return;
+  }
+#endif
+  bit_heap_free(h, vp);
+}
+
+#ifdef __ALLOC_STATS__
+// Free space is read off the bitmap: every clear bit is a free block, and the longest run
+// of clear bits is the largest request that could still succeed.
+void bit_heap_get_stats(bit_heap_t * h, mem_stats_t * s) {
+   uint32_t cur_map_idx, current_map, bit;
+   uint32_t free_blocks = 0, run = 0, longest = 0;
+
+   for(cur_map_idx = 0; cur_map_idx < h->mapblocks; ++cur_map_idx) {
+      current_map = MAP_LOAD(&h->bitmap[cur_map_idx]);
+      for(bit = 0; bit < BITMAP; ++bit) {
+         if((current_map >> bit) & 0x1) {
+            run = 0;
+            continue;
+         }
+         ++free_blocks;
+         if(++run > longest) {
+            longest = run;
+         }
+      }
+   }
+   *s = h->stats;
+   STAT_FINISH(s, free_blocks << SHFTFACTOR, longest << SHFTFACTOR);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void bit_heap_get_cost(bit_heap_t * h, mem_cost_t * c) {
+   *c = h->cost;
+}
+#endif
+
+#ifdef __HEAP_MAP__
+// Every maximal run of clear bits is one free block.
+void bit_heap_map(bit_heap_t * h, mem_map_t * m) {
+   uint32_t cur_map_idx, current_map, bit, block;
+   uint32_t run = 0;
+
+   map_start(m, (h->mapblocks * BITMAP) << SHFTFACTOR);
+   for(cur_map_idx = 0; cur_map_idx < h->mapblocks; ++cur_map_idx) {
+      current_map = MAP_LOAD(&h->bitmap[cur_map_idx]);
+      for(bit = 0; bit < BITMAP; ++bit) {
+         block = cur_map_idx * BITMAP + bit;
+         if(!((current_map >> bit) & 0x1)) {
+            ++run;
+            continue;
+         }
+         map_free_block(m, (block - run) << SHFTFACTOR, run << SHFTFACTOR);
+         run = 0;
+      }
+   }
+   map_free_block(m, ((h->mapblocks * BITMAP) - run) << SHFTFACTOR, run << SHFTFACTOR);
+   map_finish(m);
+}
+#endif
+
+
+//==------------------------------------------==//
+// [Default heap: the static arena of ARENA_BYTES]
+
+#ifdef __DO_NOT_INLINE__ 
+   void * __attribute__ ((noinline)) bit_malloc(unsigned nbytes)
+#else
+   void * bit_malloc(unsigned nbytes)
+#endif
+{
+   return bit_heap_malloc(&default_heap, nbytes);
+}
+
+#ifdef __DO_NOT_INLINE__ 
+   void __attribute__ ((noinline)) bit_free(void * p) 
+#else
+   void bit_free(void * p) 
+#endif
+{
+   bit_heap_free(&default_heap, p);
+}
+
+void * bit_calloc(unsigned nelem, unsigned elsize) {
+   return bit_heap_calloc(&default_heap, nelem, elsize);
+}
+
+void * bit_realloc(void * vp, unsigned newbytes) {
+   return bit_heap_realloc(&default_heap, vp, newbytes);
+}
+
+unsigned bit_malloc_batch(unsigned count, unsigned nbytes, void ** out) {
+   return bit_heap_malloc_batch(&default_heap, count, nbytes, out);
+}
+
+void bit_free_batch(void ** ptrs, unsigned count) {
+   bit_heap_free_batch(&default_heap, ptrs, count);
+}
+
+void * bit_memalign(unsigned alignment, unsigned nbytes) {
+   return bit_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+void * bit_aligned_alloc(unsigned alignment, unsigned nbytes) {
+   return bit_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+#ifdef __ALLOC_STATS__
+void bit_get_stats(mem_stats_t * s) {
+   bit_heap_get_stats(&default_heap, s);
+}
+#endif
+
+#ifdef __HEAP_MAP__
+void bit_map(mem_map_t * m) {
+   bit_heap_map(&default_heap, m);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void bit_get_cost(mem_cost_t * c) {
+   bit_heap_get_cost(&default_heap, c);
+}
+#endif
+
 #ifdef __DO_NOT_INLINE__ 
     void __attribute__ ((noinline)) bit_lazyfree(void * vp)
 #else   
     void bit_lazyfree(void * vp)
 #endif
 {
-  if(lazyreserved < 32) {
-    lazyhold[lazyreserved++] = (uint32_t)vp;
-  } else {
-    lazyreserved = 0;
-    bit_free(vp);
-    for(int i = 0; i < 32; ++i) {
-      bit_free((void*)lazyhold[i]);
-    }
-  }
+   bit_heap_lazyfree(&default_heap, vp);
+}
+
+#ifdef BIT_THREADED
+// Marks this build as safe to call from several threads at once; MemCast looks for it and
+// then leaves out the alloc_lock/alloc_unlock wrapping.
+int bit_threadsafe(void) {
+   return 1;
 }
+#endif
\ No newline at end of file
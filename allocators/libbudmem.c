@@ -53,25 +53,90 @@
 
 
 
-#define MAX_BUDDY_CHUNK 							(uint32_t)(ARENA_BYTES >> 2)				// dividing by 4 to represent 32-bit words.
-#define NUM_OF_LEAVES 								(uint32_t)(ARENA_BYTES/MIN_REQ_SIZE) 		
-#define NUM_OF_LEAVES_WORDS 						(uint32_t)(NUM_OF_LEAVES>>5)
 #define LOG2_MIN_REQ_SIZE 							(uint32_t)(BITS_TO_REPRESENT(MIN_REQ_SIZE)-1)
-#define TOTAL_LEVELS 								(uint32_t)(BITS_TO_REPRESENT(NUM_OF_LEAVES))
 
+// Geometry of the default heap, which lives in static arrays of ARENA_BYTES.
+#define MAX_BUDDY_CHUNK 							(uint32_t)(ARENA_BYTES >> 2)				// dividing by 4 to represent 32-bit words.
+#define DEFAULT_LEAVES 								(uint32_t)(ARENA_BYTES/MIN_REQ_SIZE) 		
+#define DEFAULT_LEVELS 								(uint32_t)(BITS_TO_REPRESENT(DEFAULT_LEAVES))
+#if (ARENA_BYTES/MIN_REQ_SIZE) <= 32768
+#define DEFAULT_CODE_SHIFT 							2
+#else
+#define DEFAULT_CODE_SHIFT 							3
+#endif
+#define DEFAULT_CODE_WORDS 							((DEFAULT_LEAVES >> (5 - DEFAULT_CODE_SHIFT)) ? (DEFAULT_LEAVES >> (5 - DEFAULT_CODE_SHIFT)) : 1)
+
+// Everything below is relative to the heap h in scope.
+#define NUM_OF_LEAVES 								(h->leaves)
+#define NUM_OF_LEAVES_WORDS 						(h->leaves >> 5)
+#define TOTAL_LEVELS 								(h->levels)
+#define BUDDY_ARENA 								(h->arena)
 
-typedef struct uintx_t {
-	uint32_t internal[NUM_OF_LEAVES_WORDS];
-} uintx_t;
+// Level 0 holds the leaves (MIN_REQ_SIZE blocks), level TOTAL_LEVELS-1 the whole arena.
+// Every level owns NUM_OF_LEAVES_WORDS words of h->tree, and its bits are packed into the
+// last of them; a set bit means the node is not entirely free (it, an ancestor or a
+// descendant is allocated).
+#define TREE(level) 								(h->tree + (level) * NUM_OF_LEAVES_WORDS)
+#define LEVEL_NODES(level) 							(NUM_OF_LEAVES >> (level))
+#define LEVEL_WORDS(level) 							((LEVEL_NODES(level) >> 5) ? (LEVEL_NODES(level) >> 5) : 1)
+#define LEVEL_BASE(level) 							(NUM_OF_LEAVES_WORDS - LEVEL_WORDS(level))
 
+// The level of each allocation is kept only at its first leaf, as a packed code: 4 bits
+// while there are at most 16 levels, 8 bits beyond that (h->code_shift is 2 or 3).
+#define LEVEL_CODE_SHIFT 							(h->code_shift)
+#define LEVEL_CODE_BITS 							(1 << LEVEL_CODE_SHIFT)
+#define LEVEL_CODE_MASK 							((1u << LEVEL_CODE_BITS) - 1)
+#define LEVEL_CODES_PER_WORD_LOG2 					(5 - LEVEL_CODE_SHIFT)
+#define LEVEL_CODE_POS(leaf) 						(((leaf) & ((1 << LEVEL_CODES_PER_WORD_LOG2) - 1)) << LEVEL_CODE_SHIFT)
+// With __ACCESS_COUNT__, reading a code is one metadata load and setting one a load and a store.
+#ifdef __BUDDY_LEVEL_LOCKS__
+// Codes of blocks owned by different threads share words, so they change bit-wise atomically.
+#define GET_LEVEL(leaf) 							(COST_META_LOAD(&h->cost, 1), (__atomic_load_n(&h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2], __ATOMIC_RELAXED) >> LEVEL_CODE_POS(leaf)) & LEVEL_CODE_MASK)
+#define SET_LEVEL(leaf, level) 						(COST_META_LOAD(&h->cost, 1), COST_META_STORE(&h->cost, 1), __atomic_fetch_and(&h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2], ~(LEVEL_CODE_MASK << LEVEL_CODE_POS(leaf)), __ATOMIC_RELAXED), \
+													__atomic_fetch_or(&h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2], (uint32_t)(level) << LEVEL_CODE_POS(leaf), __ATOMIC_RELAXED))
+#else
+#define GET_LEVEL(leaf) 							(COST_META_LOAD(&h->cost, 1), (h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2] >> LEVEL_CODE_POS(leaf)) & LEVEL_CODE_MASK)
+#define SET_LEVEL(leaf, level) 						(COST_META_LOAD(&h->cost, 1), COST_META_STORE(&h->cost, 1), h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2] = \
+													(h->level_codes[(leaf) >> LEVEL_CODES_PER_WORD_LOG2] & ~(LEVEL_CODE_MASK << LEVEL_CODE_POS(leaf))) | \
+													((uint32_t)(level) << LEVEL_CODE_POS(leaf)))
+#endif
 
-static uint32_t 	BUDDY_ARENA[MAX_BUDDY_CHUNK] 		= {0};
-static uint8_t 		ADDR_LUT[ARENA_BYTES] 				= {0};
-static uintx_t 		tree[TOTAL_LEVELS] 					= {0};
+// The state of one heap. The default heap points these at static arrays of ARENA_BYTES;
+// bud_heap_init carves them out of the caller's region instead.
+struct bud_heap {
+	char * 		arena;
+	uint32_t * 	tree;
+	uint32_t * 	level_codes;
+	uint32_t 	leaves;
+	uint32_t 	levels;
+	uint32_t 	code_shift;
+#ifdef __BUDDY_FREELIST__
+	uint32_t 	free_head[32];
+	uint32_t 	nonempty_levels;
+	uint8_t 	freelist_ready;
+#endif
+#ifdef __BUDDY_LEVEL_LOCKS__
+	// Each level's list, its TREE bits and the links in its blocks are guarded by the
+	// level's own lock, so threads working on different orders never wait on each other.
+	fine_lock_t level_lock[32];
+	uint32_t 	in_flight; 					// splits and merges holding blocks off every list
+#endif
+	/* For lazy free, keep up to LAZY_DEPTH freed blocks of each of the lowest LAZY_CLASSES levels */
+	void * 		lazyhold[LAZY_CLASSES][LAZY_DEPTH];
+	uint8_t  	lazyreserved[LAZY_CLASSES];
+#ifdef __ALLOC_STATS__
+	mem_stats_t stats;
+#endif
+#ifdef __ACCESS_COUNT__
+	mem_cost_t 	cost;
+#endif
+};
+_Static_assert(sizeof(bud_heap_t) <= HEAP_STATE_BYTES, "bud_heap_t outgrew HEAP_STATE_BYTES");
 
-/* For lazy free, store 32, 32-bit addresses */
-static uint32_t lazyhold[32];
-static uint8_t  lazyreserved = 0;
+static uint32_t 	default_arena[MAX_BUDDY_CHUNK] __attribute__ ((aligned(ARENA_ALIGN))) = {0};
+static uint32_t 	default_codes[DEFAULT_CODE_WORDS] 					= {0};
+static uint32_t 	default_tree[DEFAULT_LEVELS * (DEFAULT_LEAVES >> 5)] 	= {0};
+static bud_heap_t 	default_heap = { (char *)default_arena, default_tree, default_codes, DEFAULT_LEAVES, DEFAULT_LEVELS, DEFAULT_CODE_SHIFT };
 
 
 #define LT(n) n, n, n, n, n, n, n, n, n, n, n, n, n, n, n, n
@@ -98,106 +163,293 @@ uint32_t intlog2 (uint32_t v) {  	// 32-bit word to find the log of
 	return r;
 }
 
+// Bytes of the block at p, for the statistics.
+#define BLOCK_BYTES(p) 								(1u << (GET_LEVEL((uint32_t)(((char *)(p) - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE)) + LOG2_MIN_REQ_SIZE))
 
+#ifndef __BUDDY_LEVEL_LOCKS__
+// SET_LEVEL for count blocks of a level laid end to end from leaf on, merging the codes
+// that share a word into one write.
+static void set_levels(bud_heap_t * h, uint32_t leaf, uint32_t count, uint32_t level) {
+	uint32_t word = leaf >> LEVEL_CODES_PER_WORD_LOG2;
+	uint32_t keep = 0xFFFFFFFF, codes = 0;
 
-void __attribute__ ((always_inline)) update_tree(int level) {
-	uint32_t starting_idx, next_idx;
-	uint32_t bitmap;
-	// Mark Up
-
-	for(int i = level; i < TOTAL_LEVELS ; i++) {
-		starting_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS - 1 - i)) >> 5);
-		if(starting_idx >= NUM_OF_LEAVES_WORDS) {
-			uint32_t tmp = 0;
-			uint32_t tree_node = tree[i-1].internal[NUM_OF_LEAVES_WORDS-1];
-			#pragma unroll
-			for(int k = 0; k < 32; k += 2 ) {
-				uint32_t res1 = (tree_node >> k)&0x1;
-				uint32_t res2 = (tree_node >> (k+1))&0x1;
-				tmp |= (res1 | res2) << (k>>1);
-			}
-			tree[i].internal[NUM_OF_LEAVES_WORDS-1] = tmp;	
-				
-		} else {
-			next_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS - 2 - i)) >> 5);
+	for(; count > 0; --count, leaf += 1u << level) {
+		if((leaf >> LEVEL_CODES_PER_WORD_LOG2) != word) {
+			COST_META_LOAD(&h->cost, 1);
+			COST_META_STORE(&h->cost, 1);
+			h->level_codes[word] = (h->level_codes[word] & keep) | codes;
+			word = leaf >> LEVEL_CODES_PER_WORD_LOG2;
+			keep = 0xFFFFFFFF;
+			codes = 0;
 		}
+		keep &= ~(LEVEL_CODE_MASK << LEVEL_CODE_POS(leaf));
+		codes |= level << LEVEL_CODE_POS(leaf);
+	}
+	COST_META_LOAD(&h->cost, 1);
+	COST_META_STORE(&h->cost, 1);
+	h->level_codes[word] = (h->level_codes[word] & keep) | codes;
+}
+#endif
 
 
-		for(int j = starting_idx; j < NUM_OF_LEAVES_WORDS; j+=2) {
-			uint32_t tmp = 0;
-			uint32_t tree_node = tree[i].internal[j+1];
-			for(int k = 0; k < 32; k += 2 ) {
-				uint32_t res1 = (tree_node >> k)&0x1;
-				uint32_t res2 = (tree_node >> (k+1))&0x1;
-				tmp |= (res1 | res2) << (k>>1);
-			}
-			
-			tmp <<= 16;
-			tree_node = tree[i].internal[j]; 
-			for(int k = 0; k < 32; k += 2 ) {
-				uint32_t res1 = (tree_node >> k)&0x1;
-				uint32_t res2 = (tree_node >> (k+1))&0x1;
-				tmp |= (res1 | res2) << (k>>1);
-			}			
-			
-			tree[i+1].internal[next_idx] = tmp;	
-			++next_idx;		
+
+#ifdef __BUDDY_FREELIST__
+
+// Free-list engine: every free block sits on the list of its level (order), linked through
+// leaf indices stored in the first two words of the block. TREE(level) then holds one bit
+// per node, set while that node is a free block on its list, which is all free needs to
+// find and merge its buddy. nonempty_levels has bit l set while list l is non-empty.
+#define FREE_NIL 									0xFFFFFFFF
+#define FREE_LINK(leaf) 							((uint32_t *)(BUDDY_ARENA + ((leaf) << LOG2_MIN_REQ_SIZE)))
+
+#ifdef __BUDDY_LEVEL_LOCKS__
+#define LEVEL_LOCK(level) 							FINE_LOCK(&h->level_lock[level])
+#define LEVEL_UNLOCK(level) 						FINE_UNLOCK(&h->level_lock[level])
+#define NONEMPTY() 									__atomic_load_n(&h->nonempty_levels, __ATOMIC_RELAXED)
+#define NONEMPTY_SET(mask) 							__atomic_fetch_or(&h->nonempty_levels, (mask), __ATOMIC_RELAXED)
+#define NONEMPTY_CLR(mask) 							__atomic_fetch_and(&h->nonempty_levels, ~(mask), __ATOMIC_RELAXED)
+#define IN_FLIGHT(delta) 							__atomic_add_fetch(&h->in_flight, (delta), __ATOMIC_ACQ_REL)
+#else
+#define LEVEL_LOCK(level)
+#define LEVEL_UNLOCK(level)
+#define NONEMPTY() 									(h->nonempty_levels)
+#define NONEMPTY_SET(mask) 							(h->nonempty_levels |= (mask))
+#define NONEMPTY_CLR(mask) 							(h->nonempty_levels &= ~(mask))
+#endif
+
+static inline uint32_t is_free_node(bud_heap_t * h, uint32_t level, uint32_t node) {
+	COST_META_LOAD(&h->cost, 1);
+	return (TREE(level)[LEVEL_BASE(level) + (node >> 5)] >> (node & 0x1F)) & 0x1;
+}
+
+static void push_free(bud_heap_t * h, uint32_t level, uint32_t node) {
+	uint32_t leaf = node << level;
+	uint32_t head = (NONEMPTY() >> level) & 0x1 ? h->free_head[level] : FREE_NIL;
+
+	// The head and the tree word are read; both links, the head, the tree word and the old
+	// head's back link written.
+	COST_META_LOAD(&h->cost, (head != FREE_NIL) + 1);
+	COST_META_STORE(&h->cost, (head != FREE_NIL) + 4);
+	FREE_LINK(leaf)[0] = head;
+	FREE_LINK(leaf)[1] = FREE_NIL;
+	if(head != FREE_NIL) {
+		FREE_LINK(head)[1] = leaf;
+	}
+	h->free_head[level] = leaf;
+	NONEMPTY_SET(1u << level);
+	TREE(level)[LEVEL_BASE(level) + (node >> 5)] |= 1u << (node & 0x1F);
+}
+
+static void unlink_free(bud_heap_t * h, uint32_t level, uint32_t node) {
+	uint32_t leaf = node << level;
+	uint32_t next = FREE_LINK(leaf)[0];
+	uint32_t prev = FREE_LINK(leaf)[1];
+
+	// Both links and the tree word are read; a link or the head, the neighbour's back link and
+	// the tree word written.
+	COST_META_LOAD(&h->cost, 3);
+	COST_META_STORE(&h->cost, (next != FREE_NIL) + 2);
+	if(prev != FREE_NIL) {
+		FREE_LINK(prev)[0] = next;
+	} else {
+		h->free_head[level] = next;
+		if(next == FREE_NIL) {
+			NONEMPTY_CLR(1u << level);
 		}
 	}
+	if(next != FREE_NIL) {
+		FREE_LINK(next)[1] = prev;
+	}
+	TREE(level)[LEVEL_BASE(level) + (node >> 5)] &= ~(1u << (node & 0x1F));
+}
+
 
-	// Mark Down
-	for(int i = level; i > 0; i--) {
-		starting_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS - 1 - i))>>5);	
-		if(starting_idx >= NUM_OF_LEAVES_WORDS) {
-			uint32_t tree_node = tree[i].internal[NUM_OF_LEAVES_WORDS-1]; 
-			#pragma unroll
-			for(int k = 0; k < 16; k+=1) {
-				uint32_t res = (tree_node >> k)&0x1;
-				uint32_t bitidx1 = k << 1;
-				uint32_t bitidx2 = 1+(k << 1);
-				tree[i-1].internal[NUM_OF_LEAVES_WORDS-1] = (tree[i-1].internal[NUM_OF_LEAVES_WORDS-1] & ~(res << bitidx1)) | (res << bitidx1);
-				tree[i-1].internal[NUM_OF_LEAVES_WORDS-1] = (tree[i-1].internal[NUM_OF_LEAVES_WORDS-1] & ~(res << bitidx2)) | (res << bitidx2);
-			}				
-		} else {
-			next_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS - i)) >> 5);
+static void * bud_alloc_block(bud_heap_t * h, unsigned bytes)
+
+{
+	uint32_t intLogBytes;
+	uint32_t level, order, candidates;
+	uint32_t node;
+
+	if(bytes > (NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE)) {
+		return NULL;
+	}
+
+#ifdef __BUDDY_LEVEL_LOCKS__
+	if(!__atomic_load_n(&h->freelist_ready, __ATOMIC_ACQUIRE)) {
+		LEVEL_LOCK(TOTAL_LEVELS - 1);
+		if(!h->freelist_ready) {
+			push_free(h, TOTAL_LEVELS - 1, 0);
+			__atomic_store_n(&h->freelist_ready, 1, __ATOMIC_RELEASE);
 		}
-		for(int j = starting_idx; j < NUM_OF_LEAVES_WORDS; ++j) {
-			uint32_t tree_node = tree[i].internal[j];
-			uint32_t tmp1 = ~0;
-			#pragma unroll
-			for(int k = 0; k < 16; ++k) {
-				uint32_t res = (tree_node >> k)&0x1;
-				uint32_t bitidx1 = k << 1;
-				uint32_t bitidx2 = 1+bitidx1;
-				tree[i-1].internal[next_idx] = (tree[i-1].internal[next_idx] & ~(res << bitidx1)) | (res << bitidx1);
-				tree[i-1].internal[next_idx] = (tree[i-1].internal[next_idx] & ~(res << bitidx2)) | (res << bitidx2);
-			}
-			#pragma unroll
-			for(int k = 16; k < 32; ++k) {
-				uint32_t res = (tree_node >> k)&0x1;
-				uint32_t bitidx1 = k << 1;
-				uint32_t bitidx2 = 1+bitidx1;
-				tree[i-1].internal[next_idx+1] = (tree[i-1].internal[next_idx+1] & ~(res << bitidx1)) | (res << bitidx1);
-				tree[i-1].internal[next_idx+1] = (tree[i-1].internal[next_idx+1] & ~(res << bitidx2)) | (res << bitidx2);
+		LEVEL_UNLOCK(TOTAL_LEVELS - 1);
+	}
+#else
+	if(!h->freelist_ready) {
+		push_free(h, TOTAL_LEVELS - 1, 0);
+		h->freelist_ready = 1;
+	}
+#endif
+
+	if(bytes < MIN_REQ_SIZE) {
+		bytes = MIN_REQ_SIZE;
+	}
+
+	intLogBytes = intlog2(bytes);
+
+	if((bytes - (1u<<intLogBytes)) > 0) {
+		intLogBytes+=1;
+	}
+
+	level = intLogBytes - LOG2_MIN_REQ_SIZE;
+
+#ifdef __BUDDY_LEVEL_LOCKS__
+	// The order is picked from a snapshot of nonempty_levels and rechecked under its lock;
+	// if another thread emptied it first, pick again. While a split or merge elsewhere holds
+	// blocks off the lists, an empty snapshot is not final yet.
+	for(;;) {
+		candidates = NONEMPTY() & ~((1u << level) - 1);
+		if(candidates == 0) {
+			if(__atomic_load_n(&h->in_flight, __ATOMIC_ACQUIRE) == 0) {
+				return NULL;
 			}
-			next_idx+=2;
+			sched_yield();
+			continue;
+		}
+		order = intlog2(candidates & ~(candidates-1));
+		STAT_STEP(&h->stats);
+
+		LEVEL_LOCK(order);
+		if((NONEMPTY() >> order) & 0x1) {
+			break;
 		}
+		LEVEL_UNLOCK(order);
+	}
+	IN_FLIGHT(1);
+	COST_META_LOAD(&h->cost, 1);
+	node = h->free_head[order] >> order;
+	unlink_free(h, order, node);
+	LEVEL_UNLOCK(order);
+
+	// Split down to the requested level, keeping the left half and freeing the right.
+	while(order > level) {
+		--order;
+		node <<= 1;
+		STAT_STEP(&h->stats);
+		LEVEL_LOCK(order);
+		push_free(h, order, node | 0x1);
+		LEVEL_UNLOCK(order);
 	}
+	IN_FLIGHT(-1);
+#else
+	// Smallest non-empty order that can hold the request.
+	candidates = h->nonempty_levels & ~((1u << level) - 1);
+	if(candidates == 0) {
+		return NULL;
+	}
+	order = intlog2(candidates & ~(candidates-1));
+	STAT_STEP(&h->stats);
+
+	COST_META_LOAD(&h->cost, 1);
+	node = h->free_head[order] >> order;
+	unlink_free(h, order, node);
+
+	// Split down to the requested level, keeping the left half and freeing the right.
+	while(order > level) {
+		--order;
+		node <<= 1;
+		STAT_STEP(&h->stats);
+		push_free(h, order, node | 0x1);
+	}
+#endif
+
+	SET_LEVEL(node << level, level);
+	return (void *) (BUDDY_ARENA + (node << intLogBytes));
 }
 
-#ifdef __DO_NOT_INLINE__ 
-   void * __attribute__ ((noinline)) bud_malloc(unsigned bytes)
+
+
+#ifndef __BUDDY_LEVEL_LOCKS__
+// Merges node with its buddy for as long as that is a free block of the same order, then
+// puts the result on its list.
+static void release_node(bud_heap_t * h, uint32_t level, uint32_t node)
+{
+	while(level < TOTAL_LEVELS - 1 && is_free_node(h, level, node ^ 0x1)) {
+		unlink_free(h, level, node ^ 0x1);
+		node >>= 1;
+		++level;
+	}
+	push_free(h, level, node);
+}
+#endif
+
+static void bud_release(bud_heap_t * h, void * p)
+{
+	uint32_t leaf = (uint32_t)(((char *)p - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE);
+	uint32_t level = GET_LEVEL(leaf);
+	uint32_t node = leaf >> level;
+
+	// Merge with the buddy for as long as it is a free block of the same order.
+#ifdef __BUDDY_LEVEL_LOCKS__
+	IN_FLIGHT(1);
+	for(;;) {
+		LEVEL_LOCK(level);
+		if(level < TOTAL_LEVELS - 1 && is_free_node(h, level, node ^ 0x1)) {
+			unlink_free(h, level, node ^ 0x1);
+			LEVEL_UNLOCK(level);
+			node >>= 1;
+			++level;
+			continue;
+		}
+		push_free(h, level, node);
+		LEVEL_UNLOCK(level);
+		break;
+	}
+	IN_FLIGHT(-1);
 #else
-   void * bud_malloc(unsigned bytes)
+	release_node(h, level, node);
 #endif
+}
+
+#ifdef __BUDDY_LEVEL_LOCKS__
+// Level-locked heaps take blocks one at a time, each under the locks of the orders it
+// touches, and release them the same way.
+static uint32_t bud_alloc_blocks(bud_heap_t * h, unsigned bytes, uint32_t count, void ** out)
+{
+	uint32_t got = 0;
+
+	while(got < count && (out[got] = bud_alloc_block(h, bytes)) != NULL) {
+		++got;
+	}
+	return got;
+}
 
+static void bud_release_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count)
+{
+	for(; count > 0; --count, ++node) {
+		bud_release(h, BUDDY_ARENA + (node << (level + LOG2_MIN_REQ_SIZE)));
+	}
+}
+#else
+// bud_alloc_block for up to count blocks of bytes, stored to out[]; returns how many. Each
+// block taken off a list is cut up whole instead of split once per request: as many blocks
+// of the requested level as are still wanted go out, their level codes are set together,
+// and what is left goes back on the lists as the largest aligned blocks it holds, which
+// are no more pushes than a single split makes.
+static uint32_t bud_alloc_blocks(bud_heap_t * h, unsigned bytes, uint32_t count, void ** out)
 {
 	uint32_t intLogBytes;
-	uint32_t level;
-	uint32_t bitmap;
+	uint32_t level, order, candidates;
+	uint32_t node, span, take, r, k;
+	uint32_t got = 0;
 
-	if(bytes > ARENA_BYTES) {
-		return NULL;
+	if(bytes > (NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE)) {
+		return 0;
+	}
+
+	if(!h->freelist_ready) {
+		push_free(h, TOTAL_LEVELS - 1, 0);
+		h->freelist_ready = 1;
 	}
 
 	if(bytes < MIN_REQ_SIZE) {
@@ -206,49 +458,165 @@ void __attribute__ ((always_inline)) update_tree(int level) {
 
 	intLogBytes = intlog2(bytes);
 
-	if((bytes - (1<<intLogBytes)) > 0) {
+	if((bytes - (1u<<intLogBytes)) > 0) {
 		intLogBytes+=1;
 	}
 
 	level = intLogBytes - LOG2_MIN_REQ_SIZE;
 
-	uint32_t starting_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS-1 - level))>>5);
+	while(got < count) {
+		candidates = h->nonempty_levels & ~((1u << level) - 1);
+		if(candidates == 0) {
+			break;
+		}
+		order = intlog2(candidates & ~(candidates-1));
+		STAT_STEP(&h->stats);
+
+		COST_META_LOAD(&h->cost, 1);
+		node = h->free_head[order] >> order;
+		unlink_free(h, order, node);
+
+		// The block holds span nodes of the requested level, from node on.
+		span = 1u << (order - level);
+		node <<= order - level;
+		take = (count - got < span) ? count - got : span;
+		set_levels(h, node << level, take, level);
+		for(k = 0; k < take; ++k) {
+			out[got++] = (void *) (BUDDY_ARENA + ((node + k) << intLogBytes));
+		}
+		for(r = take; r < span; r += 1u << k) {
+			k = intlog2(r & ~(r-1));
+			STAT_STEP(&h->stats);
+			push_free(h, level + k, (node + r) >> k);
+		}
+	}
+	return got;
+}
+
+// Frees count blocks of a level laid end to end from node on. The range is cut into the
+// largest aligned blocks it holds, and each is merged and put on a list once, instead of
+// every block merging with the one freed just before it.
+static void bud_release_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count)
+{
+	uint32_t k;
+
+	while(count > 0) {
+		for(k = 0; level + k < TOTAL_LEVELS - 1 && !((node >> k) & 0x1) && (2u << k) <= count; ++k);
+		release_node(h, level + k, node >> k);
+		node += 1u << k;
+		count -= 1u << k;
+	}
+}
+#endif
+
+#else
+
+// Sets (set != 0) or clears count consecutive nodes of a level, one masked write per word.
+static void mark_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count, int set) {
+	uint32_t word = LEVEL_BASE(level) + (node >> 5);
+	uint32_t bit = node & 0x1F;
+	uint32_t take, mask;
 
-	if(starting_idx == NUM_OF_LEAVES_WORDS) {
-		uint32_t num_of_bits = (1<< (TOTAL_LEVELS - 1 - level));
-		uint32_t bitmask = (1 << num_of_bits);
+	while(count > 0) {
+		take = (count < 32 - bit) ? count : 32 - bit;
+		mask = ((take == 32) ? 0xFFFFFFFF : ((1u << take) - 1)) << bit;
+		COST_META_LOAD(&h->cost, 1);
+		COST_META_STORE(&h->cost, 1);
+		TREE(level)[word] = set ? (TREE(level)[word] | mask) : (TREE(level)[word] & ~mask);
+		count -= take;
+		bit = 0;
+		++word;
+	}
+}
 
-		bitmap = tree[level].internal[NUM_OF_LEAVES_WORDS-1];
-		if(bitmap < bitmask) {
-			uint32_t lvl_vec 		= ~bitmap & ~(~bitmap-1);
-			uint32_t addr_idx 		= intlog2(lvl_vec);
-			tree[level].internal[NUM_OF_LEAVES_WORDS-1] = bitmap | lvl_vec;
+// Marks node as allocated: the node and its whole subtree become unavailable, and every
+// ancestor becomes partially used. Ancestors are walked only until one is already marked,
+// since everything above it is marked too.
+static void mark_alloc(bud_heap_t * h, uint32_t level, uint32_t node) {
+	uint32_t i, word, bit;
 
-			update_tree(level);
+	for(i = 0; i <= level; ++i) {
+		mark_range(h, level - i, node << i, 1u << i, 1);
+	}
 
-			uint32_t ADDR_TAG = ((uint32_t)BUDDY_ARENA + (addr_idx << (intLogBytes)) );
-			ADDR_TAG ^= (uint32_t)BUDDY_ARENA;
-			ADDR_LUT[ADDR_TAG>>LOG2_MIN_REQ_SIZE] = level;
-			return (void *) (BUDDY_ARENA + (addr_idx << (intLogBytes)) );
+	for(i = level + 1; i < TOTAL_LEVELS; ++i) {
+		node >>= 1;
+		word = LEVEL_BASE(i) + (node >> 5);
+		bit = 1u << (node & 0x1F);
+		COST_META_LOAD(&h->cost, 1);
+		if(TREE(i)[word] & bit) {
+			break;
 		}
+		COST_META_STORE(&h->cost, 1);
+		TREE(i)[word] |= bit;
+	}
+}
+
+// Releases node and its subtree, then clears ancestors for as long as the sibling at
+// each step is entirely free as well.
+static void mark_free(bud_heap_t * h, uint32_t level, uint32_t node) {
+	uint32_t i, word, pair;
+
+	for(i = 0; i <= level; ++i) {
+		mark_range(h, level - i, node << i, 1u << i, 0);
 	}
 
+	for(i = level + 1; i < TOTAL_LEVELS; ++i) {
+		word = LEVEL_BASE(i - 1) + (node >> 5);
+		COST_META_LOAD(&h->cost, 1);
+		pair = (TREE(i - 1)[word] >> (node & 0x1E)) & 0x3;
+		if(pair) {
+			break;
+		}
+		node >>= 1;
+		COST_META_LOAD(&h->cost, 1);
+		COST_META_STORE(&h->cost, 1);
+		TREE(i)[LEVEL_BASE(i) + (node >> 5)] &= ~(1u << (node & 0x1F));
+	}
+}
+
+static void * bud_alloc_block(bud_heap_t * h, unsigned bytes)
+
+{
+	uint32_t intLogBytes;
+	uint32_t level;
+	uint32_t bitmap;
+
+	if(bytes > (NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE)) {
+		return NULL;
+	}
+
+	if(bytes < MIN_REQ_SIZE) {
+		bytes = MIN_REQ_SIZE;
+	}
+
+	intLogBytes = intlog2(bytes);
+
+	if((bytes - (1u<<intLogBytes)) > 0) {
+		intLogBytes+=1;
+	}
+
+	level = intLogBytes - LOG2_MIN_REQ_SIZE;
+
+	uint32_t starting_idx = LEVEL_BASE(level);
+	// Levels with fewer than 32 nodes only own the low bits of their word.
+	uint32_t unused_bits = (LEVEL_NODES(level) < 32) ? ~((1u << LEVEL_NODES(level)) - 1) : 0;
+
 	for(int i = starting_idx; i < NUM_OF_LEAVES_WORDS; ++i) {
-		bitmap = tree[level].internal[i];
+		STAT_STEP(&h->stats);
+		COST_META_LOAD(&h->cost, 1);
+		bitmap = TREE(level)[i] | unused_bits;
 		if(~bitmap == 0) {
 			continue;
 		}			
 		uint32_t lvl_vec 		= ~bitmap & ~(~bitmap-1);
 		uint32_t addr_idx 		= intlog2(lvl_vec);
+		uint32_t node 			= ((i - starting_idx) << 5) + addr_idx;
 
-		tree[level].internal[i] = bitmap | lvl_vec;
-		
-		update_tree(level);
+		mark_alloc(h, level, node);
 
-		uint32_t ADDR_TAG = ((uint32_t)BUDDY_ARENA + ((((i-starting_idx) << 5)+addr_idx) << (intLogBytes)));
-		ADDR_TAG ^= (uint32_t)BUDDY_ARENA;			
-		ADDR_LUT[ADDR_TAG>>LOG2_MIN_REQ_SIZE] = level;
-		return (void *) (BUDDY_ARENA + ((((i-starting_idx) << 5)+addr_idx) << (intLogBytes)));
+		SET_LEVEL(node << level, level);
+		return (void *) (BUDDY_ARENA + (node << intLogBytes));
 	}
 	return NULL;
 	
@@ -256,71 +624,558 @@ void __attribute__ ((always_inline)) update_tree(int level) {
 
 
 
-#ifdef __DO_NOT_INLINE__ 
-   void __attribute__ ((noinline)) bud_free(void * p)
+static void bud_release(bud_heap_t * h, void * p)
+{
+	uint32_t leaf = (uint32_t)(((char *)p - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE);
+	uint32_t level = GET_LEVEL(leaf);
+
+	mark_free(h, level, leaf >> level);
+}
+
+// mark_alloc for count consecutive nodes of a level: each level of their subtrees is
+// written once for the whole range, and so is each ancestor level, for the range of
+// parents, until the parents are down to one node that is marked already.
+static void mark_alloc_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count) {
+	uint32_t i, last = node + count - 1;
+
+	for(i = 0; i <= level; ++i) {
+		mark_range(h, level - i, node << i, count << i, 1);
+	}
+
+	for(i = level + 1; i < TOTAL_LEVELS; ++i) {
+		node >>= 1;
+		last >>= 1;
+		if(node == last) {
+			COST_META_LOAD(&h->cost, 1);
+			if((TREE(i)[LEVEL_BASE(i) + (node >> 5)] >> (node & 0x1F)) & 0x1) {
+				break;
+			}
+		}
+		mark_range(h, i, node, last - node + 1, 1);
+	}
+}
+
+// Whether either child in the pair holding node (of a level) is still marked.
+static inline uint32_t pair_used(bud_heap_t * h, uint32_t level, uint32_t node) {
+	COST_META_LOAD(&h->cost, 1);
+	return (TREE(level)[LEVEL_BASE(level) + (node >> 5)] >> (node & 0x1E)) & 0x3;
+}
+
+// mark_free for count consecutive nodes of a level. Above them, the parents inside the
+// range have both children free by now; only the two at its ends need their pair read.
+// Each level is cleared with one range write until no parent is left to clear.
+static void mark_free_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count) {
+	uint32_t i, last = node + count - 1;
+
+	for(i = 0; i <= level; ++i) {
+		mark_range(h, level - i, node << i, count << i, 0);
+	}
+
+	for(i = level + 1; i < TOTAL_LEVELS; ++i) {
+		uint32_t lo = node >> 1, hi = last >> 1;
+
+		if(pair_used(h, i - 1, node)) {
+			++lo;
+		}
+		if(lo <= hi && pair_used(h, i - 1, last)) {
+			if(hi == lo) {
+				break;
+			}
+			--hi;
+		}
+		if(lo > hi) {
+			break;
+		}
+		mark_range(h, i, lo, hi - lo + 1, 0);
+		node = lo;
+		last = hi;
+	}
+}
+
+// bud_alloc_block for up to count blocks of bytes, stored to out[]; returns how many. The
+// level is scanned once for the whole batch. Every run of free nodes found in a word is
+// taken at once: its subtrees and ancestors are marked with range writes (mark_alloc_range)
+// and its level codes set together, instead of a walk up the tree per block.
+static uint32_t bud_alloc_blocks(bud_heap_t * h, unsigned bytes, uint32_t count, void ** out)
+{
+	uint32_t intLogBytes;
+	uint32_t level;
+	uint32_t free_map, first, len, rest, node, k;
+	uint32_t got = 0;
+
+	if(bytes > (NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE)) {
+		return 0;
+	}
+
+	if(bytes < MIN_REQ_SIZE) {
+		bytes = MIN_REQ_SIZE;
+	}
+
+	intLogBytes = intlog2(bytes);
+
+	if((bytes - (1u<<intLogBytes)) > 0) {
+		intLogBytes+=1;
+	}
+
+	level = intLogBytes - LOG2_MIN_REQ_SIZE;
+
+	uint32_t starting_idx = LEVEL_BASE(level);
+	// Levels with fewer than 32 nodes only own the low bits of their word.
+	uint32_t unused_bits = (LEVEL_NODES(level) < 32) ? ~((1u << LEVEL_NODES(level)) - 1) : 0;
+
+	for(uint32_t i = starting_idx; i < NUM_OF_LEAVES_WORDS && got < count; ++i) {
+		STAT_STEP(&h->stats);
+		COST_META_LOAD(&h->cost, 1);
+		free_map = ~(TREE(level)[i] | unused_bits);
+
+		while(free_map && got < count) {
+			first = intlog2(free_map & ~(free_map-1));
+			rest = ~(free_map >> first);
+			len = rest ? intlog2(rest & ~(rest-1)) : 32 - first;
+			if(len > count - got) {
+				len = count - got;
+			}
+			node = ((i - starting_idx) << 5) + first;
+
+			mark_alloc_range(h, level, node, len);
+			set_levels(h, node << level, len, level);
+			for(k = 0; k < len; ++k) {
+				out[got++] = (void *) (BUDDY_ARENA + ((node + k) << intLogBytes));
+			}
+			free_map &= ~(((len == 32) ? 0xFFFFFFFF : ((1u << len) - 1)) << first);
+		}
+	}
+	return got;
+}
+
+// Frees count blocks of a level laid end to end from node on.
+static void bud_release_range(bud_heap_t * h, uint32_t level, uint32_t node, uint32_t count)
+{
+	mark_free_range(h, level, node, count);
+}
+
+
+#endif /* __BUDDY_FREELIST__ */
+
+void bud_heap_free(bud_heap_t * h, void * p)
+{
+	COST_CALL(&h->cost, COST_FREE);
+	if(!p) {
+		return;
+	}
+	STAT_FREE(&h->stats, p, BLOCK_BYTES(p));
+	bud_release(h, p);
+}
+
+
+#ifndef __BUDDY_LEVEL_LOCKS__
+// Returns every block held by the lazy-free cache to the tree; nonzero if there were any.
+static uint8_t lazy_flush(bud_heap_t * h) {
+	uint8_t flushed = 0;
+
+	for(int c = 0; c < LAZY_CLASSES; ++c) {
+		while(h->lazyreserved[c] > 0) {
+			COST_META_LOAD(&h->cost, 1);
+			bud_release(h, h->lazyhold[c][--h->lazyreserved[c]]);
+			flushed = 1;
+		}
+	}
+	return flushed;
+}
+#endif
+
+// A request whose level has a block waiting in the lazy-free cache is served from there.
+// Otherwise the engine allocates, and on failure the cache is flushed and it retries once.
+static void * bud_serve(bud_heap_t * h, unsigned bytes)
+{
+#ifdef __BUDDY_LEVEL_LOCKS__
+	// The lazy-free cache is shared by the whole heap, so level-locked builds do without it.
+	return bud_alloc_block(h, bytes);
 #else
-   void bud_free(void * p)
+	void * vp;
+	uint32_t rounded = (bytes < MIN_REQ_SIZE) ? MIN_REQ_SIZE : bytes;
+	uint32_t intLogBytes = intlog2(rounded);
+	uint32_t level;
+
+	if((rounded - (1u<<intLogBytes)) > 0) {
+		intLogBytes+=1;
+	}
+	level = intLogBytes - LOG2_MIN_REQ_SIZE;
+
+	if(level < LAZY_CLASSES && h->lazyreserved[level] > 0) {
+		COST_META_LOAD(&h->cost, 1);
+		return h->lazyhold[level][--h->lazyreserved[level]];
+	}
+
+	vp = bud_alloc_block(h, bytes);
+	if(!vp && lazy_flush(h)) {
+		vp = bud_alloc_block(h, bytes);
+	}
+	return vp;
 #endif
+}
+
+// bud_serve for count blocks of bytes: the lazy-free cache of their level is emptied
+// first, the rest comes from one batch of the engine, retried once after a flush.
+static uint32_t bud_serve_batch(bud_heap_t * h, unsigned bytes, uint32_t count, void ** out)
 {
-	uint32_t addr_map = ((uint32_t)p ^ (uint32_t)BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE;
-	uint32_t level = ADDR_LUT[addr_map];
-	uint32_t intLogBytes = level + LOG2_MIN_REQ_SIZE;
-	uint32_t starting_idx = NUM_OF_LEAVES_WORDS - ((1<< (TOTAL_LEVELS-1 - level))>>5);
-	uint32_t res = ((uint32_t)p - ((uint32_t)BUDDY_ARENA + (((starting_idx) << 5) << intLogBytes))) >> intLogBytes;
-	uint32_t res2 = (res >> 5)<<5;
-	tree[level].internal[starting_idx+(res-res2)] &= ~(1<<res2);
-	update_tree(level);
+	uint32_t got = 0;
+#ifndef __BUDDY_LEVEL_LOCKS__
+	uint32_t rounded = (bytes < MIN_REQ_SIZE) ? MIN_REQ_SIZE : bytes;
+	uint32_t intLogBytes = intlog2(rounded);
+	uint32_t level;
+
+	if((rounded - (1u<<intLogBytes)) > 0) {
+		intLogBytes+=1;
+	}
+	level = intLogBytes - LOG2_MIN_REQ_SIZE;
+
+	while(got < count && level < LAZY_CLASSES && h->lazyreserved[level] > 0) {
+		COST_META_LOAD(&h->cost, 1);
+		out[got++] = h->lazyhold[level][--h->lazyreserved[level]];
+	}
+#endif
+	got += bud_alloc_blocks(h, bytes, count - got, out + got);
+#ifndef __BUDDY_LEVEL_LOCKS__
+	if(got < count && lazy_flush(h)) {
+		got += bud_alloc_blocks(h, bytes, count - got, out + got);
+	}
+#endif
+	return got;
 }
 
+void * bud_heap_malloc(bud_heap_t * h, unsigned bytes)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	void * vp = bud_serve(h, bytes);
+
+	STAT_MALLOC(&h->stats, bytes, vp, BLOCK_BYTES(vp));
+	return vp;
+}
 
-void * bud_realloc(void * vp, unsigned newbytes) {
+// Every block is aligned to its own size (relative to the arena, which starts on an
+// ARENA_ALIGN boundary), so an aligned request only needs a large enough order: it is
+// served as a request for the larger of bytes and alignment.
+void * bud_heap_memalign(bud_heap_t * h, unsigned alignment, unsigned bytes)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	void * vp = NULL;
+
+	if(alignment != 0 && (alignment & (alignment - 1)) == 0) {
+		if(alignment < MIN_REQ_SIZE) {
+			alignment = MIN_REQ_SIZE;
+		}
+		if(((uintptr_t)BUDDY_ARENA & (alignment - 1)) == 0) {
+			vp = bud_serve(h, (bytes > alignment) ? bytes : alignment);
+		}
+	}
+	STAT_MALLOC(&h->stats, bytes, vp, BLOCK_BYTES(vp));
+	return vp;
+}
+
+// count blocks of bytes each, as count calls of bud_heap_malloc would hand them out but for
+// one search and one round of metadata writes per run of blocks (see bud_alloc_blocks).
+// Returns how many were allocated; out[] past them is NULL.
+unsigned bud_heap_malloc_batch(bud_heap_t * h, unsigned count, unsigned bytes, void ** out)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	uint32_t got = bud_serve_batch(h, bytes, count, out), i;
+
+	for(i = got; i < count; ++i) {
+		out[i] = NULL;
+	}
+#ifdef __ALLOC_STATS__
+	for(i = 0; i < count; ++i) {
+		STAT_MALLOC(&h->stats, bytes, out[i], BLOCK_BYTES(out[i]));
+	}
+#endif
+	return got;
+}
+
+// Frees every non-NULL block of ptrs[]. Consecutive entries that are blocks of one level
+// laid end to end in the arena, as bud_heap_malloc_batch hands them out, are released as
+// one range (see bud_release_range).
+void bud_heap_free_batch(bud_heap_t * h, void ** ptrs, unsigned count)
+{
+	COST_CALL(&h->cost, COST_FREE);
+	uint32_t i, leaf, lvl, level = 0, node = 0, run = 0;
+
+	for(i = 0; i < count; ++i) {
+		if(!ptrs[i]) {
+			continue;
+		}
+		leaf = (uint32_t)(((char *)ptrs[i] - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE);
+		lvl = GET_LEVEL(leaf);
+		STAT_FREE(&h->stats, ptrs[i], 1u << (lvl + LOG2_MIN_REQ_SIZE));
+		if(run > 0 && lvl == level && (leaf >> lvl) == node + run) {
+			++run;
+			continue;
+		}
+		if(run > 0) {
+			bud_release_range(h, level, node, run);
+		}
+		level = lvl;
+		node = leaf >> lvl;
+		run = 1;
+	}
+	if(run > 0) {
+		bud_release_range(h, level, node, run);
+	}
+}
+
+void * bud_heap_realloc(bud_heap_t * h, void * vp, unsigned newbytes) {
+	COST_CALL(&h->cost, COST_REALLOC);
 	void *newp = NULL;
 	uint32_t *cnewp, *cvp;
 
 	int idx = 0;
 	/* behavior on corner cases conforms to SUSv2 */
 	if (!vp)
-		return bud_malloc(newbytes);
+		return bud_heap_malloc(h, newbytes);
 
 	if (newbytes != 0) {
-		if ( (newp = bud_malloc(newbytes)) == NULL)
+		if ( (newp = bud_heap_malloc(h, newbytes)) == NULL)
 			return NULL;
 
-		uint32_t addr_map = ((uint32_t)vp ^ (uint32_t)BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE;
-		uint32_t level = ADDR_LUT[addr_map];
+		uint32_t addr_map = (uint32_t)(((char *)vp - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE);
+		uint32_t level = GET_LEVEL(addr_map);
 		uint32_t intLogBytes = level + LOG2_MIN_REQ_SIZE;
-		uint32_t w0rds = (1 << intLogBytes)>>2; 
+		uint32_t bytes = ((1u << intLogBytes) < newbytes) ? (1u << intLogBytes) : newbytes;
+		uint32_t w0rds = (bytes + 3)>>2; 
 
 		cnewp   = newp;
 		cvp     = vp;
+		COST_ARENA_LOAD(&h->cost, w0rds);
+		COST_ARENA_STORE(&h->cost, w0rds);
 
 		for(idx = 0; idx < w0rds; ++ idx) {
 			cnewp[idx]=cvp[idx];
 		}
 	}
 
-	bud_free(vp);
+	bud_heap_free(h, vp);
 	return newp;
 } 
 
-void * bud_calloc(unsigned nelem, unsigned elsize) {
+void * bud_heap_calloc(bud_heap_t * h, unsigned nelem, unsigned elsize) {
+  COST_CALL(&h->cost, COST_CALLOC);
   void *vp;
   unsigned nbytes;
   uint32_t * cvp;
   unsigned int i = 0;
 
-  nbytes = (nelem * elsize)>>2;
-  if ( (vp = bud_malloc(nbytes)) == NULL)
+  nbytes = nelem * elsize;
+  if ( (vp = bud_heap_malloc(h, nbytes)) == NULL)
     return NULL;
 
   cvp = (uint32_t *)vp;
-  for(i=0; i< nbytes; ++i) {
+  COST_ARENA_STORE(&h->cost, (nbytes + 3) >> 2);
+  for(i=0; i< ((nbytes+3)>>2); ++i) {
     cvp[i]='\0';
   }
   return vp;
 }
 
+void bud_heap_lazyfree(bud_heap_t * h, void * vp) {
+  COST_CALL(&h->cost, COST_FREE);
+  if(!vp) {
+    return;
+  }
 
+#ifndef __BUDDY_LEVEL_LOCKS__
+  uint32_t level = GET_LEVEL((uint32_t)(((char *)vp - BUDDY_ARENA) >> LOG2_MIN_REQ_SIZE));
+
+  if(level < LAZY_CLASSES && h->lazyreserved[level] < LAZY_DEPTH) {
+    STAT_FREE(&h->stats, vp, 1u << (level + LOG2_MIN_REQ_SIZE));
+    COST_META_STORE(&h->cost, 1);
+    h->lazyhold[level][h->lazyreserved[level]++] = vp;
+    return;
+  }
+#endif
+  bud_heap_free(h, vp);
+}
+
+#ifdef __ALLOC_STATS__
+// Free space is read off the tree. With free lists, TREE(level) marks exactly the free
+// blocks of that order; otherwise a clear leaf bit is a free leaf, and a clear bit on a
+// level means one free block of that order.
+void bud_heap_get_stats(bud_heap_t * h, mem_stats_t * s) {
+	uint64_t free_bytes = 0, largest = 0;
+	uint32_t level, w, words, nodes;
+
+	for(level = 0; level < TOTAL_LEVELS; ++level) {
+		nodes = LEVEL_NODES(level);
+		words = LEVEL_WORDS(level);
+		for(w = 0; w < words; ++w) {
+			uint32_t bits = TREE(level)[LEVEL_BASE(level) + w];
+			uint32_t valid = (nodes < 32) ? (1u << nodes) - 1 : 0xFFFFFFFF;
+#ifdef __BUDDY_FREELIST__
+			uint32_t found = __builtin_popcount(bits & valid);
+
+			free_bytes += (uint64_t)found << (level + LOG2_MIN_REQ_SIZE);
+#else
+			uint32_t found = __builtin_popcount(~bits & valid);
+
+			if(level == 0) {
+				free_bytes += (uint64_t)found << LOG2_MIN_REQ_SIZE;
+			}
+#endif
+			if(found) {
+				largest = 1ull << (level + LOG2_MIN_REQ_SIZE);
+			}
+		}
+	}
+#ifdef __BUDDY_FREELIST__
+	if(!h->freelist_ready) {
+		free_bytes = largest = (uint64_t)NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE;
+	}
+#endif
+	*s = h->stats;
+	STAT_FINISH(s, free_bytes, largest);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void bud_heap_get_cost(bud_heap_t * h, mem_cost_t * c) {
+	*c = h->cost;
+}
+#endif
+
+#ifdef __HEAP_MAP__
+#define NODE_BIT(level, node) 						((TREE(level)[LEVEL_BASE(level) + ((node) >> 5)] >> ((node) & 0x1F)) & 0x1)
+
+// Every free node whose parent is not free is one free block. With free lists that is
+// exactly a set TREE bit; otherwise a clear bit under a set parent bit (or a clear root).
+void bud_heap_map(bud_heap_t * h, mem_map_t * m) {
+	uint32_t level, node, free_node;
+
+	map_start(m, NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE);
+#ifdef __BUDDY_FREELIST__
+	if(!h->freelist_ready) {
+		map_free_block(m, 0, NUM_OF_LEAVES << LOG2_MIN_REQ_SIZE);
+		map_finish(m);
+		return;
+	}
+#endif
+	for(level = 0; level < TOTAL_LEVELS; ++level) {
+		for(node = 0; node < LEVEL_NODES(level); ++node) {
+#ifdef __BUDDY_FREELIST__
+			free_node = NODE_BIT(level, node);
+#else
+			free_node = !NODE_BIT(level, node) && (level == TOTAL_LEVELS - 1 || NODE_BIT(level + 1, node >> 1));
+#endif
+			if(free_node) {
+				map_free_block(m, node << (level + LOG2_MIN_REQ_SIZE), 1u << (level + LOG2_MIN_REQ_SIZE));
+			}
+		}
+	}
+	map_finish(m);
+}
+#endif
+
+// Lays a heap out over [base, base+bytes): the heap state, the tree and the level codes
+// first, then the arena, whose size is the largest power of two (of at least 32 leaves)
+// that still fits. Blocks are aligned to their own size relative to the arena start, which
+// itself is aligned to ARENA_ALIGN. Returns NULL when not even 32 leaves fit.
+bud_heap_t * bud_heap_init(void * base, size_t bytes) {
+	uintptr_t start = ((uintptr_t)base + 7) & ~(uintptr_t)7;
+	uintptr_t end = (uintptr_t)base + bytes;
+	uintptr_t meta = start + ((sizeof(bud_heap_t) + 7) & ~(size_t)7);
+	bud_heap_t * h = (bud_heap_t *)start;
+	uint64_t leaves, levels, shift, code_words, first;
+
+	if(!base || end < meta) {
+		return NULL;
+	}
+
+	// Arenas stop at 1 GB so block sizes and offsets stay within 32 bits.
+	for(leaves = 1ull << (30 - LOG2_MIN_REQ_SIZE); leaves >= 32; leaves >>= 1) {
+		levels = intlog2((uint32_t)leaves) + 1;
+		shift = (leaves <= 32768) ? 2 : 3;
+		code_words = leaves >> (5 - shift);
+		first = (meta + (levels * (leaves >> 5) + code_words) * sizeof(uint32_t) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+		if(first <= end && ((end - first) >> LOG2_MIN_REQ_SIZE) >= leaves) {
+			break;
+		}
+	}
+	if(leaves < 32) {
+		return NULL;
+	}
+
+	memset(h, 0, sizeof(bud_heap_t));
+	h->tree 		= (uint32_t *)meta;
+	h->level_codes 	= h->tree + levels * (leaves >> 5);
+	h->arena 		= (char *)first;
+	h->leaves 		= (uint32_t)leaves;
+	h->levels 		= (uint32_t)levels;
+	h->code_shift 	= (uint32_t)shift;
+	memset(h->tree, 0, (levels * (leaves >> 5) + code_words) * sizeof(uint32_t));
+	return h;
+}
+
+
+//==------------------------------------------==//
+// [Default heap: the static arena of ARENA_BYTES]
+
+#ifdef __DO_NOT_INLINE__ 
+   void * __attribute__ ((noinline)) bud_malloc(unsigned bytes)
+#else
+   void * bud_malloc(unsigned bytes)
+#endif
+{
+	return bud_heap_malloc(&default_heap, bytes);
+}
+
+#ifdef __DO_NOT_INLINE__ 
+   void __attribute__ ((noinline)) bud_free(void * p)
+#else
+   void bud_free(void * p)
+#endif
+{
+	bud_heap_free(&default_heap, p);
+}
+
+void * bud_realloc(void * vp, unsigned newbytes) {
+	return bud_heap_realloc(&default_heap, vp, newbytes);
+}
+
+void * bud_calloc(unsigned nelem, unsigned elsize) {
+	return bud_heap_calloc(&default_heap, nelem, elsize);
+}
+
+unsigned bud_malloc_batch(unsigned count, unsigned bytes, void ** out) {
+	return bud_heap_malloc_batch(&default_heap, count, bytes, out);
+}
+
+void bud_free_batch(void ** ptrs, unsigned count) {
+	bud_heap_free_batch(&default_heap, ptrs, count);
+}
+
+void * bud_memalign(unsigned alignment, unsigned bytes) {
+	return bud_heap_memalign(&default_heap, alignment, bytes);
+}
+
+void * bud_aligned_alloc(unsigned alignment, unsigned bytes) {
+	return bud_heap_memalign(&default_heap, alignment, bytes);
+}
+
+#ifdef __ALLOC_STATS__
+void bud_get_stats(mem_stats_t * s) {
+	bud_heap_get_stats(&default_heap, s);
+}
+#endif
+
+#ifdef __HEAP_MAP__
+void bud_map(mem_map_t * m) {
+	bud_heap_map(&default_heap, m);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void bud_get_cost(mem_cost_t * c) {
+	bud_heap_get_cost(&default_heap, c);
+}
+#endif
 
 #ifdef __DO_NOT_INLINE__ 
     void __attribute__ ((noinline)) bud_lazyfree(void * vp)
@@ -328,16 +1183,13 @@ void * bud_calloc(unsigned nelem, unsigned elsize) {
     void bud_lazyfree(void * vp)
 #endif
 {
+	bud_heap_lazyfree(&default_heap, vp);
+}
 
-  if(lazyreserved < 32) {
-    lazyhold[lazyreserved++] = (uint32_t)vp;
-  } else {
-    lazyreserved = 0;
-    bud_free(vp);
-    for(int i = 0; i < 32; ++i) {
-      bud_free((void*)lazyhold[i]);
-    }
-  }
-
-
-}
\ No newline at end of file
+#ifdef __BUDDY_LEVEL_LOCKS__
+// Marks this build as safe to call from several threads at once; MemCast looks for it and
+// then leaves out the alloc_lock/alloc_unlock wrapping.
+int bud_threadsafe(void) {
+	return 1;
+}
+#endif
\ No newline at end of file
@@ -13,6 +13,41 @@
 // Memory Utils Includes.
 #include "memutils.h"
 
+// With __ACCESS_COUNT__, every read and write of a header field or free-list link is one
+// metadata word.
+#ifdef __ACCESS_COUNT__
+#define HDR_LOAD(x)     (COST_META_LOAD(&h->cost, 1), (x))
+#define HDR_STORE(x)    (COST_META_STORE(&h->cost, 1), (x))
+#else
+#define HDR_LOAD(x)     (x)
+#define HDR_STORE(x)    (x)
+#endif
+
+#ifdef __GNU_COMPACT_HEADER__
+// Compact 8-byte CHUNK header: neighbour links are 32-bit byte offsets from the arena base
+// and the freebit is packed into bit 0 of the right link (offsets are multiples of 8).
+// Offset 0 stands for NULL, so the first header slot of the arena is never handed out.
+typedef uint32_t CLINK;
+
+typedef struct CHUNK {
+  CLINK l;
+  CLINK r;
+} CHUNK;
+
+#define TOLINK(chunk)   ( (chunk) ? (CLINK)((char *)(chunk) - (char *)h->arena) : 0 )
+#define FROMLINK(link)  ( (link) ? (CHUNK *)((char *)h->arena + (link)) : NULL )
+
+#define LEFT(chunk)           FROMLINK(HDR_LOAD((chunk)->l))
+#define RIGHT(chunk)          FROMLINK(HDR_LOAD((chunk)->r) & ~0x01u)
+#define SET_LEFT(chunk, q)    HDR_STORE( (chunk)->l = TOLINK(q) )
+#define SET_RIGHT(chunk, q)   HDR_STORE( (chunk)->r = TOLINK(q) | (HDR_LOAD((chunk)->r) & 0x01u) )
+
+#define SET_FREEBIT(chunk) HDR_STORE( (chunk)->r = HDR_LOAD((chunk)->r) | 0x01u )
+#define CLR_FREEBIT(chunk) HDR_STORE( (chunk)->r = HDR_LOAD((chunk)->r) & ~0x01u )
+#define GET_FREEBIT(chunk) ( HDR_LOAD((chunk)->r) & 0x01u )
+
+#define ARENA_FIRST 1
+#else
 // CHUNK header for heap management. Each Chunk requires a minimum size of 16 bytes (according to this alignment scheme)
 typedef struct CHUNK {
   uint8_t space_hold;
@@ -21,65 +56,442 @@ typedef struct CHUNK {
   uint8_t meta;
 } CHUNK;
 
+typedef CHUNK * CLINK;
+
+#define TOLINK(chunk)   (chunk)
+#define FROMLINK(link)  (link)
+
+#define LEFT(chunk)           HDR_LOAD( (chunk)->l )
+#define RIGHT(chunk)          HDR_LOAD( (chunk)->r )
+#define SET_LEFT(chunk, q)    HDR_STORE( (chunk)->l = (q) )
+#define SET_RIGHT(chunk, q)   HDR_STORE( (chunk)->r = (q) )
+
 // We store the freebit -- 1 if the chunk is free, 0 if it is reserved --
-#define SET_FREEBIT(chunk) ( (chunk)->meta = 0x01 )
-#define CLR_FREEBIT(chunk) ( (chunk)->meta = 0x00 )
-#define GET_FREEBIT(chunk) ( (chunk)->meta )
+#define SET_FREEBIT(chunk) HDR_STORE( (chunk)->meta = 0x01 )
+#define CLR_FREEBIT(chunk) HDR_STORE( (chunk)->meta = 0x00 )
+#define GET_FREEBIT(chunk) HDR_LOAD( (chunk)->meta )
+
+#define ARENA_FIRST 0
+#endif
 
 // chunk size is implicit from l-r
-#define CHUNKSIZE(chunk) ( (char *)(chunk)->r - (char *)(chunk) )
+#define CHUNKSIZE(chunk) ( (char *)RIGHT(chunk) - (char *)(chunk) )
 #define TOCHUNK(vp) (-1 + (CHUNK *)(vp))
 #define FROMCHUNK(chunk) ((void *)(1 + (chunk)))
 #define ARENA_CHUNKS (ARENA_BYTES/sizeof(CHUNK))
 
-static CHUNK arena[ARENA_CHUNKS];
-static CHUNK *bot = NULL;       /* all free space, initially */
-static CHUNK *top = NULL;       /* delimiter chunk for top of arena */
+#define REQUEST_SIZE(nbytes) (sizeof(CHUNK) * (((nbytes)+sizeof(CHUNK)-1)/sizeof(CHUNK) + 1))
+#define LAZY_CLASS(chunksz) ((uint32_t)((chunksz) / sizeof(CHUNK)) - 2)
+
+#if defined(__GNU_BINNED__) || defined(__GNU_BEST_FIT__)
+#define GNU_INDEXED
+#define GNU_MIN_CHUNK     (2*sizeof(CHUNK))         // header + room for a free-list link pair
+#endif
+
+#define GNU_BINS          32
+#define GNU_EXACT_BINS    16
+#define GNU_LOG_BASE      4                         // log2(GNU_EXACT_BINS+2): first ranged bin starts at 18 units
+
+// All state of one heap. gnu_heap_init places this at the start of the caller's memory
+// and the chunks right after it; gnu_malloc and friends use a static default heap.
+struct gnu_heap {
+  CHUNK *   arena;                                  /* first CHUNK of the heap's memory */
+  uint32_t  chunks;                                 /* number of CHUNKs in it */
+  CHUNK *   bot;                                    /* all free space, initially */
+  CHUNK *   top;                                    /* delimiter chunk for top of arena */
+#ifdef __GNU_BEST_FIT__
+  CHUNK *   root;
+#endif
+#ifdef __GNU_BINNED__
+  CHUNK *   bins[GNU_BINS];
+  uint32_t  binmap;                                 // bit i is set when bins[i] is non-empty
+#endif
+  // For lazy free, keep up to LAZY_DEPTH freed chunks of each of the LAZY_CLASSES smallest
+  // chunk sizes (one CHUNK apart) for malloc to hand straight back.
+  void *    lazyhold[LAZY_CLASSES][LAZY_DEPTH];
+  uint8_t   lazyreserved[LAZY_CLASSES];
+#ifdef __ALLOC_STATS__
+  mem_stats_t stats;
+#endif
+#ifdef __ACCESS_COUNT__
+  mem_cost_t cost;
+#endif
+};
+
+static CHUNK default_arena[ARENA_CHUNKS] __attribute__ ((aligned(ARENA_ALIGN)));
+static gnu_heap_t default_heap = { default_arena, ARENA_CHUNKS };
+
+
+#ifdef __GNU_BEST_FIT__
+// Free chunks of at least GNU_TREE_THRESHOLD bytes are kept in a treap ordered by
+// (CHUNKSIZE, address). The heap priority is a hash of the chunk address, so no extra
+// state is stored and the expected depth stays O(log n). Nodes live in the free payload.
+typedef struct TREENODE {
+  CLINK left;
+  CLINK right;
+  CLINK parent;
+} TREENODE;
+
+#define NODE(chunk)                 ((TREENODE *)FROMCHUNK(chunk))
+#define TLEFT(chunk)                FROMLINK(HDR_LOAD(NODE(chunk)->left))
+#define TRIGHT(chunk)               FROMLINK(HDR_LOAD(NODE(chunk)->right))
+#define TPARENT(chunk)              FROMLINK(HDR_LOAD(NODE(chunk)->parent))
+#define SET_TLEFT(chunk, q)         HDR_STORE( NODE(chunk)->left = TOLINK(q) )
+#define SET_TRIGHT(chunk, q)        HDR_STORE( NODE(chunk)->right = TOLINK(q) )
+#define SET_TPARENT(chunk, q)       HDR_STORE( NODE(chunk)->parent = TOLINK(q) )
+#define PRIORITY(chunk)   ((uint32_t)(((uintptr_t)(chunk) >> 3) * 2654435761u))
+
+
+static int tree_less(gnu_heap_t * h, CHUNK * a, CHUNK * b) {
+  uint64_t sa = CHUNKSIZE(a), sb = CHUNKSIZE(b);
+  return (sa < sb) || (sa == sb && a < b);
+}
+
+// Lifts x above its parent, preserving the search order.
+static void tree_rotate_up(gnu_heap_t * h, CHUNK * x) {
+  CHUNK * p = TPARENT(x);
+  CHUNK * g = TPARENT(p);
+
+  if (TLEFT(p) == x) {
+    SET_TLEFT(p, TRIGHT(x));
+    if (TRIGHT(x)) {
+      SET_TPARENT(TRIGHT(x), p);
+    }
+    SET_TRIGHT(x, p);
+  } else {
+    SET_TRIGHT(p, TLEFT(x));
+    if (TLEFT(x)) {
+      SET_TPARENT(TLEFT(x), p);
+    }
+    SET_TLEFT(x, p);
+  }
+  SET_TPARENT(p, x);
+  SET_TPARENT(x, g);
+
+  if (!g) {
+    h->root = x;
+  } else if (TLEFT(g) == p) {
+    SET_TLEFT(g, x);
+  } else {
+    SET_TRIGHT(g, x);
+  }
+}
+
+static void tree_insert(gnu_heap_t * h, CHUNK * x) {
+  CHUNK * parent = NULL;
+  CHUNK * cur = h->root;
+
+  while (cur) {
+    parent = cur;
+    cur = tree_less(h, x, cur) ? TLEFT(cur) : TRIGHT(cur);
+  }
+
+  SET_TLEFT(x, NULL);
+  SET_TRIGHT(x, NULL);
+  SET_TPARENT(x, parent);
+  if (!parent) {
+    h->root = x;
+  } else if (tree_less(h, x, parent)) {
+    SET_TLEFT(parent, x);
+  } else {
+    SET_TRIGHT(parent, x);
+  }
+
+  while (TPARENT(x) && PRIORITY(x) > PRIORITY(TPARENT(x))) {
+    tree_rotate_up(h, x);
+  }
+}
+
+// Must be called before the chunk's size changes, the search order depends on it.
+static void tree_unlink(gnu_heap_t * h, CHUNK * x) {
+  CHUNK * l, * r, * p;
+
+  /* rotate x down to a leaf, always lifting the child with the higher priority */
+  for (;;) {
+    l = TLEFT(x);
+    r = TRIGHT(x);
+    if (!l && !r) {
+      break;
+    }
+    if (!l) {
+      tree_rotate_up(h, r);
+    } else if (!r || PRIORITY(l) > PRIORITY(r)) {
+      tree_rotate_up(h, l);
+    } else {
+      tree_rotate_up(h, r);
+    }
+  }
+
+  p = TPARENT(x);
+  if (!p) {
+    h->root = NULL;
+  } else if (TLEFT(p) == x) {
+    SET_TLEFT(p, NULL);
+  } else {
+    SET_TRIGHT(p, NULL);
+  }
+}
+
+// Removes and returns the smallest indexed chunk of at least size bytes (or NULL).
+static CHUNK * tree_take(gnu_heap_t * h, uint64_t size) {
+  CHUNK * best = NULL;
+  CHUNK * cur = h->root;
+
+  while (cur) {
+    STAT_STEP(&h->stats);
+    if (CHUNKSIZE(cur) >= size) {
+      best = cur;
+      cur = TLEFT(cur);
+    } else {
+      cur = TRIGHT(cur);
+    }
+  }
+  if (best) {
+    tree_unlink(h, best);
+  }
+  return best;
+}
+#endif
+
+#ifdef __GNU_BINNED__
+// Free chunks are threaded into size-class bins through their (unused) payload.
+// Chunk sizes are counted in units of sizeof(CHUNK): the first GNU_EXACT_BINS bins
+// hold exactly one size each (2, 3, ... units), the rest hold power-of-two ranges.
+typedef struct FREELINK {
+  CLINK fd;
+  CLINK bk;
+} FREELINK;
+
+#define LINKS(chunk)                ((FREELINK *)FROMCHUNK(chunk))
+#define NEXT_FREE(chunk)            FROMLINK(HDR_LOAD(LINKS(chunk)->fd))
+#define PREV_FREE(chunk)            FROMLINK(HDR_LOAD(LINKS(chunk)->bk))
+#define SET_NEXT_FREE(chunk, q)     HDR_STORE( LINKS(chunk)->fd = TOLINK(q) )
+#define SET_PREV_FREE(chunk, q)     HDR_STORE( LINKS(chunk)->bk = TOLINK(q) )
+
+
+
+#define LT(n) n, n, n, n, n, n, n, n, n, n, n, n, n, n, n, n
+static const char LogTable256[256] = 
+{
+    0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    LT(4), LT(5), LT(5), LT(6), LT(6), LT(6), LT(6),
+    LT(7), LT(7), LT(7), LT(7), LT(7), LT(7), LT(7), LT(7)
+};
+
+static uint32_t binlog2(uint32_t v) {
+  uint32_t t, tt;
+  tt = v >> 16;
+  if (tt > 0) {
+    t = tt >> 8;
+    return (t > 0) ? 0x18 | LogTable256[t] : 0x10 | LogTable256[tt];
+  }
+  t = v >> 8;
+  return (t > 0) ? 0x08 | LogTable256[t] : LogTable256[v];
+}
+
+static uint32_t bin_index(uint64_t size) {
+  uint32_t units = size / sizeof(CHUNK);
+  uint32_t idx;
+
+  // Nothing smaller than GNU_MIN_CHUNK (2 units) is ever binned; a request below it
+  // still maps to bin 0 rather than wrapping past the end of bins[].
+  if (units < GNU_EXACT_BINS + 2) {
+    return (units > 2) ? units - 2 : 0;
+  }
+  idx = GNU_EXACT_BINS + binlog2(units) - GNU_LOG_BASE;
+  return (idx < GNU_BINS) ? idx : GNU_BINS - 1;
+}
+
+static void bin_insert(gnu_heap_t * h, CHUNK * p) {
+  uint32_t idx = bin_index(CHUNKSIZE(p));
+
+  COST_META_LOAD(&h->cost, 1);
+  COST_META_STORE(&h->cost, 1);
+  SET_PREV_FREE(p, NULL);
+  SET_NEXT_FREE(p, h->bins[idx]);
+  if (h->bins[idx]) {
+    SET_PREV_FREE(h->bins[idx], p);
+  }
+  h->bins[idx] = p;
+  h->binmap |= (1u << idx);
+}
+
+// Must be called before the chunk's size changes, the bin is derived from it.
+static void bin_unlink(gnu_heap_t * h, CHUNK * p) {
+  uint32_t idx = bin_index(CHUNKSIZE(p));
+  CHUNK * fd = NEXT_FREE(p);
+  CHUNK * bk = PREV_FREE(p);
+
+  if (bk) {
+    SET_NEXT_FREE(bk, fd);
+  } else {
+    COST_META_STORE(&h->cost, 1);
+    h->bins[idx] = fd;
+  }
+  if (fd) {
+    SET_PREV_FREE(fd, bk);
+  }
+  if (!h->bins[idx]) {
+    h->binmap &= ~(1u << idx);
+  }
+}
+
+// Pops a free chunk of at least size bytes (or NULL). Exact bins and every bin above
+// the request's own bin fit by construction; only the request's ranged bin is walked.
+// Sizes covered by the best-fit tree are looked up there instead.
+static CHUNK * bin_take(gnu_heap_t * h, uint64_t size) {
+  uint32_t idx = bin_index(size);
+  uint32_t map;
+  CHUNK * p;
+
+  STAT_STEP(&h->stats);
 
-// For lazy free, store 32, 32-bit addresses
-static uint32_t lazyhold[32];
-static uint8_t  lazyreserved = 0;
+#ifdef __GNU_BEST_FIT__
+  if (size >= GNU_TREE_THRESHOLD) {
+    return tree_take(h, size);
+  }
+#endif
+
+  if (idx >= GNU_EXACT_BINS) {
+    COST_META_LOAD(&h->cost, 1);
+    for (p = h->bins[idx]; p != NULL; p = NEXT_FREE(p)) {
+      STAT_STEP(&h->stats);
+      if (CHUNKSIZE(p) >= size) {
+        bin_unlink(h, p);
+        return p;
+      }
+    }
+    ++idx;
+  }
+
+  map = (idx < GNU_BINS) ? h->binmap & (~0u << idx) : 0;
+  if (map) {
+    COST_META_LOAD(&h->cost, 1);
+    p = h->bins[binlog2(map & (~map + 1))];
+    bin_unlink(h, p);
+    return p;
+  }
+#ifdef __GNU_BEST_FIT__
+  /* every indexed chunk is larger than a binned request, so the smallest one is the best fit */
+  return tree_take(h, size);
+#else
+  return NULL;
+#endif
+}
+#endif
 
 
+#ifdef GNU_INDEXED
+// Files a free chunk with whichever index covers its size.
+static void free_insert(gnu_heap_t * h, CHUNK * p) {
+#ifdef __GNU_BEST_FIT__
+  if (CHUNKSIZE(p) >= GNU_TREE_THRESHOLD) {
+    tree_insert(h, p);
+    return;
+  }
+#endif
+#ifdef __GNU_BINNED__
+  bin_insert(h, p);
+#endif
+}
+
+static void free_unlink(gnu_heap_t * h, CHUNK * p) {
+#ifdef __GNU_BEST_FIT__
+  if (CHUNKSIZE(p) >= GNU_TREE_THRESHOLD) {
+    tree_unlink(h, p);
+    return;
+  }
+#endif
+#ifdef __GNU_BINNED__
+  bin_unlink(h, p);
+#endif
+}
+
+// With bins every request is served by the index; with the tree alone only large
+// requests are, smaller ones keep the first-fit walk.
+#ifdef __GNU_BINNED__
+#define INDEX_SERVES(size)  1
+#define index_take(size)    bin_take(h, size)
+#else
+#define INDEX_SERVES(size)  ((size) >= GNU_TREE_THRESHOLD)
+#define index_take(size)    tree_take(h, size)
+#endif
+#endif
+
 // This initializes the doubly-linked list of CHUNKS to point to the beginning and end of the arena (indicating the availability of the entire arena)
-static void init(void) {
-  bot = &arena[0]; top = &arena[ARENA_CHUNKS-1];
-  bot->l = NULL; 
-  bot->r = top;
-  bot->meta = 0x01;
+static void init(gnu_heap_t * h) {
+  h->bot = &h->arena[ARENA_FIRST]; h->top = &h->arena[h->chunks-1];
+  SET_LEFT(h->bot, NULL); 
+  SET_RIGHT(h->bot, h->top);
+  SET_FREEBIT(h->bot);
   
-  top->l = bot;  
-  top->r = NULL;
-  top->meta = 0x0;
+  SET_LEFT(h->top, h->bot);  
+  SET_RIGHT(h->top, NULL);
+  CLR_FREEBIT(h->top);
+
+#ifdef GNU_INDEXED
+  free_insert(h, h->bot);
+#endif
 }
 
 
 // This search through the doubly-linked list of chunks to find enough free space for an incoming request (returns NULL if no space is available.)
-#ifdef __DO_NOT_INLINE__ 
-   void * __attribute__ ((noinline)) gnu_malloc(unsigned nbytes)
-#else
-    void * gnu_malloc(unsigned nbytes)
-#endif
+static void * gnu_alloc_chunk(gnu_heap_t * h, unsigned nbytes)
 {
   CHUNK *p;
   uint64_t size, chunksz;
   uint8_t res1, res2;
 
-  if (!bot){
-    init();
+  if (!h->bot){
+    init(h);
   }
 
   nbytes = (nbytes <= 0) ? 1 : nbytes;
 
   /* Using Division to compute Upper Bound */
-  size = sizeof(CHUNK) * ((nbytes+sizeof(CHUNK)-1)/sizeof(CHUNK) + 1); // Will be automatically converted into the corresponding shift operator defined in our paper 
-  p = bot;
+  size = REQUEST_SIZE(nbytes); // Will be automatically converted into the corresponding shift operator defined in our paper 
+
+#ifdef GNU_INDEXED
+  if (INDEX_SERVES(size)) {
+    p = index_take(size);
+    if (!p) {
+      return NULL;
+    }
+
+    CLR_FREEBIT(p);
+    chunksz = CHUNKSIZE(p);
+
+    /* only split off a remainder that can carry its own free-list links */
+    if (chunksz - size >= GNU_MIN_CHUNK) {
+      CHUNK * q, * pr;
+
+      q = (CHUNK *)(size + (char *)p );
+      pr = RIGHT(p);
+
+      SET_LEFT(q, p); 
+      SET_RIGHT(q, pr);
+
+      SET_RIGHT(p, q); 
+      SET_LEFT(pr, q);
+
+      SET_FREEBIT(q);
+      free_insert(h, q);
+    }
+    return FROMCHUNK(p);
+  }
+#endif
+
+  p = h->bot;
   while (p != NULL) {
+    STAT_STEP(&h->stats);
     chunksz = CHUNKSIZE(p);
 
     res1 = chunksz > size;
     res2 = chunksz == size;
     if (GET_FREEBIT(p) && (res1 || res2)) {
+#ifdef GNU_INDEXED
+        free_unlink(h, p);
+#endif
         CLR_FREEBIT(p);
 
         /* create a remainder chunk */
@@ -87,76 +499,435 @@ static void init(void) {
             CHUNK * q, * pr;
 
             q = (CHUNK *)(size + (char *)p );
-            pr = p->r;
+            pr = RIGHT(p);
 
-            q->l = p; 
-            q->r = pr;
+            SET_LEFT(q, p); 
+            SET_RIGHT(q, pr);
             
-            p->r = q; 
-            pr->l = q;
+            SET_RIGHT(p, q); 
+            SET_LEFT(pr, q);
 
             SET_FREEBIT(q);
+#ifdef GNU_INDEXED
+            free_insert(h, q);
+#endif
           }      
       break;
     }
-    p = p->r;
+    p = RIGHT(p);
   }
   return (!p) ? NULL : FROMCHUNK(p);
 
 }
 
-#ifdef __DO_NOT_INLINE__ 
-    void __attribute__ ((noinline)) gnu_free(void * vp)
-#else   
-    void gnu_free(void * vp)
+#ifdef GNU_INDEXED
+#define GNU_SPLIT_MIN     GNU_MIN_CHUNK
+#else
+#define GNU_SPLIT_MIN     sizeof(CHUNK)
+#endif
+
+// gnu_alloc_chunk for a payload whose address is a multiple of alignment (a power of two).
+// Chunks are walked in address order; in the first free one that fits, the space in front
+// of the first aligned payload is split off as a free chunk of its own (it must be able to
+// stand alone, so a gap too small for that moves on to the next aligned payload), and the
+// tail is split off as usual. The arena starts on an ARENA_ALIGN boundary, so gaps are
+// always whole chunks.
+static void * gnu_alloc_aligned(gnu_heap_t * h, unsigned alignment, unsigned nbytes)
+{
+  CHUNK *p, *q, *pr;
+  uint64_t size, chunksz, gap;
+
+  if (!h->bot){
+    init(h);
+  }
+
+  nbytes = (nbytes <= 0) ? 1 : nbytes;
+  size = REQUEST_SIZE(nbytes);
+  if (alignment < sizeof(CHUNK)) {
+    alignment = sizeof(CHUNK);
+  }
+
+  for (p = h->bot; p != NULL; p = RIGHT(p)) {
+    STAT_STEP(&h->stats);
+    if (!GET_FREEBIT(p)) {
+      continue;
+    }
+    chunksz = CHUNKSIZE(p);
+    gap = (alignment - ((uintptr_t)FROMCHUNK(p) & (alignment - 1))) & (alignment - 1);
+    while (gap != 0 && gap < GNU_SPLIT_MIN) {
+      gap += alignment;
+    }
+    if (chunksz < gap + size) {
+      continue;
+    }
+
+#ifdef GNU_INDEXED
+    free_unlink(h, p);
 #endif
+    if (gap != 0) {
+      /* p keeps the gap and stays free; the aligned chunk starts after it */
+      q = (CHUNK *)(gap + (char *)p);
+      pr = RIGHT(p);
+
+      SET_LEFT(q, p);
+      SET_RIGHT(q, pr);
+
+      SET_RIGHT(p, q);
+      SET_LEFT(pr, q);
+#ifdef GNU_INDEXED
+      free_insert(h, p);
+#endif
+      p = q;
+      chunksz -= gap;
+    }
+    CLR_FREEBIT(p);
+
+    if (chunksz - size >= GNU_SPLIT_MIN) {
+      q = (CHUNK *)(size + (char *)p);
+      pr = RIGHT(p);
+
+      SET_LEFT(q, p);
+      SET_RIGHT(q, pr);
+
+      SET_RIGHT(p, q);
+      SET_LEFT(pr, q);
+
+      SET_FREEBIT(q);
+#ifdef GNU_INDEXED
+      free_insert(h, q);
+#endif
+    }
+    return FROMCHUNK(p);
+  }
+  return NULL;
+}
+
+// Cuts up to count chunks of size bytes, end to end, out of the free chunk p (already off
+// the index), stores their payloads to out[] and returns how many. Only the last chunk
+// touches the rest of the list: a tail that can stand alone is split off and filed once,
+// a smaller one is left to the last chunk.
+static uint32_t gnu_carve(gnu_heap_t * h, CHUNK * p, uint64_t size, uint32_t count, void ** out)
+{
+  CHUNK *q, *pr;
+  uint64_t chunksz = CHUNKSIZE(p);
+  uint32_t k, n = (uint32_t)((chunksz / size < count) ? chunksz / size : count);
+
+  pr = RIGHT(p);
+  CLR_FREEBIT(p);
+  for (k = 0; k < n; ++k) {
+    out[k] = FROMCHUNK(p);
+    if (k + 1 == n) {
+      break;
+    }
+    q = (CHUNK *)(size + (char *)p);
+    SET_RIGHT(p, q);
+    SET_LEFT(q, p);
+    SET_RIGHT(q, pr);
+    CLR_FREEBIT(q);
+    p = q;
+  }
+
+  if (chunksz - n * size >= GNU_SPLIT_MIN) {
+    q = (CHUNK *)(size + (char *)p);
+
+    SET_LEFT(q, p);
+    SET_RIGHT(q, pr);
+
+    SET_RIGHT(p, q);
+    SET_LEFT(pr, q);
+
+    SET_FREEBIT(q);
+#ifdef GNU_INDEXED
+    free_insert(h, q);
+#endif
+  } else if (n > 1) {
+    SET_LEFT(pr, p);
+  }
+  return n;
+}
+
+// gnu_alloc_chunk for up to count payloads of nbytes, stored to out[]; returns how many.
+// Every free chunk found is carved into as many of them as it holds (gnu_carve), so the
+// index is asked once per chunk rather than once per payload, first for a chunk that
+// holds the whole rest of the batch. Without an index, one walk of the list serves the
+// whole batch.
+static uint32_t gnu_alloc_chunks(gnu_heap_t * h, unsigned nbytes, uint32_t count, void ** out)
+{
+  CHUNK *p;
+  uint64_t size;
+  uint32_t got = 0;
+
+  if (!h->bot){
+    init(h);
+  }
+
+  nbytes = (nbytes <= 0) ? 1 : nbytes;
+  size = REQUEST_SIZE(nbytes);
+
+#ifdef GNU_INDEXED
+  if (INDEX_SERVES(size)) {
+    while (got < count) {
+      p = (count - got > 1) ? index_take(size * (count - got)) : NULL;
+      if (!p) {
+        p = index_take(size);
+      }
+      if (!p) {
+        break;
+      }
+      got += gnu_carve(h, p, size, count - got, out + got);
+    }
+    return got;
+  }
+#endif
+
+  p = h->bot;
+  while (p != NULL && got < count) {
+    STAT_STEP(&h->stats);
+    if (GET_FREEBIT(p) && CHUNKSIZE(p) >= size) {
+#ifdef GNU_INDEXED
+      free_unlink(h, p);
+#endif
+      got += gnu_carve(h, p, size, count - got, out + got);
+      p = TOCHUNK(out[got - 1]);
+    }
+    p = RIGHT(p);
+  }
+  return got;
+}
+
+static void gnu_release(gnu_heap_t * h, void * vp);
+
+// Returns every chunk held by the lazy-free cache to the arena; nonzero if there were any.
+static uint8_t lazy_flush(gnu_heap_t * h) {
+  uint8_t flushed = 0;
+
+  for (int c = 0; c < LAZY_CLASSES; ++c) {
+    while (h->lazyreserved[c] > 0) {
+      COST_META_LOAD(&h->cost, 1);
+      gnu_release(h, h->lazyhold[c][--h->lazyreserved[c]]);
+      flushed = 1;
+    }
+  }
+  return flushed;
+}
+
+// Lays a heap out over [base, base+bytes): the heap state first, then the chunks (from an
+// ARENA_ALIGN boundary). Returns NULL when the region cannot hold the state and a few chunks.
+gnu_heap_t * gnu_heap_init(void * base, size_t bytes) {
+  uintptr_t start = ((uintptr_t)base + 7) & ~(uintptr_t)7;
+  uintptr_t end = (uintptr_t)base + bytes;
+  gnu_heap_t * h = (gnu_heap_t *)start;
+  uintptr_t first = (start + sizeof(gnu_heap_t) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  uint64_t chunks;
+
+  if (!base || end < first || (end - first) / sizeof(CHUNK) < ARENA_FIRST + 4) {
+    return NULL;
+  }
+  chunks = (end - first) / sizeof(CHUNK);
+#ifdef __GNU_COMPACT_HEADER__
+  /* links are 32-bit byte offsets */
+  if (chunks > 0xFFFFFFFFull / sizeof(CHUNK)) {
+    chunks = 0xFFFFFFFFull / sizeof(CHUNK);
+  }
+#endif
+
+  memset(h, 0, sizeof(gnu_heap_t));
+  h->arena = (CHUNK *)first;
+  h->chunks = (uint32_t)chunks;
+  init(h);
+  return h;
+}
+
+// Serves a request from the lazy-free cache when a chunk of exactly the right size is
+// waiting there, and only then searches the arena. If the arena is out of space, the
+// cache is flushed and the search retried once.
+static void * gnu_serve(gnu_heap_t * h, unsigned nbytes)
+{
+  void * vp;
+  uint32_t lclass = LAZY_CLASS(REQUEST_SIZE((nbytes <= 0) ? 1 : nbytes));
+
+  if (lclass < LAZY_CLASSES && h->lazyreserved[lclass] > 0) {
+    COST_META_LOAD(&h->cost, 1);
+    return h->lazyhold[lclass][--h->lazyreserved[lclass]];
+  }
+
+  vp = gnu_alloc_chunk(h, nbytes);
+  if (!vp && lazy_flush(h)) {
+    vp = gnu_alloc_chunk(h, nbytes);
+  }
+  return vp;
+}
+
+// gnu_serve for count payloads of nbytes: the lazy-free cache of their size is emptied
+// first, the rest comes from one batch of gnu_alloc_chunks, retried once after a flush.
+static uint32_t gnu_serve_batch(gnu_heap_t * h, unsigned nbytes, uint32_t count, void ** out)
+{
+  uint32_t got = 0;
+  uint32_t lclass = LAZY_CLASS(REQUEST_SIZE((nbytes <= 0) ? 1 : nbytes));
+
+  while (got < count && lclass < LAZY_CLASSES && h->lazyreserved[lclass] > 0) {
+    COST_META_LOAD(&h->cost, 1);
+    out[got++] = h->lazyhold[lclass][--h->lazyreserved[lclass]];
+  }
+
+  got += gnu_alloc_chunks(h, nbytes, count - got, out + got);
+  if (got < count && lazy_flush(h)) {
+    got += gnu_alloc_chunks(h, nbytes, count - got, out + got);
+  }
+  return got;
+}
+
+void * gnu_heap_malloc(gnu_heap_t * h, unsigned nbytes)
+{
+  COST_CALL(&h->cost, COST_MALLOC);
+  void * vp = gnu_serve(h, nbytes);
+
+  STAT_MALLOC(&h->stats, nbytes, vp, CHUNKSIZE(TOCHUNK(vp)));
+  return vp;
+}
+// Aligned requests skip the lazy-free cache (it is kept by size, not by address) and walk
+// the arena; on failure the cache is flushed and the walk retried once.
+void * gnu_heap_memalign(gnu_heap_t * h, unsigned alignment, unsigned nbytes)
+{
+  COST_CALL(&h->cost, COST_MALLOC);
+  void * vp = NULL;
+
+  if (alignment != 0 && (alignment & (alignment - 1)) == 0) {
+    vp = gnu_alloc_aligned(h, alignment, nbytes);
+    if (!vp && lazy_flush(h)) {
+      vp = gnu_alloc_aligned(h, alignment, nbytes);
+    }
+  }
+  STAT_MALLOC(&h->stats, nbytes, vp, CHUNKSIZE(TOCHUNK(vp)));
+  return vp;
+}
+
+// Puts a chunk back and merges it with free neighbours (the statistics are left to the callers).
+static void gnu_release(gnu_heap_t * h, void * vp)
  {
   CHUNK *p, *q;
-  if (!vp) {
-    return;
-  }
 
   p = TOCHUNK(vp);
   CLR_FREEBIT(p);
-  q = p->l;
+  q = LEFT(p);
   if (q != NULL && GET_FREEBIT(q)) /* try to consolidate leftward */
     {
-
+#ifdef GNU_INDEXED
+      free_unlink(h, q);
+#endif
       CLR_FREEBIT(q);
-      q->r        = p->r;
-      ((p->r))->l = q;
+      SET_RIGHT(q, RIGHT(p));
+      SET_LEFT(RIGHT(p), q);
       SET_FREEBIT(q);
 
       p = q;
     }
 
-  q = p->r;
+  q = RIGHT(p);
 
   if (q != NULL && GET_FREEBIT(q)) /* try to consolidate rightward */
     {
+#ifdef GNU_INDEXED
+      free_unlink(h, q);
+#endif
       CLR_FREEBIT(q);
-      p->r      = q->r;
-      (q->r)->l = p;
+      SET_RIGHT(p, RIGHT(q));
+      SET_LEFT(RIGHT(q), p);
       SET_FREEBIT(q);
     }
   SET_FREEBIT(p);  
+#ifdef GNU_INDEXED
+  free_insert(h, p);
+#endif
 }
 
-void * gnu_realloc(void * vp, unsigned newbytes) {
+void gnu_heap_free(gnu_heap_t * h, void * vp)
+{
+  COST_CALL(&h->cost, COST_FREE);
+  if (!vp) {
+    return;
+  }
+  STAT_FREE(&h->stats, vp, CHUNKSIZE(TOCHUNK(vp)));
+  gnu_release(h, vp);
+}
+
+// count payloads of nbytes each, cut end to end out of as few free chunks as possible (see
+// gnu_alloc_chunks). Returns how many were allocated; out[] past them is NULL.
+unsigned gnu_heap_malloc_batch(gnu_heap_t * h, unsigned count, unsigned nbytes, void ** out)
+{
+  COST_CALL(&h->cost, COST_MALLOC);
+  uint32_t got = gnu_serve_batch(h, nbytes, count, out), i;
+
+  for (i = got; i < count; ++i) {
+    out[i] = NULL;
+  }
+#ifdef __ALLOC_STATS__
+  for (i = 0; i < count; ++i) {
+    STAT_MALLOC(&h->stats, nbytes, out[i], CHUNKSIZE(TOCHUNK(out[i])));
+  }
+#endif
+  return got;
+}
+
+// Releases the chunks first .. last, neighbours in the arena, as one: first is stretched
+// over the others (two link writes), then released, merged and filed once.
+static void gnu_release_range(gnu_heap_t * h, CHUNK * first, CHUNK * last)
+{
+  CHUNK *pr;
+
+  if (last != first) {
+    pr = RIGHT(last);
+    SET_RIGHT(first, pr);
+    SET_LEFT(pr, first);
+  }
+  gnu_release(h, FROMCHUNK(first));
+}
+
+// Frees every non-NULL payload of ptrs[]. Consecutive entries whose chunks are neighbours
+// in the arena, as gnu_heap_malloc_batch hands them out, are released as one chunk (see
+// gnu_release_range).
+void gnu_heap_free_batch(gnu_heap_t * h, void ** ptrs, unsigned count)
+{
+  COST_CALL(&h->cost, COST_FREE);
+  CHUNK *p, *first = NULL, *last = NULL;
+  uint32_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (!ptrs[i]) {
+      continue;
+    }
+    p = TOCHUNK(ptrs[i]);
+    STAT_FREE(&h->stats, ptrs[i], CHUNKSIZE(p));
+    if (last && RIGHT(last) == p) {
+      last = p;
+      continue;
+    }
+    if (first) {
+      gnu_release_range(h, first, last);
+    }
+    first = last = p;
+  }
+  if (first) {
+    gnu_release_range(h, first, last);
+  }
+}
+
+void * gnu_heap_realloc(gnu_heap_t * h, void * vp, unsigned newbytes) {
+  COST_CALL(&h->cost, COST_REALLOC);
   void *newp = NULL;
   char *cnewp, *cvp;
-
   int idx = 0;
+
   /* behavior on corner cases conforms to SUSv2 */
   if (vp == NULL)
-    return gnu_malloc(newbytes);
+    return gnu_heap_malloc(h, newbytes);
 
   if (newbytes != 0)
     {
       CHUNK *oldchunk;
       uint64_t bytes;
 
-      if ( (newp = gnu_malloc(newbytes)) == NULL)
+      if ( (newp = gnu_heap_malloc(h, newbytes)) == NULL)
         return NULL;
       oldchunk = TOCHUNK(vp);
       bytes = CHUNKSIZE(oldchunk) - sizeof(CHUNK);
@@ -165,50 +936,195 @@ void * gnu_realloc(void * vp, unsigned newbytes) {
 
       cnewp   = (char *)newp;
       cvp     = (char *)vp;
+      COST_ARENA_LOAD(&h->cost, (bytes + 3) >> 2);
+      COST_ARENA_STORE(&h->cost, (bytes + 3) >> 2);
       for(idx = 0; idx < bytes; ++ idx) {
         cnewp[idx]=cvp[idx];
       }
     }
 
-  gnu_free(vp);
+  gnu_heap_free(h, vp);
   return newp;
 }
 
-void * gnu_calloc(unsigned nelem, unsigned elsize) {
+void * gnu_heap_calloc(gnu_heap_t * h, unsigned nelem, unsigned elsize) {
+  COST_CALL(&h->cost, COST_CALLOC);
   void *vp;
   unsigned nbytes;
   unsigned char * cvp;
   unsigned int i = 0;
 
   nbytes = nelem * elsize;
-  if ( (vp = gnu_malloc(nbytes)) == NULL)
+  if ( (vp = gnu_heap_malloc(h, nbytes)) == NULL)
     return NULL;
 
   cvp = (unsigned char *)vp;
+  COST_ARENA_STORE(&h->cost, (nbytes + 3) >> 2);
   for(i=0; i< nbytes; ++i) {
     cvp[i]='\0';
   }
   return vp;
 }
 
+void gnu_heap_lazyfree(gnu_heap_t * h, void * vp) {
+  COST_CALL(&h->cost, COST_FREE);
+  uint32_t lclass;
 
+  if (!vp) {
+    return;
+  }
 
-#ifdef __DO_NOT_INLINE__ 
-    void __attribute__ ((noinline)) gnu_lazyfree(void * vp)
-#else   
-    void gnu_lazyfree(void * vp)
+  STAT_FREE(&h->stats, vp, CHUNKSIZE(TOCHUNK(vp)));
+  lclass = LAZY_CLASS(CHUNKSIZE(TOCHUNK(vp)));
+  if (lclass < LAZY_CLASSES && h->lazyreserved[lclass] < LAZY_DEPTH) {
+    COST_META_STORE(&h->cost, 1);
+    h->lazyhold[lclass][h->lazyreserved[lclass]++] = vp;
+    return;
+  }
+  gnu_release(h, vp);
+}
+
+// Sums the free chunks (headers included) and finds the largest. Walks every chunk.
+static void free_space(gnu_heap_t * h, uint64_t * free_bytes, uint64_t * largest) {
+  CHUNK *p;
+  uint64_t chunksz;
+
+  *free_bytes = 0;
+  *largest = 0;
+  if (!h->bot) {
+    *free_bytes = *largest = (uint64_t)(h->chunks - ARENA_FIRST - 1) * sizeof(CHUNK);
+    return;
+  }
+
+  for (p = h->bot; p != h->top; p = RIGHT(p)) {
+    if (GET_FREEBIT(p)) {
+      chunksz = CHUNKSIZE(p);
+      *free_bytes += chunksz;
+      if (chunksz > *largest) {
+        *largest = chunksz;
+      }
+    }
+  }
+}
+
+// External fragmentation in per-mille: the share of free bytes lying outside the largest
+// free chunk (0 when all free space is contiguous). Walks every chunk, so it is meant for
+// comparing placement policies rather than for the allocation path.
+unsigned gnu_heap_fragmentation(gnu_heap_t * h) {
+  uint64_t free_bytes, largest;
+
+  free_space(h, &free_bytes, &largest);
+  return (free_bytes == 0) ? 0 : (unsigned)(1000 - (largest * 1000) / free_bytes);
+}
+
+#ifdef __ALLOC_STATS__
+void gnu_heap_get_stats(gnu_heap_t * h, mem_stats_t * s) {
+  uint64_t free_bytes, largest;
+
+  free_space(h, &free_bytes, &largest);
+  *s = h->stats;
+  STAT_FINISH(s, free_bytes, largest);
+}
 #endif
-{
 
-  if(lazyreserved < 32) {
-    lazyhold[lazyreserved++] = (uint32_t)vp;
+#ifdef __ACCESS_COUNT__
+void gnu_heap_get_cost(gnu_heap_t * h, mem_cost_t * c) {
+  *c = h->cost;
+}
+#endif
+
+#ifdef __HEAP_MAP__
+// Every free chunk, header included, is one free block. Walks every chunk.
+void gnu_heap_map(gnu_heap_t * h, mem_map_t * m) {
+  CHUNK *p;
+
+  map_start(m, h->chunks * sizeof(CHUNK));
+  if (!h->bot) {
+    map_free_block(m, ARENA_FIRST * sizeof(CHUNK), (h->chunks - ARENA_FIRST - 1) * sizeof(CHUNK));
   } else {
-    lazyreserved = 0;
-    gnu_free(vp);
-    for(int i = 0; i < 32; ++i) {
-      gnu_free((void*)lazyhold[i]);
+    for (p = h->bot; p != h->top; p = RIGHT(p)) {
+      if (GET_FREEBIT(p)) {
+        map_free_block(m, (uint32_t)((char *)p - (char *)h->arena), (uint32_t)CHUNKSIZE(p));
+      }
     }
   }
+  map_finish(m);
+}
+#endif
+
+
+//==------------------------------------------==//
+// [Default heap: the static arena of ARENA_BYTES]
 
+#ifdef __DO_NOT_INLINE__ 
+   void * __attribute__ ((noinline)) gnu_malloc(unsigned nbytes)
+#else
+    void * gnu_malloc(unsigned nbytes)
+#endif
+{
+  return gnu_heap_malloc(&default_heap, nbytes);
+}
+
+#ifdef __DO_NOT_INLINE__ 
+    void __attribute__ ((noinline)) gnu_free(void * vp)
+#else   
+    void gnu_free(void * vp)
+#endif
+{
+  gnu_heap_free(&default_heap, vp);
+}
+
+void * gnu_realloc(void * vp, unsigned newbytes) {
+  return gnu_heap_realloc(&default_heap, vp, newbytes);
+}
+
+void * gnu_calloc(unsigned nelem, unsigned elsize) {
+  return gnu_heap_calloc(&default_heap, nelem, elsize);
+}
+
+unsigned gnu_malloc_batch(unsigned count, unsigned nbytes, void ** out) {
+  return gnu_heap_malloc_batch(&default_heap, count, nbytes, out);
+}
 
+void gnu_free_batch(void ** ptrs, unsigned count) {
+  gnu_heap_free_batch(&default_heap, ptrs, count);
+}
+
+void * gnu_memalign(unsigned alignment, unsigned nbytes) {
+  return gnu_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+void * gnu_aligned_alloc(unsigned alignment, unsigned nbytes) {
+  return gnu_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+unsigned gnu_fragmentation(void) {
+  return gnu_heap_fragmentation(&default_heap);
+}
+
+#ifdef __ALLOC_STATS__
+void gnu_get_stats(mem_stats_t * s) {
+  gnu_heap_get_stats(&default_heap, s);
+}
+#endif
+
+#ifdef __HEAP_MAP__
+void gnu_map(mem_map_t * m) {
+  gnu_heap_map(&default_heap, m);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void gnu_get_cost(mem_cost_t * c) {
+  gnu_heap_get_cost(&default_heap, c);
+}
+#endif
+
+#ifdef __DO_NOT_INLINE__ 
+    void __attribute__ ((noinline)) gnu_lazyfree(void * vp)
+#else   
+    void gnu_lazyfree(void * vp)
+#endif
+{
+  gnu_heap_lazyfree(&default_heap, vp);
 }
\ No newline at end of file
@@ -18,13 +18,64 @@ typedef uint32_t HEAPWIDTH;
 #define GETADDR(ADDR) ((void *)(ADDR))
 #define HEAPWIDTH_SZ sizeof(HEAPWIDTH)
 
+// The bump pointer of one heap. CURR and PREV count LCHUNKs, so a request of n bytes
+// moves CURR by n/HEAPWIDTH_SZ.
+struct lin_heap {
+	LCHUNK * base;
+	LCHUNK * curr;
+	LCHUNK * prev;
+	LCHUNK * end;
+#ifdef __ALLOC_STATS__
+	mem_stats_t stats;
+#endif
+#ifdef __ACCESS_COUNT__
+	mem_cost_t cost;
+#endif
+};
+
 static HEAPWIDTH larena[LARENA_CHUNKS];
-static LCHUNK * CURR_ADDR 	= larena;
-static LCHUNK * PREV_ADDR 	= larena;
-static LCHUNK * END 		= &larena[LARENA_CHUNKS-1];
+static lin_heap_t default_heap = { larena, larena, larena, &larena[LARENA_CHUNKS-1] };
 
+#ifdef __ALLOC_STATS__
+// Nothing is given back before lin_heap_freeall, so the blocks live are the bytes below CURR.
+#define STAT_USED(h) 	do { 															\
+							(h)->stats.live_bytes = (uint32_t)(((h)->curr - (h)->base) * HEAPWIDTH_SZ); \
+							if((h)->stats.live_bytes > (h)->stats.peak_bytes) { 		\
+								(h)->stats.peak_bytes = (h)->stats.live_bytes; 			\
+							} 															\
+						} while(0)
+#else
+#define STAT_USED(h)
+#endif
 
-void * __attribute__ ((noinline)) lin_malloc(unsigned nbytes) {
+// Lays a heap out over [base, base+bytes): the heap state first, then the arena. Returns
+// NULL when the region cannot hold the state.
+lin_heap_t * lin_heap_init(void * base, size_t bytes) {
+	uintptr_t start = ((uintptr_t)base + 7) & ~(uintptr_t)7;
+	uintptr_t first = start + ((sizeof(lin_heap_t) + 7) & ~(size_t)7);
+	uintptr_t end = (uintptr_t)base + bytes;
+	lin_heap_t * h = (lin_heap_t *)start;
+
+	if(!base || end < first + HEAPWIDTH_SZ) {
+		return NULL;
+	}
+	h->base = (LCHUNK *)first;
+	h->curr = h->base;
+	h->prev = h->base;
+	h->end 	= h->base + (end - first) / HEAPWIDTH_SZ;
+#ifdef __ALLOC_STATS__
+	memset(&h->stats, 0, sizeof(mem_stats_t));
+#endif
+#ifdef __ACCESS_COUNT__
+	memset(&h->cost, 0, sizeof(mem_cost_t));
+#endif
+	return h;
+}
+
+// The bump pointer is heap state, so lin touches no metadata words at all; only calloc's
+// clearing counts, as arena stores.
+void * lin_heap_malloc(lin_heap_t * h, unsigned nbytes) {
+	COST_CALL(&h->cost, COST_MALLOC);
 	uint32_t size = nbytes;
 	uint32_t newsize=0;
 
@@ -32,60 +83,229 @@ void * __attribute__ ((noinline)) lin_malloc(unsigned nbytes) {
 		size = HEAPWIDTH_SZ;
 	}
 	
-	if((size&MASK) != 0) {
-		newsize=(size&(~0x03))+HEAPWIDTH_SZ;
-	} else {
-		newsize=size;
-	}
+	// Rounded up a word at a time, so sizes near 2^32 cannot wrap to nothing.
+	newsize = size / HEAPWIDTH_SZ + ((size & MASK) != 0);
 
-	if(newsize >= (END-CURR_ADDR)) {
+	if(newsize >= (h->end-h->curr)) {
+		STAT_MALLOC(&h->stats, nbytes, NULL, 0);
 		return NULL;
 	}
-	PREV_ADDR = CURR_ADDR;
-	CURR_ADDR += newsize;
+	h->prev = h->curr;
+	h->curr += newsize;
+	STAT_MALLOC(&h->stats, nbytes, h->prev, newsize * HEAPWIDTH_SZ);
+	STAT_USED(h);
 	
-	return GETADDR(PREV_ADDR);
+	return GETADDR(h->prev);
 }
 
+// Bumps CURR up to the next multiple of alignment, then allocates from there. The words
+// skipped are only given back by lin_heap_freeall, like everything else.
+void * lin_heap_memalign(lin_heap_t * h, unsigned alignment, unsigned nbytes) {
+	COST_CALL(&h->cost, COST_MALLOC);
+	uint32_t size = (nbytes == 0) ? HEAPWIDTH_SZ : nbytes;
+	uint32_t newsize, pad;
 
-void * __attribute__ ((noinline)) lin_realloc(void * p, unsigned newsize) {
+	if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		STAT_MALLOC(&h->stats, nbytes, NULL, 0);
+		return NULL;
+	}
+	if(alignment < HEAPWIDTH_SZ) {
+		alignment = HEAPWIDTH_SZ;
+	}
+	newsize = size / HEAPWIDTH_SZ + ((size & MASK) != 0);
+	pad = (uint32_t)((alignment - ((uintptr_t)h->curr & (alignment - 1))) & (alignment - 1)) / HEAPWIDTH_SZ;
+
+	if(pad + newsize >= (h->end-h->curr)) {
+		STAT_MALLOC(&h->stats, nbytes, NULL, 0);
+		return NULL;
+	}
+	h->prev = h->curr + pad;
+	h->curr = h->prev + newsize;
+	STAT_MALLOC(&h->stats, nbytes, h->prev, (pad + newsize) * HEAPWIDTH_SZ);
+	STAT_USED(h);
+
+	return GETADDR(h->prev);
+}
+
+// One bump for as many of the count blocks as fit, laid end to end; out[] past them is
+// NULL. PREV is left at the last one, so it is the block realloc can still grow.
+unsigned lin_heap_malloc_batch(lin_heap_t * h, unsigned count, unsigned size, void ** out) {
+	COST_CALL(&h->cost, COST_MALLOC);
+	uint32_t newsize = (((size == 0) ? HEAPWIDTH_SZ : size) + MASK) / HEAPWIDTH_SZ;
+	uint32_t fit, i;
+
+	fit = (uint32_t)((h->end - h->curr) / newsize);
+	if(fit > 0 && fit * newsize == (uint32_t)(h->end - h->curr)) {
+		--fit;
+	}
+	if(fit > count) {
+		fit = count;
+	}
+	for(i = 0; i < count; ++i) {
+		out[i] = (i < fit) ? GETADDR(h->curr + i * newsize) : NULL;
+		STAT_MALLOC(&h->stats, size, out[i], (i < fit) ? newsize * HEAPWIDTH_SZ : 0);
+	}
+	if(fit > 0) {
+		h->prev = h->curr + (fit - 1) * newsize;
+		h->curr += fit * newsize;
+		STAT_USED(h);
+	}
+	return fit;
+}
+
+void lin_heap_free_batch(lin_heap_t * h, void ** ptrs, unsigned count) {
+	COST_CALL(&h->cost, COST_FREE);
+#ifdef __ALLOC_STATS__
+	unsigned i;
+
+	for(i = 0; i < count; ++i) {
+		if(ptrs[i]) {
+			++h->stats.frees;
+		}
+	}
+#endif
+}
+
+void * lin_heap_realloc(lin_heap_t * h, void * p, unsigned newsize) {
+	COST_CALL(&h->cost, COST_REALLOC);
 	newsize = (newsize <= 0) ? HEAPWIDTH_SZ : newsize;
 		
 	if(!p) {
-		return lin_malloc(newsize);
+		return lin_heap_malloc(h, newsize);
 	}
 
-	int size = ((newsize&MASK) == 0) ? newsize : ((newsize&(~MASK))+HEAPWIDTH_SZ);;
+	int size = (((newsize&MASK) == 0) ? newsize : ((newsize&(~MASK))+HEAPWIDTH_SZ)) / HEAPWIDTH_SZ;
 	
-	if(p == PREV_ADDR && size < (END-PREV_ADDR)) {
-		CURR_ADDR = PREV_ADDR + size;
+	if(p == h->prev && size < (h->end-h->prev)) {
+#ifdef __ALLOC_STATS__
+		h->stats.requested_bytes += newsize;
+		h->stats.granted_bytes += size * HEAPWIDTH_SZ;
+#endif
+		h->curr = h->prev + size;
+		STAT_USED(h);
 		return p;
 	}
+	STAT_MALLOC(&h->stats, newsize, NULL, 0);
 	return NULL;
 }
 
 
-void * __attribute__ ((noinline)) lin_calloc(unsigned nelem, unsigned elsize) {
+void * lin_heap_calloc(lin_heap_t * h, unsigned nelem, unsigned elsize) {
+  COST_CALL(&h->cost, COST_CALLOC);
   void *vp;
   unsigned nbytes;
   unsigned char * cvp;
   unsigned int i = 0;
 
   nbytes = nelem * elsize;
-  if ( (vp = lin_malloc(nbytes)) == NULL)
+  if ( (vp = lin_heap_malloc(h, nbytes)) == NULL)
     return NULL;
   cvp = (unsigned char *)vp;
+  COST_ARENA_STORE(&h->cost, (nbytes + 3) >> 2);
   for(i=0; i< nbytes; ++i) {
     cvp[i]='\0';
   }
   return vp;
 }
 
+void lin_heap_free(lin_heap_t * h, void * p) {
+	COST_CALL(&h->cost, COST_FREE);
+#ifdef __ALLOC_STATS__
+	if(p) {
+		++h->stats.frees;
+	}
+#endif
+}
+
+
+void lin_heap_freeall(lin_heap_t * h)  {
+	h->curr = h->base;
+	h->prev = h->base;
+#ifdef __ALLOC_STATS__
+	h->stats.live_blocks = 0;
+	h->stats.live_bytes = 0;
+#endif
+}
+
+#ifdef __ALLOC_STATS__
+// The only free space is the run above CURR.
+void lin_heap_get_stats(lin_heap_t * h, mem_stats_t * s) {
+	uint32_t left = (uint32_t)((h->end - h->curr) * HEAPWIDTH_SZ);
+
+	*s = h->stats;
+	STAT_FINISH(s, left, left);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void lin_heap_get_cost(lin_heap_t * h, mem_cost_t * c) {
+	*c = h->cost;
+}
+#endif
+
+#ifdef __HEAP_MAP__
+// The only free block is the run above CURR.
+void lin_heap_map(lin_heap_t * h, mem_map_t * m) {
+	map_start(m, (uint32_t)((h->end - h->base) * HEAPWIDTH_SZ));
+	map_free_block(m, (uint32_t)((h->curr - h->base) * HEAPWIDTH_SZ), (uint32_t)((h->end - h->curr) * HEAPWIDTH_SZ));
+	map_finish(m);
+}
+#endif
+
+
+//==------------------------------------------==//
+// [Default heap: the static arena of ARENA_BYTES]
+
+void * __attribute__ ((noinline)) lin_malloc(unsigned nbytes) {
+	return lin_heap_malloc(&default_heap, nbytes);
+}
+
+void * __attribute__ ((noinline)) lin_realloc(void * p, unsigned newsize) {
+	return lin_heap_realloc(&default_heap, p, newsize);
+}
+
+void * __attribute__ ((noinline)) lin_calloc(unsigned nelem, unsigned elsize) {
+	return lin_heap_calloc(&default_heap, nelem, elsize);
+}
+
+void * __attribute__ ((noinline)) lin_memalign(unsigned alignment, unsigned nbytes) {
+	return lin_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+void * __attribute__ ((noinline)) lin_aligned_alloc(unsigned alignment, unsigned nbytes) {
+	return lin_heap_memalign(&default_heap, alignment, nbytes);
+}
+
+unsigned __attribute__ ((noinline)) lin_malloc_batch(unsigned count, unsigned size, void ** out) {
+	return lin_heap_malloc_batch(&default_heap, count, size, out);
+}
+
 void lin_free(void * p) {
+	lin_heap_free(&default_heap, p);
 }
 
+void lin_free_batch(void ** ptrs, unsigned count) {
+	lin_heap_free_batch(&default_heap, ptrs, count);
+}
 
 void lin_freeall()  {
-	CURR_ADDR = larena;
-	PREV_ADDR = larena;
-}
\ No newline at end of file
+	lin_heap_freeall(&default_heap);
+}
+
+#ifdef __ALLOC_STATS__
+void lin_get_stats(mem_stats_t * s) {
+	lin_heap_get_stats(&default_heap, s);
+}
+#endif
+
+#ifdef __HEAP_MAP__
+void lin_map(mem_map_t * m) {
+	lin_heap_map(&default_heap, m);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void lin_get_cost(mem_cost_t * c) {
+	lin_heap_get_cost(&default_heap, c);
+}
+#endif
\ No newline at end of file
@@ -11,155 +11,90 @@
 
 #include "memutils.h"
 
-static uint32_t N0_FAST_ARENA___8[  64] 		= {0}; 
-static uint32_t N1_FAST_ARENA___8[  64] 		= {0}; 
-static uint32_t N2_FAST_ARENA___8[  64] 		= {0}; 
-static uint32_t N3_FAST_ARENA___8[  64] 		= {0}; 
-static uint32_t N_FAST_ARENA___16[ 128] 		= {0}; 
-static uint32_t N_FAST_ARENA___32[ 256] 		= {0}; 
-static uint32_t N_FAST_ARENA___64[ 512] 		= {0}; 
-static uint32_t N_FAST_ARENA__128[1024] 		= {0}; 
-static uint32_t N_FAST_ARENA__256[2048] 		= {0}; 
-static uint32_t N_FAST_ARENA__512[4096] 		= {0}; 
-static uint32_t N_FAST_ARENA_1024[8192] 		= {0}; 
-
-
-static uint32_t N_FREE_ADDRESS___LT[11] = {
-										0, 0, 0, 0, 0, 0,
-										0, 0, 0, 0, 0
-									};
-
-static const uint8_t  N_SHIFT_LEFTS__LT[11] = {
-												3, 3, 3, 3, 4, 5, 6, 7, 8, 9, 10
-											};
-
-static uint32_t * N_FAST_ADDRESS___LT[11][32] = {
-													{
-													N0_FAST_ARENA___8 + 0, N0_FAST_ARENA___8 + 2, N0_FAST_ARENA___8 + 4, N0_FAST_ARENA___8 + 6, 
-													N0_FAST_ARENA___8 + 8, N0_FAST_ARENA___8 + 10, N0_FAST_ARENA___8 + 12, N0_FAST_ARENA___8 + 14, 
-													N0_FAST_ARENA___8 + 16, N0_FAST_ARENA___8 + 18, N0_FAST_ARENA___8 + 20, N0_FAST_ARENA___8 + 22, 
-													N0_FAST_ARENA___8 + 24, N0_FAST_ARENA___8 + 26, N0_FAST_ARENA___8 + 28, N0_FAST_ARENA___8 + 30, 
-													N0_FAST_ARENA___8 + 32, N0_FAST_ARENA___8 + 34, N0_FAST_ARENA___8 + 36, N0_FAST_ARENA___8 + 38, 
-													N0_FAST_ARENA___8 + 40, N0_FAST_ARENA___8 + 42, N0_FAST_ARENA___8 + 44, N0_FAST_ARENA___8 + 46, 
-													N0_FAST_ARENA___8 + 48, N0_FAST_ARENA___8 + 50, N0_FAST_ARENA___8 + 52, N0_FAST_ARENA___8 + 54, 
-													N0_FAST_ARENA___8 + 56, N0_FAST_ARENA___8 + 58, N0_FAST_ARENA___8 + 60, N0_FAST_ARENA___8 + 62, 
-													},
-
-													{
-													N1_FAST_ARENA___8 + 0, N1_FAST_ARENA___8 + 2, N1_FAST_ARENA___8 + 4, N1_FAST_ARENA___8 + 6, 
-													N1_FAST_ARENA___8 + 8, N1_FAST_ARENA___8 + 10, N1_FAST_ARENA___8 + 12, N1_FAST_ARENA___8 + 14, 
-													N1_FAST_ARENA___8 + 16, N1_FAST_ARENA___8 + 18, N1_FAST_ARENA___8 + 20, N1_FAST_ARENA___8 + 22, 
-													N1_FAST_ARENA___8 + 24, N1_FAST_ARENA___8 + 26, N1_FAST_ARENA___8 + 28, N1_FAST_ARENA___8 + 30, 
-													N1_FAST_ARENA___8 + 32, N1_FAST_ARENA___8 + 34, N1_FAST_ARENA___8 + 36, N1_FAST_ARENA___8 + 38, 
-													N1_FAST_ARENA___8 + 40, N1_FAST_ARENA___8 + 42, N1_FAST_ARENA___8 + 44, N1_FAST_ARENA___8 + 46, 
-													N1_FAST_ARENA___8 + 48, N1_FAST_ARENA___8 + 50, N1_FAST_ARENA___8 + 52, N1_FAST_ARENA___8 + 54, 
-													N1_FAST_ARENA___8 + 56, N1_FAST_ARENA___8 + 58, N1_FAST_ARENA___8 + 60, N1_FAST_ARENA___8 + 62, 
-													},
-
-													{
-													N2_FAST_ARENA___8 + 0, N2_FAST_ARENA___8 + 2, N2_FAST_ARENA___8 + 4, N2_FAST_ARENA___8 + 6, 
-													N2_FAST_ARENA___8 + 8, N2_FAST_ARENA___8 + 10, N2_FAST_ARENA___8 + 12, N2_FAST_ARENA___8 + 14, 
-													N2_FAST_ARENA___8 + 16, N2_FAST_ARENA___8 + 18, N2_FAST_ARENA___8 + 20, N2_FAST_ARENA___8 + 22, 
-													N2_FAST_ARENA___8 + 24, N2_FAST_ARENA___8 + 26, N2_FAST_ARENA___8 + 28, N2_FAST_ARENA___8 + 30, 
-													N2_FAST_ARENA___8 + 32, N2_FAST_ARENA___8 + 34, N2_FAST_ARENA___8 + 36, N2_FAST_ARENA___8 + 38, 
-													N2_FAST_ARENA___8 + 40, N2_FAST_ARENA___8 + 42, N2_FAST_ARENA___8 + 44, N2_FAST_ARENA___8 + 46, 
-													N2_FAST_ARENA___8 + 48, N2_FAST_ARENA___8 + 50, N2_FAST_ARENA___8 + 52, N2_FAST_ARENA___8 + 54, 
-													N2_FAST_ARENA___8 + 56, N2_FAST_ARENA___8 + 58, N2_FAST_ARENA___8 + 60, N2_FAST_ARENA___8 + 62, 
-													},
-
-													{
-													N3_FAST_ARENA___8 + 0, N3_FAST_ARENA___8 + 2, N3_FAST_ARENA___8 + 4, N3_FAST_ARENA___8 + 6, 
-													N3_FAST_ARENA___8 + 8, N3_FAST_ARENA___8 + 10, N3_FAST_ARENA___8 + 12, N3_FAST_ARENA___8 + 14, 
-													N3_FAST_ARENA___8 + 16, N3_FAST_ARENA___8 + 18, N3_FAST_ARENA___8 + 20, N3_FAST_ARENA___8 + 22, 
-													N3_FAST_ARENA___8 + 24, N3_FAST_ARENA___8 + 26, N3_FAST_ARENA___8 + 28, N3_FAST_ARENA___8 + 30, 
-													N3_FAST_ARENA___8 + 32, N3_FAST_ARENA___8 + 34, N3_FAST_ARENA___8 + 36, N3_FAST_ARENA___8 + 38, 
-													N3_FAST_ARENA___8 + 40, N3_FAST_ARENA___8 + 42, N3_FAST_ARENA___8 + 44, N3_FAST_ARENA___8 + 46, 
-													N3_FAST_ARENA___8 + 48, N3_FAST_ARENA___8 + 50, N3_FAST_ARENA___8 + 52, N3_FAST_ARENA___8 + 54, 
-													N3_FAST_ARENA___8 + 56, N3_FAST_ARENA___8 + 58, N3_FAST_ARENA___8 + 60, N3_FAST_ARENA___8 + 62, 
-													},
-
-													{
-													N_FAST_ARENA___16 + 0, N_FAST_ARENA___16 + 4, N_FAST_ARENA___16 + 8, N_FAST_ARENA___16 + 12, 
-													N_FAST_ARENA___16 + 16, N_FAST_ARENA___16 + 20, N_FAST_ARENA___16 + 24, N_FAST_ARENA___16 + 28, 
-													N_FAST_ARENA___16 + 32, N_FAST_ARENA___16 + 36, N_FAST_ARENA___16 + 40, N_FAST_ARENA___16 + 44, 
-													N_FAST_ARENA___16 + 48, N_FAST_ARENA___16 + 52, N_FAST_ARENA___16 + 56, N_FAST_ARENA___16 + 60, 
-													N_FAST_ARENA___16 + 64, N_FAST_ARENA___16 + 68, N_FAST_ARENA___16 + 72, N_FAST_ARENA___16 + 76, 
-													N_FAST_ARENA___16 + 80, N_FAST_ARENA___16 + 84, N_FAST_ARENA___16 + 88, N_FAST_ARENA___16 + 92, 
-													N_FAST_ARENA___16 + 96, N_FAST_ARENA___16 + 100, N_FAST_ARENA___16 + 104, N_FAST_ARENA___16 + 108, 
-													N_FAST_ARENA___16 + 112, N_FAST_ARENA___16 + 116, N_FAST_ARENA___16 + 120, N_FAST_ARENA___16 + 124, 
-													},
-
-													{
-													N_FAST_ARENA___32 + 0, N_FAST_ARENA___32 + 8, N_FAST_ARENA___32 + 16, N_FAST_ARENA___32 + 24, 
-													N_FAST_ARENA___32 + 32, N_FAST_ARENA___32 + 40, N_FAST_ARENA___32 + 48, N_FAST_ARENA___32 + 56, 
-													N_FAST_ARENA___32 + 64, N_FAST_ARENA___32 + 72, N_FAST_ARENA___32 + 80, N_FAST_ARENA___32 + 88, 
-													N_FAST_ARENA___32 + 96, N_FAST_ARENA___32 + 104, N_FAST_ARENA___32 + 112, N_FAST_ARENA___32 + 120, 
-													N_FAST_ARENA___32 + 128, N_FAST_ARENA___32 + 136, N_FAST_ARENA___32 + 144, N_FAST_ARENA___32 + 152, 
-													N_FAST_ARENA___32 + 160, N_FAST_ARENA___32 + 168, N_FAST_ARENA___32 + 176, N_FAST_ARENA___32 + 184, 
-													N_FAST_ARENA___32 + 192, N_FAST_ARENA___32 + 200, N_FAST_ARENA___32 + 208, N_FAST_ARENA___32 + 216, 
-													N_FAST_ARENA___32 + 224, N_FAST_ARENA___32 + 232, N_FAST_ARENA___32 + 240, N_FAST_ARENA___32 + 248, 
-													},
-
-													{
-													N_FAST_ARENA___64 + 0, N_FAST_ARENA___64 + 16, N_FAST_ARENA___64 + 32, N_FAST_ARENA___64 + 48, 
-													N_FAST_ARENA___64 + 64, N_FAST_ARENA___64 + 80, N_FAST_ARENA___64 + 96, N_FAST_ARENA___64 + 112, 
-													N_FAST_ARENA___64 + 128, N_FAST_ARENA___64 + 144, N_FAST_ARENA___64 + 160, N_FAST_ARENA___64 + 176, 
-													N_FAST_ARENA___64 + 192, N_FAST_ARENA___64 + 208, N_FAST_ARENA___64 + 224, N_FAST_ARENA___64 + 240, 
-													N_FAST_ARENA___64 + 256, N_FAST_ARENA___64 + 272, N_FAST_ARENA___64 + 288, N_FAST_ARENA___64 + 304, 
-													N_FAST_ARENA___64 + 320, N_FAST_ARENA___64 + 336, N_FAST_ARENA___64 + 352, N_FAST_ARENA___64 + 368, 
-													N_FAST_ARENA___64 + 384, N_FAST_ARENA___64 + 400, N_FAST_ARENA___64 + 416, N_FAST_ARENA___64 + 432, 
-													N_FAST_ARENA___64 + 448, N_FAST_ARENA___64 + 464, N_FAST_ARENA___64 + 480, N_FAST_ARENA___64 + 496, 
-													},
-
-													{
-													N_FAST_ARENA__128 + 0, N_FAST_ARENA__128 + 32, N_FAST_ARENA__128 + 64, N_FAST_ARENA__128 + 96, 
-													N_FAST_ARENA__128 + 128, N_FAST_ARENA__128 + 160, N_FAST_ARENA__128 + 192, N_FAST_ARENA__128 + 224, 
-													N_FAST_ARENA__128 + 256, N_FAST_ARENA__128 + 288, N_FAST_ARENA__128 + 320, N_FAST_ARENA__128 + 352, 
-													N_FAST_ARENA__128 + 384, N_FAST_ARENA__128 + 416, N_FAST_ARENA__128 + 448, N_FAST_ARENA__128 + 480, 
-													N_FAST_ARENA__128 + 512, N_FAST_ARENA__128 + 544, N_FAST_ARENA__128 + 576, N_FAST_ARENA__128 + 608, 
-													N_FAST_ARENA__128 + 640, N_FAST_ARENA__128 + 672, N_FAST_ARENA__128 + 704, N_FAST_ARENA__128 + 736, 
-													N_FAST_ARENA__128 + 768, N_FAST_ARENA__128 + 800, N_FAST_ARENA__128 + 832, N_FAST_ARENA__128 + 864, 
-													N_FAST_ARENA__128 + 896, N_FAST_ARENA__128 + 928, N_FAST_ARENA__128 + 960, N_FAST_ARENA__128 + 992, 
-													},
-
-													{
-													N_FAST_ARENA__256 + 0, N_FAST_ARENA__256 + 64, N_FAST_ARENA__256 + 128, N_FAST_ARENA__256 + 192, 
-													N_FAST_ARENA__256 + 256, N_FAST_ARENA__256 + 320, N_FAST_ARENA__256 + 384, N_FAST_ARENA__256 + 448, 
-													N_FAST_ARENA__256 + 512, N_FAST_ARENA__256 + 576, N_FAST_ARENA__256 + 640, N_FAST_ARENA__256 + 704, 
-													N_FAST_ARENA__256 + 768, N_FAST_ARENA__256 + 832, N_FAST_ARENA__256 + 896, N_FAST_ARENA__256 + 960, 
-													N_FAST_ARENA__256 + 1024, N_FAST_ARENA__256 + 1088, N_FAST_ARENA__256 + 1152, N_FAST_ARENA__256 + 1216, 
-													N_FAST_ARENA__256 + 1280, N_FAST_ARENA__256 + 1344, N_FAST_ARENA__256 + 1408, N_FAST_ARENA__256 + 1472, 
-													N_FAST_ARENA__256 + 1536, N_FAST_ARENA__256 + 1600, N_FAST_ARENA__256 + 1664, N_FAST_ARENA__256 + 1728, 
-													N_FAST_ARENA__256 + 1792, N_FAST_ARENA__256 + 1856, N_FAST_ARENA__256 + 1920, N_FAST_ARENA__256 + 1984, 
-													},
-
-													{
-													N_FAST_ARENA__512 + 0, N_FAST_ARENA__512 + 128, N_FAST_ARENA__512 + 256, N_FAST_ARENA__512 + 384, 
-													N_FAST_ARENA__512 + 512, N_FAST_ARENA__512 + 640, N_FAST_ARENA__512 + 768, N_FAST_ARENA__512 + 896, 
-													N_FAST_ARENA__512 + 1024, N_FAST_ARENA__512 + 1152, N_FAST_ARENA__512 + 1280, N_FAST_ARENA__512 + 1408, 
-													N_FAST_ARENA__512 + 1536, N_FAST_ARENA__512 + 1664, N_FAST_ARENA__512 + 1792, N_FAST_ARENA__512 + 1920, 
-													N_FAST_ARENA__512 + 2048, N_FAST_ARENA__512 + 2176, N_FAST_ARENA__512 + 2304, N_FAST_ARENA__512 + 2432, 
-													N_FAST_ARENA__512 + 2560, N_FAST_ARENA__512 + 2688, N_FAST_ARENA__512 + 2816, N_FAST_ARENA__512 + 2944, 
-													N_FAST_ARENA__512 + 3072, N_FAST_ARENA__512 + 3200, N_FAST_ARENA__512 + 3328, N_FAST_ARENA__512 + 3456, 
-													N_FAST_ARENA__512 + 3584, N_FAST_ARENA__512 + 3712, N_FAST_ARENA__512 + 3840, N_FAST_ARENA__512 + 3968, 
-													},
-
-													{
-													N_FAST_ARENA_1024 + 0, N_FAST_ARENA_1024 + 256, N_FAST_ARENA_1024 + 512, N_FAST_ARENA_1024 + 768, 
-													N_FAST_ARENA_1024 + 1024, N_FAST_ARENA_1024 + 1280, N_FAST_ARENA_1024 + 1536, N_FAST_ARENA_1024 + 1792, 
-													N_FAST_ARENA_1024 + 2048, N_FAST_ARENA_1024 + 2304, N_FAST_ARENA_1024 + 2560, N_FAST_ARENA_1024 + 2816, 
-													N_FAST_ARENA_1024 + 3072, N_FAST_ARENA_1024 + 3328, N_FAST_ARENA_1024 + 3584, N_FAST_ARENA_1024 + 3840, 
-													N_FAST_ARENA_1024 + 4096, N_FAST_ARENA_1024 + 4352, N_FAST_ARENA_1024 + 4608, N_FAST_ARENA_1024 + 4864, 
-													N_FAST_ARENA_1024 + 5120, N_FAST_ARENA_1024 + 5376, N_FAST_ARENA_1024 + 5632, N_FAST_ARENA_1024 + 5888, 
-													N_FAST_ARENA_1024 + 6144, N_FAST_ARENA_1024 + 6400, N_FAST_ARENA_1024 + 6656, N_FAST_ARENA_1024 + 6912, 
-													N_FAST_ARENA_1024 + 7168, N_FAST_ARENA_1024 + 7424, N_FAST_ARENA_1024 + 7680, N_FAST_ARENA_1024 + 7936, 
-													},
-
-											};
-
-/* For lazy free, store 32, 32-bit addresses */
-static uint32_t lazyhold[32];
-static uint8_t  lazyreserved = 0;
+// All size classes share one arena, laid out in class order. The classes, their slot
+// counts and the lookup tables come from lutclasses.h, generated by tools/lutgen.c from a
+// request-size profile. A pointer's class comes from a radix table indexed by its offset
+// in 2^LUT_RADIX_SHIFT byte granules, its slot from one subtract and shift. Each class
+// owns as many occupancy words as its slot count needs.
+#include "lutclasses.h"
+
+static const uint32_t N_FREE_INIT____LT[LUT_OCCUPANCY_WORDS] = LUT_OCCUPANCY_INIT;
+
+#ifdef __LUT_HYBRID__
+// Requests the classes cannot serve go to the heap's own backing heap of LUT_BACKING_SCHEME,
+// laid over the rest of its region; pointers outside the LUT arena are handed back to it.
+#define BACKING_CALL_(scheme, fn) 			scheme##_##fn
+#define BACKING_CALL(scheme, fn) 			BACKING_CALL_(scheme, fn)
+#define BACKING_HEAP_T 						BACKING_CALL(LUT_BACKING_SCHEME, heap_t)
+#define BACKING_INIT 						BACKING_CALL(LUT_BACKING_SCHEME, heap_init)
+#define BACKING_MALLOC(n) 					BACKING_CALL(LUT_BACKING_SCHEME, heap_malloc)(backing_heap(h), n)
+#define BACKING_REALLOC(p, n) 				BACKING_CALL(LUT_BACKING_SCHEME, heap_realloc)(backing_heap(h), p, n)
+#define BACKING_MEMALIGN(a, n) 				BACKING_CALL(LUT_BACKING_SCHEME, heap_memalign)(backing_heap(h), a, n)
+#define BACKING_FREE(p) 					BACKING_CALL(LUT_BACKING_SCHEME, heap_free)(backing_heap(h), p)
+#define BACKING_MALLOC_BATCH(c, n, o) 		BACKING_CALL(LUT_BACKING_SCHEME, heap_malloc_batch)(backing_heap(h), c, n, o)
+#ifdef __LUT_CLASS_LOCKS__
+#define BACKING_LOCK() 						FINE_LOCK(&h->backing_lock)
+#define BACKING_UNLOCK() 					FINE_UNLOCK(&h->backing_lock)
+#else
+#define BACKING_LOCK()
+#define BACKING_UNLOCK()
+#endif
+#endif
+
+// The state of one heap. Every heap has the class layout of lutclasses.h; only where its
+// arena lives and which slots are taken differ.
+struct lut_heap {
+	char * 		arena;
+	uint32_t 	N_FREE_ADDRESS___LT[LUT_OCCUPANCY_WORDS];
+	/* For lazy free, keep up to LAZY_DEPTH freed slots of each of the first LAZY_CLASSES classes */
+	void * 		lazyhold[LAZY_CLASSES][LAZY_DEPTH];
+	uint8_t  	lazyreserved[LAZY_CLASSES];
+#ifdef __LUT_HYBRID__
+	BACKING_HEAP_T * backing;
+#endif
+#ifdef __LUT_CLASS_LOCKS__
+	// Each class's occupancy words are guarded by its own lock, so threads taking slots of
+	// different classes never wait on each other. backing_lock guards the heap's own backing
+	// heap (and the first-use layout of the default heap's), which no other heap shares.
+	fine_lock_t class_lock[LUT_CLASSES];
+	fine_lock_t backing_lock;
+#endif
+#ifdef __ALLOC_STATS__
+	// Blocks of the backing allocator are counted in its own statistics, not these.
+	mem_stats_t stats;
+#endif
+#ifdef __ACCESS_COUNT__
+	// Likewise the words the backing allocator touches.
+	mem_cost_t 	cost;
+#endif
+};
+
+// Bytes of the slot at offset within the LUT arena, for the statistics.
+#define SLOT_BYTES(offset) 					(1u << N_SHIFT_LEFTS__LT[N_CLASS_RADIX__LT[(offset) >> LUT_RADIX_SHIFT]])
+
+#ifdef __LUT_CLASS_LOCKS__
+#define CLASS_LOCK(i) 						FINE_LOCK(&h->class_lock[i])
+#define CLASS_UNLOCK(i) 					FINE_UNLOCK(&h->class_lock[i])
+#else
+#define CLASS_LOCK(i)
+#define CLASS_UNLOCK(i)
+#endif
+
+static uint32_t LUT_ARENA[LUT_ARENA_BYTES >> 2] __attribute__ ((aligned(ARENA_ALIGN))) = {0};
+static lut_heap_t default_heap = { (char *)LUT_ARENA, LUT_OCCUPANCY_INIT };
+
+#ifdef __LUT_HYBRID__
+// The default heap's backing heap gets a static region of its own, laid out on first use;
+// every other heap has one from lut_heap_init.
+static uint64_t LUT_BACKING_REGION[ARENA_BYTES >> 3] __attribute__ ((aligned(ARENA_ALIGN)));
+
+static BACKING_HEAP_T * backing_heap(lut_heap_t * h) {
+	if(!h->backing) {
+		h->backing = BACKING_INIT(LUT_BACKING_REGION, sizeof(LUT_BACKING_REGION));
+	}
+	return h->backing;
+}
+#endif
 
 #define LT(n) n, n, n, n, n, n, n, n, n, n, n, n, n, n, n, n
 static const char LogTable256[256] = 
@@ -185,135 +120,598 @@ uint32_t ilog2 (uint32_t v) {  	// 32-bit word to find the log of
 }
 
 
-#ifdef __DO_NOT_INLINE__ 
-    void *  __attribute__ ((noinline)) lut_malloc(unsigned bytes)
-#else   
-    void * lut_malloc(unsigned bytes)
+// Takes the first free slot of the first class, from first_class upwards, with one free.
+static void * lut_take_slot(lut_heap_t * h, uint32_t first_class) {
+
+	// conduct linear search ^^ 
+	for(int i = first_class; i < LUT_CLASSES; ++ i) {
+		CLASS_LOCK(i);
+		for(int w = N_WORD_BASE____LT[i]; w < N_WORD_BASE____LT[i+1]; ++w) {
+			STAT_STEP(&h->stats);
+			COST_META_LOAD(&h->cost, 1);
+			uint32_t FREE_ADDRESS 	= h->N_FREE_ADDRESS___LT[w];
+			if(FREE_ADDRESS != 0xFFFFFFFF) {
+				COST_META_STORE(&h->cost, 1);
+				uint32_t z_vec 		= ~FREE_ADDRESS & ~(~FREE_ADDRESS-1);
+				uint32_t addr_idx 	= ((w - N_WORD_BASE____LT[i]) << 5) + ilog2(z_vec);
+				h->N_FREE_ADDRESS___LT[w] |= z_vec;
+				CLASS_UNLOCK(i);
+				return (void *)(h->arena + N_CLASS_BASE___LT[i] + (addr_idx << N_SHIFT_LEFTS__LT[i]));
+			}
+		}
+		CLASS_UNLOCK(i);
+	}
+	return NULL;
+}
+
+// lut_take_slot for up to count slots, stored to out[]; returns how many. The classes are
+// searched once for the whole batch, and every free slot an occupancy word holds is taken
+// with one write to it, lowest first, before the search moves on.
+static uint32_t lut_take_slots(lut_heap_t * h, uint32_t first_class, uint32_t count, void ** out) {
+	uint32_t got = 0;
+
+	for(int i = first_class; i < LUT_CLASSES && got < count; ++ i) {
+		CLASS_LOCK(i);
+		for(int w = N_WORD_BASE____LT[i]; w < N_WORD_BASE____LT[i+1] && got < count; ++w) {
+			STAT_STEP(&h->stats);
+			COST_META_LOAD(&h->cost, 1);
+			uint32_t FREE_SLOTS 	= ~h->N_FREE_ADDRESS___LT[w];
+			uint32_t taken 			= 0;
+			while(FREE_SLOTS != 0 && got < count) {
+				uint32_t z_vec 		= FREE_SLOTS & ~(FREE_SLOTS-1);
+				uint32_t addr_idx 	= ((w - N_WORD_BASE____LT[i]) << 5) + ilog2(z_vec);
+				out[got++] = (void *)(h->arena + N_CLASS_BASE___LT[i] + (addr_idx << N_SHIFT_LEFTS__LT[i]));
+				taken |= z_vec;
+				FREE_SLOTS &= ~z_vec;
+			}
+			if(taken) {
+				COST_META_STORE(&h->cost, 1);
+				h->N_FREE_ADDRESS___LT[w] |= taken;
+			}
+		}
+		CLASS_UNLOCK(i);
+	}
+	return got;
+}
+
+// lut_take_slot for a slot whose address is a multiple of alignment (a power of two). In a
+// class of 2^k-byte slots those are every (alignment >> k)-th slot from the first aligned
+// one, or every slot once the slots are at least that large and the class base is aligned.
+static void * lut_take_aligned_slot(lut_heap_t * h, uint32_t first_class, uint32_t alignment) {
+
+	for(int i = first_class; i < LUT_CLASSES; ++ i) {
+		uint32_t skew 	= (uint32_t)((alignment - ((uintptr_t)h->arena + N_CLASS_BASE___LT[i])) & (alignment - 1));
+		uint32_t step 	= (alignment >> N_SHIFT_LEFTS__LT[i]) ? (alignment >> N_SHIFT_LEFTS__LT[i]) : 1;
+		uint32_t slot 	= skew >> N_SHIFT_LEFTS__LT[i];
+		uint32_t mask 	= 0;
+
+		// No slot of this class starts on the boundary.
+		if(skew & ((1u << N_SHIFT_LEFTS__LT[i]) - 1)) {
+			continue;
+		}
+		CLASS_LOCK(i);
+		if(step < 32) {
+			// The aligned slots sit at the same bits of every occupancy word.
+			for(uint32_t b = slot; b < 32; b += step) {
+				mask |= 1u << b;
+			}
+			for(int w = N_WORD_BASE____LT[i]; w < N_WORD_BASE____LT[i+1]; ++w) {
+				STAT_STEP(&h->stats);
+				COST_META_LOAD(&h->cost, 1);
+				uint32_t FREE_ALIGNED 	= ~h->N_FREE_ADDRESS___LT[w] & mask;
+				if(FREE_ALIGNED != 0) {
+					COST_META_STORE(&h->cost, 1);
+					uint32_t z_vec 		= FREE_ALIGNED & ~(FREE_ALIGNED-1);
+					uint32_t addr_idx 	= ((w - N_WORD_BASE____LT[i]) << 5) + ilog2(z_vec);
+					h->N_FREE_ADDRESS___LT[w] |= z_vec;
+					CLASS_UNLOCK(i);
+					return (void *)(h->arena + N_CLASS_BASE___LT[i] + (addr_idx << N_SHIFT_LEFTS__LT[i]));
+				}
+			}
+		} else {
+			for(; slot < N_SLOTS______LT[i]; slot += step) {
+				uint32_t w = N_WORD_BASE____LT[i] + (slot >> 5);
+				STAT_STEP(&h->stats);
+				COST_META_LOAD(&h->cost, 1);
+				if(!((h->N_FREE_ADDRESS___LT[w] >> (slot & 0x1F)) & 0x1)) {
+					COST_META_STORE(&h->cost, 1);
+					h->N_FREE_ADDRESS___LT[w] |= 1u << (slot & 0x1F);
+					CLASS_UNLOCK(i);
+					return (void *)(h->arena + N_CLASS_BASE___LT[i] + (slot << N_SHIFT_LEFTS__LT[i]));
+				}
+			}
+		}
+		CLASS_UNLOCK(i);
+	}
+	return NULL;
+}
+
+static void lut_release(lut_heap_t * h, void * p);
+
+#ifndef __LUT_CLASS_LOCKS__
+// Returns every slot held by the lazy-free cache to its class; nonzero if there were any.
+static uint8_t lazy_flush(lut_heap_t * h) {
+	uint8_t flushed = 0;
+
+	for(int c = 0; c < LAZY_CLASSES; ++c) {
+		while(h->lazyreserved[c] > 0) {
+			COST_META_LOAD(&h->cost, 1);
+			lut_release(h, h->lazyhold[c][--h->lazyreserved[c]]);
+			flushed = 1;
+		}
+	}
+	return flushed;
+}
+#endif
+
+
+static void * lut_serve(lut_heap_t * h, unsigned bytes)
+ {
+	void * vp;
+
+	if(bytes == 0) {
+		bytes = 1;
+	}
+
+	uint32_t log2bytes 			= ilog2(bytes);
+	uint32_t roundbytes 		= 1u << log2bytes;
+	uint32_t logidx 			= (bytes > roundbytes ) ? log2bytes+1 : log2bytes;
+	uint32_t first_class 		= N_FIRST_CLASS__LT[logidx];
+
+#ifdef __LUT_CLASS_LOCKS__
+	// The lazy-free cache is shared by the whole heap, so class-locked builds do without it.
+	vp = lut_take_slot(h, first_class);
+#else
+	// A slot of this class waiting in the lazy-free cache skips the search entirely.
+	if(first_class < LAZY_CLASSES && h->lazyreserved[first_class] > 0) {
+		COST_META_LOAD(&h->cost, 1);
+		return h->lazyhold[first_class][--h->lazyreserved[first_class]];
+	}
+
+	vp = lut_take_slot(h, first_class);
+	if(!vp && lazy_flush(h)) {
+		vp = lut_take_slot(h, first_class);
+	}
 #endif
+#ifdef __LUT_HYBRID__
+	if(!vp) {
+		BACKING_LOCK();
+		vp = BACKING_MALLOC(bytes);
+		BACKING_UNLOCK();
+	}
+#endif
+	return vp;
+	
+}
 
+// lut_serve for count blocks of bytes: the lazy-free cache of their class is emptied first,
+// the rest comes from one batch search of the classes, retried once after a flush. Hybrid
+// builds hand whatever is still missing to the backing allocator as one batch too.
+static uint32_t lut_serve_batch(lut_heap_t * h, unsigned bytes, uint32_t count, void ** out)
  {
+	uint32_t got = 0;
+
+	if(bytes == 0) {
+		bytes = 1;
+	}
 
 	uint32_t log2bytes 			= ilog2(bytes);
-	uint32_t roundbytes 		= 1 << log2bytes;
+	uint32_t roundbytes 		= 1u << log2bytes;
 	uint32_t logidx 			= (bytes > roundbytes ) ? log2bytes+1 : log2bytes;
+	uint32_t first_class 		= N_FIRST_CLASS__LT[logidx];
 
+#ifndef __LUT_CLASS_LOCKS__
+	while(got < count && first_class < LAZY_CLASSES && h->lazyreserved[first_class] > 0) {
+		COST_META_LOAD(&h->cost, 1);
+		out[got++] = h->lazyhold[first_class][--h->lazyreserved[first_class]];
+	}
+#endif
+	got += lut_take_slots(h, first_class, count - got, out + got);
+#ifndef __LUT_CLASS_LOCKS__
+	if(got < count && lazy_flush(h)) {
+		got += lut_take_slots(h, first_class, count - got, out + got);
+	}
+#endif
+#ifdef __LUT_HYBRID__
+	if(got < count) {
+		BACKING_LOCK();
+		got += BACKING_MALLOC_BATCH(count - got, bytes, out + got);
+		BACKING_UNLOCK();
+	}
+#endif
+	return got;
+}
 
-	// conduct linear search ^^ 
-	for(int i = logidx; i < 10; ++ i) {
-		uint32_t FREE_ADDRESS 	= N_FREE_ADDRESS___LT[i];
-		if(FREE_ADDRESS != 0xFFFFFFFF) {
-			uint32_t z_vec 		= ~FREE_ADDRESS & ~(~FREE_ADDRESS-1);
-			uint32_t addr_idx 	= ilog2(z_vec);
-			N_FREE_ADDRESS___LT[i] |= z_vec;
-			uint32_t * addr 	= N_FAST_ADDRESS___LT[i][addr_idx]; 
-			return (void *)addr;
+void * lut_heap_malloc(lut_heap_t * h, unsigned bytes)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	void * vp = lut_serve(h, bytes);
+
+#if defined(__ALLOC_STATS__) && defined(__LUT_HYBRID__)
+	if(vp && (uintptr_t)vp - (uintptr_t)h->arena >= LUT_ARENA_BYTES) {
+		return vp;
+	}
+#endif
+	STAT_MALLOC(&h->stats, bytes, vp, SLOT_BYTES((uintptr_t)vp - (uintptr_t)h->arena));
+	return vp;
+}
+
+// Aligned requests skip the lazy-free cache (it is kept by class, not by address) and
+// search the classes that can hold them for an aligned free slot, flushing the cache and
+// retrying on failure. Hybrid builds then try the backing allocator's memalign.
+void * lut_heap_memalign(lut_heap_t * h, unsigned alignment, unsigned bytes)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	void * vp = NULL;
+	uint32_t request 			= (bytes == 0) ? 1 : bytes;
+	uint32_t log2bytes 			= ilog2(request);
+	uint32_t logidx 			= (request > (1u << log2bytes)) ? log2bytes+1 : log2bytes;
+
+	if(alignment != 0 && (alignment & (alignment - 1)) == 0) {
+		vp = lut_take_aligned_slot(h, N_FIRST_CLASS__LT[logidx], alignment);
+#ifndef __LUT_CLASS_LOCKS__
+		if(!vp && lazy_flush(h)) {
+			vp = lut_take_aligned_slot(h, N_FIRST_CLASS__LT[logidx], alignment);
 		}
+#endif
+#ifdef __LUT_HYBRID__
+		if(!vp) {
+			BACKING_LOCK();
+			vp = BACKING_MEMALIGN(alignment, bytes);
+			BACKING_UNLOCK();
+		}
+#endif
 	}
-	return NULL;
-	
+#if defined(__ALLOC_STATS__) && defined(__LUT_HYBRID__)
+	if(vp && (uintptr_t)vp - (uintptr_t)h->arena >= LUT_ARENA_BYTES) {
+		return vp;
+	}
+#endif
+	STAT_MALLOC(&h->stats, bytes, vp, SLOT_BYTES((uintptr_t)vp - (uintptr_t)h->arena));
+	return vp;
 }
 
+// Clears the slot's occupancy bit, or hands a backing block back (the statistics are left
+// to the callers).
+static void lut_release(lut_heap_t * h, void * p)
+{
+	uintptr_t offset = (uintptr_t)p - (uintptr_t)h->arena;
 
-#ifdef __DO_NOT_INLINE__ 
-    void __attribute__ ((noinline)) lut_free(void * p)
-#else   
-    void lut_free(void * p)
+	if(p == NULL) {
+		return;
+	}
+
+	if(offset >= LUT_ARENA_BYTES) {
+#ifdef __LUT_HYBRID__
+		BACKING_LOCK();
+		BACKING_FREE(p);
+		BACKING_UNLOCK();
 #endif
+		return;
+	}
+
+	uint32_t idx = N_CLASS_RADIX__LT[offset >> LUT_RADIX_SHIFT];
+	uint32_t slot = (offset - N_CLASS_BASE___LT[idx]) >> N_SHIFT_LEFTS__LT[idx];
+	CLASS_LOCK(idx);
+	COST_META_LOAD(&h->cost, 1);
+	COST_META_STORE(&h->cost, 1);
+	h->N_FREE_ADDRESS___LT[N_WORD_BASE____LT[idx] + (slot >> 5)] &= ~(1u << (slot & 0x1F));
+	CLASS_UNLOCK(idx);
+}
+
+void lut_heap_free(lut_heap_t * h, void * p)
 {
-	uint32_t idx;
-	uint32_t addr = (uint32_t)p;
-
-	for(int i = 0; i < 11; ++i) {
-		uint32_t waddr = (uint32_t)N_FAST_ADDRESS___LT[i][0];
-		if( addr >= waddr && addr <= waddr+(8<<N_SHIFT_LEFTS__LT[i])) {
-			idx = i;
-			addr -= waddr;
-			N_FREE_ADDRESS___LT[idx] &= ~(1 << ( (addr >> N_SHIFT_LEFTS__LT[idx])));
-			return;
+	COST_CALL(&h->cost, COST_FREE);
+#ifdef __ALLOC_STATS__
+	uintptr_t offset = (uintptr_t)p - (uintptr_t)h->arena;
+
+	if(p && offset < LUT_ARENA_BYTES) {
+		STAT_FREE(&h->stats, p, SLOT_BYTES(offset));
+	}
+#endif
+	lut_release(h, p);
+}
+
+
+// count blocks of bytes each, as count calls of lut_heap_malloc would hand them out but for
+// one search and one write per occupancy word (see lut_take_slots). Returns how many were
+// allocated; out[] past them is NULL.
+unsigned lut_heap_malloc_batch(lut_heap_t * h, unsigned count, unsigned bytes, void ** out)
+{
+	COST_CALL(&h->cost, COST_MALLOC);
+	uint32_t got = lut_serve_batch(h, bytes, count, out), i;
+
+	for(i = got; i < count; ++i) {
+		out[i] = NULL;
+	}
+#ifdef __ALLOC_STATS__
+	for(i = 0; i < count; ++i) {
+#ifdef __LUT_HYBRID__
+		if(out[i] && (uintptr_t)out[i] - (uintptr_t)h->arena >= LUT_ARENA_BYTES) {
+			continue;
 		}
+#endif
+		STAT_MALLOC(&h->stats, bytes, out[i], SLOT_BYTES((uintptr_t)out[i] - (uintptr_t)h->arena));
 	}
+#endif
+	return got;
 }
 
+// Clears the freed bits of occupancy word w, which belongs to class idx.
+static void clear_slots(lut_heap_t * h, uint32_t idx, uint32_t w, uint32_t freed)
+{
+	CLASS_LOCK(idx);
+	COST_META_LOAD(&h->cost, 1);
+	COST_META_STORE(&h->cost, 1);
+	h->N_FREE_ADDRESS___LT[w] &= ~freed;
+	CLASS_UNLOCK(idx);
+}
 
-void * lut_realloc(void * vp, unsigned newbytes) {
+// Frees every non-NULL block of ptrs[]. The occupancy bits of consecutive entries that
+// share a word are cleared with one write to it; blocks of the backing allocator go back
+// to it one by one.
+void lut_heap_free_batch(lut_heap_t * h, void ** ptrs, unsigned count)
+{
+	COST_CALL(&h->cost, COST_FREE);
+	uint32_t idx = 0, word = 0, freed = 0;
+
+	for(uint32_t i = 0; i < count; ++i) {
+		uintptr_t offset = (uintptr_t)ptrs[i] - (uintptr_t)h->arena;
+
+		if(ptrs[i] == NULL) {
+			continue;
+		}
+		if(offset >= LUT_ARENA_BYTES) {
+			lut_release(h, ptrs[i]);
+			continue;
+		}
+		STAT_FREE(&h->stats, ptrs[i], SLOT_BYTES(offset));
+
+		uint32_t slot_class = N_CLASS_RADIX__LT[offset >> LUT_RADIX_SHIFT];
+		uint32_t slot = (offset - N_CLASS_BASE___LT[slot_class]) >> N_SHIFT_LEFTS__LT[slot_class];
+		uint32_t w = N_WORD_BASE____LT[slot_class] + (slot >> 5);
+
+		if(freed && w != word) {
+			clear_slots(h, idx, word, freed);
+			freed = 0;
+		}
+		idx = slot_class;
+		word = w;
+		freed |= 1u << (slot & 0x1F);
+	}
+	if(freed) {
+		clear_slots(h, idx, word, freed);
+	}
+}
+
+void * lut_heap_realloc(lut_heap_t * h, void * vp, unsigned newbytes) {
+	COST_CALL(&h->cost, COST_REALLOC);
 	void *newp = NULL;
 	uint32_t *cnewp, *cvp;
 
-	int idx = 0;
 	/* behavior on corner cases conforms to SUSv2 */
 	if (vp == NULL)
-		return lut_malloc(newbytes);
+		return lut_heap_malloc(h, newbytes);
+
+	uintptr_t offset = (uintptr_t)vp - (uintptr_t)h->arena;
+
+#ifdef __LUT_HYBRID__
+	// The backing allocator knows the size of its own blocks.
+	if (offset >= LUT_ARENA_BYTES) {
+		BACKING_LOCK();
+		newp = BACKING_REALLOC(vp, newbytes);
+		BACKING_UNLOCK();
+		return newp;
+	}
+#endif
 
 	if (newbytes != 0) {
-		if ( (newp = lut_malloc(newbytes)) == NULL)
+		if ( (newp = lut_heap_malloc(h, newbytes)) == NULL)
 			return NULL;
 		
-		uint32_t addr = (uint32_t)vp;
-		//printf("  [DEBUG] --> %08x\n", addr);
-		uint32_t idx =0;
-		for(int i = 0; i < 11; ++i) {
-			uint32_t waddr = (uint32_t)N_FAST_ADDRESS___LT[i][0];
-			if( addr >= waddr && addr <= waddr+(8<<N_SHIFT_LEFTS__LT[i])) {
-				idx = i;
-				addr -= waddr;
-				break;
-			}
-		}		
+		uint32_t idx = N_CLASS_RADIX__LT[offset >> LUT_RADIX_SHIFT];
 
 		uint32_t bound = (1 << N_SHIFT_LEFTS__LT[idx] < newbytes) ? (1 << N_SHIFT_LEFTS__LT[idx])  : newbytes;
-		bound >>= 2;
-
-		//printf("  [DEBUG] bound is %08x\n", bound);
+		bound = (bound + 3) >> 2;
 
 		cnewp   = (uint32_t *)newp;
 		cvp     = (uint32_t *)vp;
+		COST_ARENA_LOAD(&h->cost, bound);
+		COST_ARENA_STORE(&h->cost, bound);
 
 		for(int i = 0; i < bound; ++i) {
 			cnewp[i]=cvp[i];
 		}
-
-		//printf("  [DEBUG] finished copying.\n"); 
 	}
 
-	lut_free(vp);
+	lut_heap_free(h, vp);
 	return newp;
 }
 
 
-void * lut_calloc(unsigned nelem, unsigned elsize) {
+void * lut_heap_calloc(lut_heap_t * h, unsigned nelem, unsigned elsize) {
+  COST_CALL(&h->cost, COST_CALLOC);
   void *vp;
   unsigned nbytes;
   uint32_t * cvp;
   unsigned int i = 0;
 
-  nbytes = (nelem * elsize)>>2;
-  if ( (vp = lut_malloc(nbytes)) == NULL)
+  nbytes = nelem * elsize;
+  if ( (vp = lut_heap_malloc(h, nbytes)) == NULL)
     return NULL;
 
   cvp = (uint32_t *)vp;
-  for(i=0; i< nbytes; ++i) {
+  COST_ARENA_STORE(&h->cost, (nbytes + 3) >> 2);
+  for(i=0; i< ((nbytes+3)>>2); ++i) {
     cvp[i]='\0';
   }
   return vp;
 }
 
 
+void lut_heap_lazyfree(lut_heap_t * h, void * vp) {
+  COST_CALL(&h->cost, COST_FREE);
+#ifndef __LUT_CLASS_LOCKS__
+  uintptr_t offset = (uintptr_t)vp - (uintptr_t)h->arena;
+
+  // Blocks of the backing allocator (and NULL) go straight to lut_heap_free.
+  if(offset < LUT_ARENA_BYTES) {
+    uint32_t lclass = N_CLASS_RADIX__LT[offset >> LUT_RADIX_SHIFT];
+    if(lclass < LAZY_CLASSES && h->lazyreserved[lclass] < LAZY_DEPTH) {
+      STAT_FREE(&h->stats, vp, SLOT_BYTES(offset));
+      COST_META_STORE(&h->cost, 1);
+      h->lazyhold[lclass][h->lazyreserved[lclass]++] = vp;
+      return;
+    }
+  }
+#endif
+  lut_heap_free(h, vp);
+}
+
+#ifdef __ALLOC_STATS__
+// Every clear occupancy bit is a free slot; the largest free block is the biggest slot
+// size with one left.
+void lut_heap_get_stats(lut_heap_t * h, mem_stats_t * s) {
+	uint64_t free_bytes = 0, largest = 0;
+
+	for(int i = 0; i < LUT_CLASSES; ++i) {
+		for(int w = N_WORD_BASE____LT[i]; w < N_WORD_BASE____LT[i+1]; ++w) {
+			uint32_t found = __builtin_popcount(~h->N_FREE_ADDRESS___LT[w]);
+
+			free_bytes += (uint64_t)found << N_SHIFT_LEFTS__LT[i];
+			if(found && (1ull << N_SHIFT_LEFTS__LT[i]) > largest) {
+				largest = 1ull << N_SHIFT_LEFTS__LT[i];
+			}
+		}
+	}
+	*s = h->stats;
+	STAT_FINISH(s, free_bytes, largest);
+}
+#endif
+
+#ifdef __ACCESS_COUNT__
+void lut_heap_get_cost(lut_heap_t * h, mem_cost_t * c) {
+	*c = h->cost;
+}
+#endif
+
+#ifdef __HEAP_MAP__
+// Every clear occupancy bit is one free slot; slots never merge, so neither do the blocks.
+// With __LUT_HYBRID__ the backing allocator's heap is not part of the map.
+void lut_heap_map(lut_heap_t * h, mem_map_t * m) {
+	map_start(m, LUT_ARENA_BYTES);
+	for(int i = 0; i < LUT_CLASSES; ++i) {
+		for(uint32_t slot = 0; slot < N_SLOTS______LT[i]; ++slot) {
+			if(!((h->N_FREE_ADDRESS___LT[N_WORD_BASE____LT[i] + (slot >> 5)] >> (slot & 0x1F)) & 0x1)) {
+				map_free_block(m, N_CLASS_BASE___LT[i] + (slot << N_SHIFT_LEFTS__LT[i]), 1u << N_SHIFT_LEFTS__LT[i]);
+			}
+		}
+	}
+	map_finish(m);
+}
+#endif
+
+// Lays a heap out over [base, base+bytes): the heap state first, then an arena of
+// LUT_ARENA_BYTES (aligned to ARENA_ALIGN) with the class layout of lutclasses.h. With
+// __LUT_HYBRID__ the rest of the region becomes the heap's backing heap. Returns NULL when
+// the region is smaller than that (or leaves the backing heap no room).
+lut_heap_t * lut_heap_init(void * base, size_t bytes) {
+	uintptr_t start = ((uintptr_t)base + 7) & ~(uintptr_t)7;
+	uintptr_t first = (start + sizeof(lut_heap_t) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+	lut_heap_t * h = (lut_heap_t *)start;
+
+	if(!base || (uintptr_t)base + bytes < first + LUT_ARENA_BYTES) {
+		return NULL;
+	}
+	memset(h, 0, sizeof(lut_heap_t));
+	memcpy(h->N_FREE_ADDRESS___LT, N_FREE_INIT____LT, sizeof(N_FREE_INIT____LT));
+	h->arena = (char *)first;
+#ifdef __LUT_HYBRID__
+	h->backing = BACKING_INIT(h->arena + LUT_ARENA_BYTES, (uintptr_t)base + bytes - (first + LUT_ARENA_BYTES));
+	if(!h->backing) {
+		return NULL;
+	}
+#endif
+	return h;
+}
+
+
+//==------------------------------------------==//
+// [Default heap: the static arena of LUT_ARENA_BYTES]
+
 #ifdef __DO_NOT_INLINE__ 
-    void __attribute__ ((noinline)) lut_lazyfree(void * vp)
+    void *  __attribute__ ((noinline)) lut_malloc(unsigned bytes)
 #else   
-    void lut_lazyfree(void * vp)
+    void * lut_malloc(unsigned bytes)
 #endif
 {
+	return lut_heap_malloc(&default_heap, bytes);
+}
 
-  if(lazyreserved < 32) {
-    lazyhold[lazyreserved++] = (uint32_t)vp;
-  } else {
-    lazyreserved = 0;
-    lut_free(vp);
-    for(int i = 0; i < 32; ++i) {
-      lut_free((void*)lazyhold[i]);
-    }
-  }
+#ifdef __DO_NOT_INLINE__ 
+    void __attribute__ ((noinline)) lut_free(void * p)
+#else   
+    void lut_free(void * p)
+#endif
+{
+	lut_heap_free(&default_heap, p);
+}
+
+void * lut_realloc(void * vp, unsigned newbytes) {
+	return lut_heap_realloc(&default_heap, vp, newbytes);
+}
+
+void * lut_calloc(unsigned nelem, unsigned elsize) {
+	return lut_heap_calloc(&default_heap, nelem, elsize);
+}
+
+unsigned lut_malloc_batch(unsigned count, unsigned bytes, void ** out) {
+	return lut_heap_malloc_batch(&default_heap, count, bytes, out);
+}
+
+void lut_free_batch(void ** ptrs, unsigned count) {
+	lut_heap_free_batch(&default_heap, ptrs, count);
+}
+
+void * lut_memalign(unsigned alignment, unsigned bytes) {
+	return lut_heap_memalign(&default_heap, alignment, bytes);
+}
+
+void * lut_aligned_alloc(unsigned alignment, unsigned bytes) {
+	return lut_heap_memalign(&default_heap, alignment, bytes);
+}
+
+#ifdef __ALLOC_STATS__
+void lut_get_stats(mem_stats_t * s) {
+	lut_heap_get_stats(&default_heap, s);
+}
+#endif
+
+#ifdef __HEAP_MAP__
+void lut_map(mem_map_t * m) {
+	lut_heap_map(&default_heap, m);
+}
+#endif
 
+#ifdef __ACCESS_COUNT__
+void lut_get_cost(mem_cost_t * c) {
+	lut_heap_get_cost(&default_heap, c);
+}
+#endif
 
-}
\ No newline at end of file
+#ifdef __DO_NOT_INLINE__ 
+    void __attribute__ ((noinline)) lut_lazyfree(void * vp)
+#else   
+    void lut_lazyfree(void * vp)
+#endif
+{
+	lut_heap_lazyfree(&default_heap, vp);
+}
+
+#ifdef __LUT_CLASS_LOCKS__
+// Marks this build as safe to call from several threads at once; MemCast looks for it and
+// then leaves out the alloc_lock/alloc_unlock wrapping.
+int lut_threadsafe(void) {
+	return 1;
+}
+#endif
\ No newline at end of file
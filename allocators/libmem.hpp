@@ -0,0 +1,140 @@
+//===-- libmem.hpp --------------------------------------------*- C++ -*------===//
+// Header-only C++ heaps: the bitmap and buddy allocators as class templates, so
+// that several differently sized heaps can live in one design without a macro
+// recompile (or a module clone) per heap.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+//   static libmem::BitHeap<65536>      small_heap;
+//   static libmem::BuddyHeap<1 << 20>  big_heap;
+//
+//   int * v = (int *)small_heap.malloc(40 * sizeof(int));
+//   small_heap.free(v);
+//
+// Each instance owns a region sized at compile time for an arena of at least ArenaBytes,
+// and lays libbitmem.c or libbudmem.c over it with xx_heap_init; every call forwards to
+// the matching xx_heap_* function, so link the library (built as C) in as well.
+//
+// The block size is the one thing an instance cannot choose: the C heaps take it from
+// MIN_REQ_SIZE when they are compiled. MinReq only names it, and must agree with the
+// MIN_REQ_SIZE this header and the libraries are built with.
+//
+#ifndef __LIBMEM_HPP__
+#define __LIBMEM_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+extern "C" {
+#include "memutils.h"
+}
+
+namespace libmem {
+
+	constexpr uint32_t log2_of(uint64_t v) {
+		return (v <= 1) ? 0 : 1 + log2_of(v >> 1);
+	}
+
+	constexpr bool is_power_of_two(uint64_t v) {
+		return v != 0 && (v & (v - 1)) == 0;
+	}
+
+	//==------------------------------------------==//
+	// [Bitmap Based Allocation]
+	template <uint32_t ArenaBytes, uint32_t MinReq = MIN_REQ_SIZE>
+	class BitHeap {
+		static_assert(MinReq == MIN_REQ_SIZE, "libbitmem.c fixes the block size at MIN_REQ_SIZE; build with -DMIN_REQ_SIZE=MinReq");
+		static_assert(ArenaBytes / MinReq >= 32, "ArenaBytes/MinReq must be at least 32");
+
+	public:
+		static constexpr uint64_t WORDS 		= ((uint64_t)ArenaBytes / MinReq + 31) / 32;
+		// What bit_heap_init counts per bitmap word (32 blocks, two map words, a maxrun byte
+		// and a byte towards the fullmap), the rounding of fullmap and the region locks, and
+		// the arena alignment, on top of the heap state.
+		static constexpr uint64_t REGION_BYTES 	= HEAP_STATE_BYTES + WORDS * (32 * MinReq + 2 * sizeof(uint32_t) + 1 + 1)
+												+ (WORDS + 31) / 32 * sizeof(uint32_t) + (WORDS + BIT_REGION_WORDS - 1) / BIT_REGION_WORDS
+												+ ARENA_ALIGN;
+
+		BitHeap() : heap(bit_heap_init(region, sizeof(region))) {}
+		BitHeap(const BitHeap &) = delete;
+		BitHeap & operator=(const BitHeap &) = delete;
+
+		bool owns(const void * p) const {
+			return (uintptr_t)p - (uintptr_t)region < sizeof(region);
+		}
+
+		void * malloc(unsigned size) 										{ return bit_heap_malloc(heap, size); }
+		void * realloc(void * p, unsigned newbytes) 						{ return bit_heap_realloc(heap, p, newbytes); }
+		void * calloc(unsigned nelem, unsigned elsize) 						{ return bit_heap_calloc(heap, nelem, elsize); }
+		void * memalign(unsigned alignment, unsigned size) 					{ return bit_heap_memalign(heap, alignment, size); }
+		unsigned malloc_batch(unsigned count, unsigned size, void ** out) 	{ return bit_heap_malloc_batch(heap, count, size, out); }
+		void free_batch(void ** ptrs, unsigned count) 						{ bit_heap_free_batch(heap, ptrs, count); }
+		void free(void * p) 												{ bit_heap_free(heap, p); }
+		void lazyfree(void * p) 											{ bit_heap_lazyfree(heap, p); }
+#ifdef __ALLOC_STATS__
+		void get_stats(mem_stats_t * s) 									{ bit_heap_get_stats(heap, s); }
+#endif
+#ifdef __HEAP_MAP__
+		void map(mem_map_t * m) 											{ bit_heap_map(heap, m); }
+#endif
+#ifdef __ACCESS_COUNT__
+		void get_cost(mem_cost_t * c) 										{ bit_heap_get_cost(heap, c); }
+#endif
+
+	private:
+		alignas(ARENA_ALIGN) uint8_t region[REGION_BYTES];
+		bit_heap_t * heap;
+	};
+
+	//==------------------------------------------==//
+	// [Buddy Based Allocation]
+	template <uint32_t ArenaBytes, uint32_t MinReq = MIN_REQ_SIZE>
+	class BuddyHeap {
+		static_assert(MinReq == MIN_REQ_SIZE, "libbudmem.c fixes the block size at MIN_REQ_SIZE; build with -DMIN_REQ_SIZE=MinReq");
+		static_assert(is_power_of_two(ArenaBytes), "ArenaBytes must be a power of two");
+		static_assert(ArenaBytes / MinReq >= 32, "ArenaBytes/MinReq must be at least 32");
+		static_assert(ArenaBytes <= (1u << 30), "bud_heap_init stops at 1 GB arenas");
+
+	public:
+		static constexpr uint64_t LEAVES 		= ArenaBytes / MinReq;
+		static constexpr uint64_t LEVELS 		= log2_of(LEAVES) + 1;
+		static constexpr uint64_t CODE_WORDS 	= LEAVES >> ((LEAVES <= 32768) ? 3 : 2); 		// 4- or 8-bit level codes
+		// The tree (a bit per block per level) and the level codes bud_heap_init lays out for
+		// LEAVES blocks, and the arena alignment, on top of the heap state.
+		static constexpr uint64_t REGION_BYTES 	= HEAP_STATE_BYTES + (LEVELS * (LEAVES >> 5) + CODE_WORDS) * sizeof(uint32_t)
+												+ ARENA_ALIGN + ArenaBytes;
+
+		BuddyHeap() : heap(bud_heap_init(region, sizeof(region))) {}
+		BuddyHeap(const BuddyHeap &) = delete;
+		BuddyHeap & operator=(const BuddyHeap &) = delete;
+
+		bool owns(const void * p) const {
+			return (uintptr_t)p - (uintptr_t)region < sizeof(region);
+		}
+
+		void * malloc(unsigned size) 										{ return bud_heap_malloc(heap, size); }
+		void * realloc(void * p, unsigned newbytes) 						{ return bud_heap_realloc(heap, p, newbytes); }
+		void * calloc(unsigned nelem, unsigned elsize) 						{ return bud_heap_calloc(heap, nelem, elsize); }
+		void * memalign(unsigned alignment, unsigned size) 					{ return bud_heap_memalign(heap, alignment, size); }
+		unsigned malloc_batch(unsigned count, unsigned size, void ** out) 	{ return bud_heap_malloc_batch(heap, count, size, out); }
+		void free_batch(void ** ptrs, unsigned count) 						{ bud_heap_free_batch(heap, ptrs, count); }
+		void free(void * p) 												{ bud_heap_free(heap, p); }
+		void lazyfree(void * p) 											{ bud_heap_lazyfree(heap, p); }
+#ifdef __ALLOC_STATS__
+		void get_stats(mem_stats_t * s) 									{ bud_heap_get_stats(heap, s); }
+#endif
+#ifdef __HEAP_MAP__
+		void map(mem_map_t * m) 											{ bud_heap_map(heap, m); }
+#endif
+#ifdef __ACCESS_COUNT__
+		void get_cost(mem_cost_t * c) 										{ bud_heap_get_cost(heap, c); }
+#endif
+
+	private:
+		alignas(ARENA_ALIGN) uint8_t region[REGION_BYTES];
+		bud_heap_t * heap;
+	};
+
+}
+
+#endif
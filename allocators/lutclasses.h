@@ -0,0 +1,67 @@
+//===-- lutclasses.h ------------------------------------------*- C -*--------===//
+// Size classes of the LUT allocator. Generated by tools/lutgen.c, do not edit.
+// 8 classes, 66048 bytes of arena (66048 requested).
+//===-------------------------------------------------------------------------===//
+#ifndef __LUTCLASSES_H__
+#define __LUTCLASSES_H__
+
+#define LUT_CLASSES 						8
+#define LUT_ARENA_BYTES 					66048
+#define LUT_RADIX_SHIFT 					8
+#define LUT_OCCUPANCY_WORDS 				11
+
+/* log2 of the slot size of each class */
+static const uint8_t  N_SHIFT_LEFTS__LT[LUT_CLASSES] = {
+	3, 4, 5, 6, 7, 8, 9, 10
+};
+
+/* Number of slots in each class */
+static const uint32_t N_SLOTS______LT[LUT_CLASSES] = {
+	128, 32, 32, 32, 32, 32, 32, 32
+};
+
+/* Byte offset of each class region within LUT_ARENA */
+static const uint32_t N_CLASS_BASE___LT[LUT_CLASSES] = {
+	0, 1024, 1536, 2560, 4608, 8704, 16896, 33280
+};
+
+/* First occupancy word of each class (and one past the last class) */
+static const uint32_t N_WORD_BASE____LT[LUT_CLASSES + 1] = {
+	0, 4, 5, 6, 7, 8, 9, 10, 11
+};
+
+/* Smallest class whose slots hold 2^i bytes, LUT_CLASSES when there is none */
+static const uint8_t  N_FIRST_CLASS__LT[33] = {
+	0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8
+};
+
+/* Class owning each 2^LUT_RADIX_SHIFT byte granule of LUT_ARENA */
+static const uint8_t  N_CLASS_RADIX__LT[LUT_ARENA_BYTES >> LUT_RADIX_SHIFT] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3,
+	3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+	4, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+	5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+	5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+	6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7
+};
+
+/* Initial occupancy: padding bits past the last slot of a class are set */
+#define LUT_OCCUPANCY_INIT { \
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, \
+	0x00000000, 0x00000000, 0x00000000 \
+}
+
+#endif
@@ -8,56 +8,513 @@
 #define __MEMUTILS_H__
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
 // Defines
 #define __DO_NOT_INLINE__ 				/* Can enforce each allocator to be separate functions */
 // #define __DEBUG__
+// #define __GNU_BINNED__ 				/* gnu: keep free chunks in per-size-class bins instead of walking every chunk */
+// #define __GNU_BEST_FIT__ 			/* gnu: index large free chunks in a size-ordered tree and serve them best-fit */
+// #define __GNU_COMPACT_HEADER__ 		/* gnu: 8-byte chunk header (32-bit arena offsets, freebit in the low bit) */
+// #define __BIT_NEXT_FIT__ 			/* bit: resume the bitmap search where the last allocation ended (next fit) */
+// #define __BIT_CONCURRENT__ 			/* bit: lock-free bitmap claims with compare-and-swap, for multithreaded hosts (not for HLS) */
+// #define __BIT_REGION_LOCKS__ 		/* bit: one lock per BIT_REGION_WORDS bitmap words instead of one per heap (multithreaded hosts) */
+// #define __BUDDY_FREELIST__ 			/* bud: per-order free lists with a buddy bitmap instead of searching the tree bitmaps */
+// #define __BUDDY_LEVEL_LOCKS__ 		/* bud: one lock per free-list level instead of one per heap (multithreaded hosts, implies __BUDDY_FREELIST__) */
+// #define __LUT_HYBRID__ 				/* lut: send requests the LUT classes cannot serve to LUT_BACKING_SCHEME */
+// #define __LUT_CLASS_LOCKS__ 			/* lut: one lock per size class instead of one per heap (multithreaded hosts) */
+// #define __ALLOC_STATS__ 				/* all: count requests, live bytes, failures and search steps per heap, read with xx_get_stats() */
+// #define __ACCESS_COUNT__ 			/* all: count the metadata and arena words every call loads and stores, read with xx_get_cost() (hosts) */
+// #define __HEAP_MAP__ 				/* all: xx_heap_map() walks the heap metadata into an occupancy map and a free-block histogram (hosts) */
 
-/* This makes each allocator's arena use 65536 bytes or 64 kB (Needs to be power of two) */
+#if defined(__BUDDY_LEVEL_LOCKS__) && !defined(__BUDDY_FREELIST__)
+#define __BUDDY_FREELIST__
+#endif
+
+/* This makes each allocator's arena use 65536 bytes or 64 kB (Needs to be power of two); can be set with -DARENA_BYTES=... */
+#ifndef ARENA_BYTES
 #define ARENA_BYTES		65536
+#endif
 /* Defines the minimum requestable size (only applies to buddy, bit and lut) (Needs to be power of two, and cannot be larger )*/
+#ifndef MIN_REQ_SIZE
 #define MIN_REQ_SIZE 	16
+#endif
 #define BUDDY_SAFETY_CHECK 		ARENA_BYTES/MIN_REQ_SIZE
 #if BUDDY_SAFETY_CHECK < 32
 #error "ARENA_BYTES/MIN_REQ_SIZE must be at most 32."
 #endif
+/* Every arena but lin's (the default ones and those xx_heap_init lays out) starts on this boundary (a power of two, at
+   least MIN_REQ_SIZE), and blocks sit at multiples of their size (bit, bud, lut) or of the chunk header (gnu) from there,
+   so xx_memalign finds aligned blocks among the ones the allocator hands out anyway instead of padding them. bud and lut
+   serve alignments up to ARENA_ALIGN; can be set with -DARENA_ALIGN=... */
+#ifndef ARENA_ALIGN
+#define ARENA_ALIGN 		((MIN_REQ_SIZE > 64) ? MIN_REQ_SIZE : 64)
+#endif
+#if (ARENA_ALIGN & (ARENA_ALIGN - 1)) != 0 || ARENA_ALIGN < MIN_REQ_SIZE
+#error "ARENA_ALIGN must be a power of two, and at least MIN_REQ_SIZE."
+#endif
+/* With __GNU_BEST_FIT__, free gnu chunks of at least this many bytes (header included) go into the best-fit tree */
+#define GNU_TREE_THRESHOLD 	512
+/* xx_lazyfree keeps up to LAZY_DEPTH freed blocks for each of the LAZY_CLASSES smallest block sizes, for xx_malloc to reuse */
+#define LAZY_CLASSES 		16
+#define LAZY_DEPTH 			8
+/* With __LUT_HYBRID__, the allocator (gnu, bit or bud) behind the LUT classes; its library must be linked in as well.
+   Each LUT heap has a backing heap of its own, laid over the rest of its region */
+#ifndef LUT_BACKING_SCHEME
+#define LUT_BACKING_SCHEME 	gnu
+#endif
+/* With __BIT_REGION_LOCKS__, the number of bitmap words (32 blocks each) one region lock covers; a multiple of 32 */
+#define BIT_REGION_WORDS 	32
+#if (BIT_REGION_WORDS & 31) != 0
+#error "BIT_REGION_WORDS must be a multiple of 32."
+#endif
+/* The most bytes a bit or bud heap's own state (bit_heap_t, bud_heap_t) takes at the front of an xx_heap_init region,
+   ahead of its maps and arena; libmem.hpp sizes its regions with it, and both libraries check it at compile time */
+#define HEAP_STATE_BYTES 	4096
+/* The lock of __BIT_REGION_LOCKS__, __BUDDY_LEVEL_LOCKS__ and __LUT_CLASS_LOCKS__: a test-and-set flag (zero when free) that yields while taken */
+#if defined(__BIT_REGION_LOCKS__) || defined(__BUDDY_LEVEL_LOCKS__) || defined(__LUT_CLASS_LOCKS__)
+#include <sched.h>
+typedef uint8_t fine_lock_t;
+#define FINE_LOCK(L) 		while(__atomic_test_and_set((L), __ATOMIC_ACQUIRE)) { sched_yield(); }
+#define FINE_UNLOCK(L) 		__atomic_clear((L), __ATOMIC_RELEASE)
+#endif
+/* With __ALLOC_STATS__, what xx_get_stats()/xx_heap_get_stats() report. The counters are updated on every
+   call (plainly, so they are approximate under the multithreaded flags); the free-space figures are computed
+   from the heap metadata when the stats are read. Blocks held by a lazy-free cache count as freed. */
+#ifdef __ALLOC_STATS__
+typedef struct {
+	uint64_t 	allocs; 			/* successful malloc/calloc/realloc allocations (a moving realloc also counts a free) */
+	uint64_t 	frees;
+	uint64_t 	failures; 			/* allocation requests that returned NULL */
+	uint64_t 	search_steps; 		/* chunks, bins, bitmap words, tree words or slot words examined to find space */
+	uint64_t 	requested_bytes; 	/* sum of the sizes asked for by successful allocations */
+	uint64_t 	granted_bytes; 		/* sum of the block sizes they received (rounding, headers and padding included) */
+	uint32_t 	live_blocks;
+	uint32_t 	live_bytes; 		/* block bytes currently allocated */
+	uint32_t 	peak_bytes; 		/* high-water mark of live_bytes */
+	uint32_t 	free_bytes; 		/* bytes the heap could still hand out */
+	uint32_t 	largest_free; 		/* largest block the heap could hand out right now */
+	uint16_t 	internal_frag; 		/* per-mille of granted_bytes not requested */
+	uint16_t 	external_frag; 		/* per-mille of free_bytes outside the largest free block */
+} mem_stats_t;
+
+#define STAT_STEP(S) 						(++(S)->search_steps)
+#define STAT_MALLOC(S, req, vp, granted) 	do { 												\
+												if(vp) { 										\
+													uint32_t _g = (uint32_t)(granted); 			\
+													++(S)->allocs; 								\
+													++(S)->live_blocks; 						\
+													(S)->requested_bytes += (req); 				\
+													(S)->granted_bytes += _g; 					\
+													(S)->live_bytes += _g; 						\
+													if((S)->live_bytes > (S)->peak_bytes) { 	\
+														(S)->peak_bytes = (S)->live_bytes; 		\
+													} 											\
+												} else { 										\
+													++(S)->failures; 							\
+												} 												\
+											} while(0)
+#define STAT_FREE(S, vp, granted) 			do { 												\
+												if(vp) { 										\
+													++(S)->frees; 								\
+													--(S)->live_blocks; 						\
+													(S)->live_bytes -= (uint32_t)(granted); 	\
+												} 												\
+											} while(0)
+/* Fills in the free-space and fragmentation fields of a copy of the counters */
+#define STAT_FINISH(S, free, largest) 		do { 												\
+												(S)->free_bytes = (uint32_t)(free); 			\
+												(S)->largest_free = (uint32_t)(largest); 		\
+												(S)->internal_frag = (S)->granted_bytes ? (uint16_t)(1000 - ((S)->requested_bytes * 1000) / (S)->granted_bytes) : 0; \
+												(S)->external_frag = (S)->free_bytes ? (uint16_t)(1000 - ((uint64_t)(S)->largest_free * 1000) / (S)->free_bytes) : 0; \
+											} while(0)
+#else
+#define STAT_STEP(S)
+#define STAT_MALLOC(S, req, vp, granted)
+#define STAT_FREE(S, vp, granted)
+#endif
+/* With __HEAP_MAP__, what xx_map()/xx_heap_map() report: the free blocks the heap's own metadata holds right now (free
+   gnu chunks, runs of clear bitmap bits, free buddy nodes, free LUT slots, the space above lin's bump pointer), so a
+   NULL from malloc can be told apart from running out of bytes. Blocks held by a lazy-free cache count as used. The
+   arena is cut into MAP_CELLS equal cells for the occupancy map; free blocks are counted in power-of-two buckets.
+   Read it while no other thread is allocating. */
+#ifdef __HEAP_MAP__
+#define MAP_CELLS 			64
+#define MAP_BUCKETS 		32
+typedef struct {
+	uint32_t 	arena_bytes; 				/* bytes the map covers (the heap state is not included) */
+	uint32_t 	cell_bytes; 				/* arena bytes per cell */
+	uint32_t 	free_bytes;
+	uint32_t 	free_blocks;
+	uint32_t 	largest_free; 				/* largest block the heap could hand out right now */
+	uint16_t 	frag_index; 				/* per-mille of free_bytes outside the largest free block */
+	uint32_t 	histogram[MAP_BUCKETS]; 	/* free blocks of 2^i to 2^(i+1)-1 bytes */
+	uint32_t 	cell_free[MAP_CELLS]; 		/* free bytes in each cell */
+} mem_map_t;
+
+static inline void map_start(mem_map_t * m, uint32_t arena_bytes) {
+	memset(m, 0, sizeof(mem_map_t));
+	m->arena_bytes = arena_bytes;
+	m->cell_bytes = (arena_bytes + MAP_CELLS - 1) / MAP_CELLS;
+}
+
+/* Adds the free block of bytes at offset in the arena */
+static inline void map_free_block(mem_map_t * m, uint32_t offset, uint32_t bytes) {
+	uint32_t end = offset + bytes, c, lo, hi;
+
+	if(bytes == 0) {
+		return;
+	}
+	m->free_bytes += bytes;
+	++m->free_blocks;
+	++m->histogram[31 - __builtin_clz(bytes)];
+	if(bytes > m->largest_free) {
+		m->largest_free = bytes;
+	}
+	for(c = offset / m->cell_bytes; c < MAP_CELLS && c * m->cell_bytes < end; ++c) {
+		lo = (offset > c * m->cell_bytes) ? offset : c * m->cell_bytes;
+		hi = (end < (c + 1) * m->cell_bytes) ? end : (c + 1) * m->cell_bytes;
+		m->cell_free[c] += hi - lo;
+	}
+}
+
+static inline void map_finish(mem_map_t * m) {
+	m->frag_index = m->free_bytes ? (uint16_t)(1000 - ((uint64_t)m->largest_free * 1000) / m->free_bytes) : 0;
+}
+
+/* One line of totals, the occupancy map ('.' free, '#' full, 1-9 how full) and the non-empty histogram buckets */
+static inline void mem_map_print(const mem_map_t * m, FILE * f) {
+	uint32_t c, i, size, used;
+
+	fprintf(f, "%u-byte arena, %u bytes free in %u blocks, largest %u, fragmentation %u/1000\n",
+		m->arena_bytes, m->free_bytes, m->free_blocks, m->largest_free, m->frag_index);
+	fprintf(f, "|");
+	for(c = 0; c < MAP_CELLS && c * m->cell_bytes < m->arena_bytes; ++c) {
+		size = (m->arena_bytes - c * m->cell_bytes < m->cell_bytes) ? m->arena_bytes - c * m->cell_bytes : m->cell_bytes;
+		used = size - m->cell_free[c];
+		fputc(used == 0 ? '.' : used == size ? '#' : '1' + (used * 9 - 1) / size, f);
+	}
+	fprintf(f, "| %u bytes per cell\n", m->cell_bytes);
+	for(i = 0; i < MAP_BUCKETS; ++i) {
+		if(m->histogram[i]) {
+			fprintf(f, "  %10u - %-10u %8u\n", 1u << i, (i == 31) ? 0xFFFFFFFFu : (2u << i) - 1, m->histogram[i]);
+		}
+	}
+}
+#endif
+/* With __ACCESS_COUNT__, what xx_get_cost()/xx_heap_get_cost() report: how many words each call loaded and stored, the
+   figure that sets an allocator's latency on the FPGA. Metadata words are those of the allocator's arrays and of its
+   bookkeeping inside the arena (chunk headers and free-list links, bitmap, endmap and summary words, buddy tree words,
+   level codes and list links, LUT occupancy words, lazy-cache slots); scalars of the heap state count as registers
+   and constant lookup tables as logic.
+   Arena words are the payload words realloc copies and calloc clears. A call's counts include the calls it makes
+   (realloc's malloc and free, a flush of the lazy cache). The counters are plain, so read them from single-threaded
+   runs, and build without __ALLOC_STATS__, whose bookkeeping reads metadata too. */
+#ifdef __ACCESS_COUNT__
+#define COST_MALLOC 		0 				/* lazyfree counts as a free; a batch call counts once */
+#define COST_FREE 			1
+#define COST_REALLOC 		2
+#define COST_CALLOC 		3
+#define COST_OPS 			4
+#define COST_META_LD 		0 				/* indices of the four counts */
+#define COST_META_ST 		1
+#define COST_ARENA_LD 		2
+#define COST_ARENA_ST 		3
+#define COST_BUCKETS 		24
+typedef struct {
+	uint64_t 	calls[COST_OPS];
+	uint64_t 	words[COST_OPS][4]; 			/* the four counts, summed over the calls */
+	uint32_t 	max[COST_OPS]; 					/* most words one call touched */
+	uint32_t 	histogram[COST_OPS][COST_BUCKETS]; 	/* calls that touched 0, 1, 2-3, 4-7, ... words */
+	uint32_t 	last[4]; 						/* the counts of the latest call */
+	uint32_t 	cur[4]; 						/* the counts of the call in progress */
+	uint32_t 	depth; 							/* calls in progress, nested ones included */
+} mem_cost_t;
+
+typedef struct {
+	mem_cost_t * 	cost;
+	uint8_t 		op;
+} cost_scope_t;
+
+static inline cost_scope_t cost_begin(mem_cost_t * c, uint8_t op) {
+	cost_scope_t scope = { c, op };
+
+	if(c->depth++ == 0) {
+		memset(c->cur, 0, sizeof(c->cur));
+	}
+	return scope;
+}
+
+/* Files the counts of a call when the outermost one returns */
+static inline void cost_end(cost_scope_t * scope) {
+	mem_cost_t * c = scope->cost;
+	uint32_t i, total = 0, bucket;
+
+	if(--c->depth != 0) {
+		return;
+	}
+	++c->calls[scope->op];
+	for(i = 0; i < 4; ++i) {
+		c->words[scope->op][i] += c->cur[i];
+		c->last[i] = c->cur[i];
+		total += c->cur[i];
+	}
+	if(total > c->max[scope->op]) {
+		c->max[scope->op] = total;
+	}
+	bucket = total ? 32 - __builtin_clz(total) : 0;
+	++c->histogram[scope->op][(bucket < COST_BUCKETS) ? bucket : COST_BUCKETS - 1];
+}
+
+/* Opens a call of kind op on the counters C, closed when the function returns (the first line of every entry point) */
+#define COST_CALL(C, op) 			cost_scope_t _cost_scope __attribute__ ((cleanup(cost_end))) = cost_begin((C), (op))
+#define COST_META_LOAD(C, n) 		((C)->cur[COST_META_LD] += (n))
+#define COST_META_STORE(C, n) 		((C)->cur[COST_META_ST] += (n))
+#define COST_ARENA_LOAD(C, n) 		((C)->cur[COST_ARENA_LD] += (n))
+#define COST_ARENA_STORE(C, n) 		((C)->cur[COST_ARENA_ST] += (n))
+#else
+#define COST_CALL(C, op)
+#define COST_META_LOAD(C, n) 		((void)0)
+#define COST_META_STORE(C, n) 		((void)0)
+#define COST_ARENA_LOAD(C, n) 		((void)0)
+#define COST_ARENA_STORE(C, n) 		((void)0)
+#endif
+/* thread_cache.c: the allocator behind the per-thread caches, the size classes cached (blocks of MIN_REQ_SIZE << 0 .. TC_CLASSES-1,
+   header included), the most blocks and bytes a thread keeps per class (classes that do not fit twice in TC_MAG_BYTES are
+   not cached), and how many threads get a cache; TC_MAX_THREADS * TC_CLASSES * TC_MAG_BYTES must not exceed ARENA_BYTES */
+#ifndef TC_BACKING_SCHEME
+#define TC_BACKING_SCHEME 	gnu
+#endif
+#define TC_CLASSES 			7
+#define TC_MAG_DEPTH 		8
+#define TC_MAG_BYTES 		512
+#define TC_MAX_THREADS 		16
+/* trace_recorder.c: the allocator it records calls to, how many records it buffers between writes, and how many
+   live blocks it can tell apart (a power of two) */
+#ifndef TRACE_SCHEME
+#define TRACE_SCHEME 		gnu
+#endif
+#define TRACE_BUFFER 		4096
+#define TRACE_MAX_LIVE 		65536
+
+/* Allocation traces (trace_recorder.c writes them, tools/replay.c plays them back): a trace_header_t, then one
+   16-byte trace_rec_t per call, in host byte order. Objects are numbered from 1 in allocation order, and a
+   realloc keeps the number of the object it resizes. calloc records nelem * elsize as its size. */
+#define TRACE_MAGIC 		0x52544D4Cu 	/* "LMTR" */
+#define TRACE_VERSION 		1
+#define TRACE_MALLOC 		1
+#define TRACE_CALLOC 		2
+#define TRACE_REALLOC 		3
+#define TRACE_FREE 			4
+typedef struct {
+	uint32_t 	magic;
+	uint32_t 	version;
+} trace_header_t;
+
+typedef struct {
+	uint32_t 	time_us; 		/* microseconds since the first call */
+	uint32_t 	id; 			/* object number */
+	uint32_t 	size; 			/* bytes asked for (0 for free) */
+	uint8_t 	op; 			/* TRACE_MALLOC .. TRACE_FREE */
+	uint8_t 	failed; 		/* the recorded call returned NULL */
+	uint16_t 	reserved;
+} trace_rec_t;
+
+/* Each allocator also runs on caller-provided memory: xx_heap_init(base, bytes) lays a heap
+ * out over the region (its state included) and returns a handle for the xx_heap_* calls,
+ * or NULL when the region is too small. The plain xx_* calls use a static default heap. */
+typedef struct gnu_heap gnu_heap_t;
+typedef struct lin_heap lin_heap_t;
+typedef struct bit_heap bit_heap_t;
+typedef struct bud_heap bud_heap_t;
+typedef struct lut_heap lut_heap_t;
 
 //==------------------------------------------==//
 // [GNU - Based Allocation: Single Heap]
 void * 	gnu_malloc	(unsigned nbytes);
 void * 	gnu_realloc	(void * vp, unsigned newbytes);
 void * 	gnu_calloc	(unsigned nelem, unsigned elsize);
+void * 	gnu_memalign	(unsigned alignment, unsigned nbytes);
+void * 	gnu_aligned_alloc	(unsigned alignment, unsigned nbytes);
+unsigned gnu_malloc_batch	(unsigned count, unsigned nbytes, void ** out);
+void 	gnu_free_batch	(void ** ptrs, unsigned count);
 void 	gnu_free 	(void * vp);
+void 	gnu_lazyfree	(void * vp);
+unsigned gnu_fragmentation (void); 	/* per-mille of free bytes outside the largest free chunk */
+gnu_heap_t * gnu_heap_init (void * base, size_t bytes);
+void * 	gnu_heap_malloc	(gnu_heap_t * h, unsigned nbytes);
+void * 	gnu_heap_realloc	(gnu_heap_t * h, void * vp, unsigned newbytes);
+void * 	gnu_heap_calloc	(gnu_heap_t * h, unsigned nelem, unsigned elsize);
+void * 	gnu_heap_memalign	(gnu_heap_t * h, unsigned alignment, unsigned nbytes);
+unsigned gnu_heap_malloc_batch	(gnu_heap_t * h, unsigned count, unsigned nbytes, void ** out);
+void 	gnu_heap_free_batch	(gnu_heap_t * h, void ** ptrs, unsigned count);
+void 	gnu_heap_free 	(gnu_heap_t * h, void * vp);
+void 	gnu_heap_lazyfree	(gnu_heap_t * h, void * vp);
+unsigned gnu_heap_fragmentation (gnu_heap_t * h);
+#ifdef __ALLOC_STATS__
+void 	gnu_get_stats	(mem_stats_t * s);
+void 	gnu_heap_get_stats	(gnu_heap_t * h, mem_stats_t * s);
+#endif
+#ifdef __HEAP_MAP__
+void 	gnu_map	(mem_map_t * m);
+void 	gnu_heap_map	(gnu_heap_t * h, mem_map_t * m);
+#endif
+#ifdef __ACCESS_COUNT__
+void 	gnu_get_cost	(mem_cost_t * c);
+void 	gnu_heap_get_cost	(gnu_heap_t * h, mem_cost_t * c);
+#endif
 //==-----------------------------------------
 //
 // [Linear Based Allocation: Single Heap]
 void * 	lin_malloc	(unsigned size);
 void * 	lin_realloc	(void * p, unsigned newbytes);
 void * 	lin_calloc	(unsigned nelem, unsigned elsize);
+void * 	lin_memalign	(unsigned alignment, unsigned size);
+void * 	lin_aligned_alloc	(unsigned alignment, unsigned size);
+unsigned lin_malloc_batch	(unsigned count, unsigned size, void ** out);
+void 	lin_free_batch	(void ** ptrs, unsigned count);
 void 	lin_free	(void * p);
+lin_heap_t * lin_heap_init (void * base, size_t bytes);
+void * 	lin_heap_malloc	(lin_heap_t * h, unsigned size);
+void * 	lin_heap_realloc	(lin_heap_t * h, void * p, unsigned newbytes);
+void * 	lin_heap_calloc	(lin_heap_t * h, unsigned nelem, unsigned elsize);
+void * 	lin_heap_memalign	(lin_heap_t * h, unsigned alignment, unsigned size);
+unsigned lin_heap_malloc_batch	(lin_heap_t * h, unsigned count, unsigned size, void ** out);
+void 	lin_heap_free_batch	(lin_heap_t * h, void ** ptrs, unsigned count);
+void 	lin_heap_free	(lin_heap_t * h, void * p);
+void 	lin_heap_freeall	(lin_heap_t * h);
+#ifdef __ALLOC_STATS__
+void 	lin_get_stats	(mem_stats_t * s);
+void 	lin_heap_get_stats	(lin_heap_t * h, mem_stats_t * s);
+#endif
+#ifdef __HEAP_MAP__
+void 	lin_map	(mem_map_t * m);
+void 	lin_heap_map	(lin_heap_t * h, mem_map_t * m);
+#endif
+#ifdef __ACCESS_COUNT__
+void 	lin_get_cost	(mem_cost_t * c);
+void 	lin_heap_get_cost	(lin_heap_t * h, mem_cost_t * c);
+#endif
 //==-----------------------------------------
 //
 // [Bitmap Based Allocation: Single Heap]
 void * 	bit_malloc	(unsigned size);
 void * 	bit_realloc	(void * p, unsigned newbytes);
 void * 	bit_calloc	(unsigned nelem, unsigned elsize);
+void * 	bit_memalign	(unsigned alignment, unsigned size);
+void * 	bit_aligned_alloc	(unsigned alignment, unsigned size);
+unsigned bit_malloc_batch	(unsigned count, unsigned size, void ** out);
+void 	bit_free_batch	(void ** ptrs, unsigned count);
 void 	bit_free	(void * p);
+void 	bit_lazyfree	(void * p);
+bit_heap_t * bit_heap_init (void * base, size_t bytes);
+void * 	bit_heap_malloc	(bit_heap_t * h, unsigned size);
+void * 	bit_heap_realloc	(bit_heap_t * h, void * p, unsigned newbytes);
+void * 	bit_heap_calloc	(bit_heap_t * h, unsigned nelem, unsigned elsize);
+void * 	bit_heap_memalign	(bit_heap_t * h, unsigned alignment, unsigned size);
+unsigned bit_heap_malloc_batch	(bit_heap_t * h, unsigned count, unsigned size, void ** out);
+void 	bit_heap_free_batch	(bit_heap_t * h, void ** ptrs, unsigned count);
+void 	bit_heap_free	(bit_heap_t * h, void * p);
+void 	bit_heap_lazyfree	(bit_heap_t * h, void * p);
+#ifdef __ALLOC_STATS__
+void 	bit_get_stats	(mem_stats_t * s);
+void 	bit_heap_get_stats	(bit_heap_t * h, mem_stats_t * s);
+#endif
+#ifdef __HEAP_MAP__
+void 	bit_map	(mem_map_t * m);
+void 	bit_heap_map	(bit_heap_t * h, mem_map_t * m);
+#endif
+#ifdef __ACCESS_COUNT__
+void 	bit_get_cost	(mem_cost_t * c);
+void 	bit_heap_get_cost	(bit_heap_t * h, mem_cost_t * c);
+#endif
 //------------------------------------------
 //
 // [Buddy Based Allocation: Single Heap]
 void * 	bud_malloc	(unsigned size);
 void * 	bud_realloc	(void * p, unsigned newbytes);
 void * 	bud_calloc	(unsigned nelem, unsigned elsize);
+void * 	bud_memalign	(unsigned alignment, unsigned size);
+void * 	bud_aligned_alloc	(unsigned alignment, unsigned size);
+unsigned bud_malloc_batch	(unsigned count, unsigned size, void ** out);
+void 	bud_free_batch	(void ** ptrs, unsigned count);
 void 	bud_free	(void * p);
+void 	bud_lazyfree	(void * p);
+bud_heap_t * bud_heap_init (void * base, size_t bytes);
+void * 	bud_heap_malloc	(bud_heap_t * h, unsigned size);
+void * 	bud_heap_realloc	(bud_heap_t * h, void * p, unsigned newbytes);
+void * 	bud_heap_calloc	(bud_heap_t * h, unsigned nelem, unsigned elsize);
+void * 	bud_heap_memalign	(bud_heap_t * h, unsigned alignment, unsigned size);
+unsigned bud_heap_malloc_batch	(bud_heap_t * h, unsigned count, unsigned size, void ** out);
+void 	bud_heap_free_batch	(bud_heap_t * h, void ** ptrs, unsigned count);
+void 	bud_heap_free	(bud_heap_t * h, void * p);
+void 	bud_heap_lazyfree	(bud_heap_t * h, void * p);
+#ifdef __ALLOC_STATS__
+void 	bud_get_stats	(mem_stats_t * s);
+void 	bud_heap_get_stats	(bud_heap_t * h, mem_stats_t * s);
+#endif
+#ifdef __HEAP_MAP__
+void 	bud_map	(mem_map_t * m);
+void 	bud_heap_map	(bud_heap_t * h, mem_map_t * m);
+#endif
+#ifdef __ACCESS_COUNT__
+void 	bud_get_cost	(mem_cost_t * c);
+void 	bud_heap_get_cost	(bud_heap_t * h, mem_cost_t * c);
+#endif
 //------------------------------------------
 //
 // [Buddy Based Allocation: Single Heap]
 void * 	lut_malloc	(unsigned size);
 void * 	lut_realloc	(void * p, unsigned newbytes);
 void * 	lut_calloc	(unsigned nelem, unsigned elsize);
+void * 	lut_memalign	(unsigned alignment, unsigned size);
+void * 	lut_aligned_alloc	(unsigned alignment, unsigned size);
+unsigned lut_malloc_batch	(unsigned count, unsigned size, void ** out);
+void 	lut_free_batch	(void ** ptrs, unsigned count);
 void 	lut_free	(void * p);
+void 	lut_lazyfree	(void * p);
+lut_heap_t * lut_heap_init (void * base, size_t bytes); 	/* needs room for LUT_ARENA_BYTES of lutclasses.h, and a backing heap if hybrid */
+void * 	lut_heap_malloc	(lut_heap_t * h, unsigned size);
+void * 	lut_heap_realloc	(lut_heap_t * h, void * p, unsigned newbytes);
+void * 	lut_heap_calloc	(lut_heap_t * h, unsigned nelem, unsigned elsize);
+void * 	lut_heap_memalign	(lut_heap_t * h, unsigned alignment, unsigned size);
+unsigned lut_heap_malloc_batch	(lut_heap_t * h, unsigned count, unsigned size, void ** out);
+void 	lut_heap_free_batch	(lut_heap_t * h, void ** ptrs, unsigned count);
+void 	lut_heap_free	(lut_heap_t * h, void * p);
+void 	lut_heap_lazyfree	(lut_heap_t * h, void * p);
+#ifdef __ALLOC_STATS__
+void 	lut_get_stats	(mem_stats_t * s);
+void 	lut_heap_get_stats	(lut_heap_t * h, mem_stats_t * s);
+#endif
+#ifdef __HEAP_MAP__
+void 	lut_map	(mem_map_t * m);
+void 	lut_heap_map	(lut_heap_t * h, mem_map_t * m);
+#endif
+#ifdef __ACCESS_COUNT__
+void 	lut_get_cost	(mem_cost_t * c);
+void 	lut_heap_get_cost	(lut_heap_t * h, mem_cost_t * c);
+#endif
+//------------------------------------------
+//
+// [Per-thread caching front-end over TC_BACKING_SCHEME, for multithreaded hosts]
+void * 	tc_malloc	(unsigned size);
+void * 	tc_realloc	(void * p, unsigned newbytes);
+void * 	tc_calloc	(unsigned nelem, unsigned elsize);
+void 	tc_free		(void * p);
+void 	tc_flush	(void); 		/* hand the calling thread's cached blocks back to the heap */
+void 	tc_counts	(uint64_t * ops, uint64_t * locks); 	/* operations so far, and heap-lock acquisitions they took */
+void 	tc_report	(void);
+//------------------------------------------
+//
+// [Trace recorder: passes every call on to TRACE_SCHEME and appends it to a trace file]
+void * 	tr_malloc	(unsigned size);
+void * 	tr_realloc	(void * p, unsigned newbytes);
+void * 	tr_calloc	(unsigned nelem, unsigned elsize);
+void 	tr_free		(void * p);
+int 	tr_open		(const char * path); 	/* start a trace file (else the first call opens $LIBMEM_TRACE or libmem.trace) */
+void 	tr_close	(void); 				/* write out buffered records and close the file (also run at exit) */
 //------------------------------------------
 
 #endif
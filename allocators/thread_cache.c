@@ -0,0 +1,420 @@
+//===-- thread_cache.c ----------------------------------------*- C -*--------===//
+// A per-thread caching front-end for any one of the five allocators, for
+// multithreaded programs that share a single heap.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Every thread keeps a small magazine of free blocks for each size class. Allocation pops
+// from the magazine and free pushes onto it, neither taking the heap lock; only refilling
+// an empty magazine (TC_BATCH blocks at once) or draining a full one goes to the backing
+// allocator, under one lock acquisition per batch. A block freed by a thread other than
+// the one that allocated it is pushed onto the owner's remote-free queue (a lock-free
+// stack) and goes back into the owner's magazines on its next refill, so memory does not
+// drift towards the threads that free the most. When the heap runs dry all the same, the
+// thread that found it so returns every remote-free queue to it and asks the other threads
+// to empty their magazines on their next call.
+//
+// Each block carries an 8-byte header: the owning cache and the size class (or, for
+// requests larger than the biggest class, the payload size). Class blocks are powers of
+// two from MIN_REQ_SIZE up, header included, so bit, bud and lut waste nothing on them.
+//
+// This front-end targets hosts (it uses thread-local storage and atomics), not HLS.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "memutils.h"
+
+#define BACKING_CALL_(scheme, fn) 			scheme##_##fn
+#define BACKING_CALL(scheme, fn) 			BACKING_CALL_(scheme, fn)
+#define BACKING_MALLOC 						BACKING_CALL(TC_BACKING_SCHEME, malloc)
+#define BACKING_FREE 						BACKING_CALL(TC_BACKING_SCHEME, free)
+
+#define TC_HEADER 							sizeof(tc_header_t)
+#define TC_BLOCK(cls) 						((uint32_t)MIN_REQ_SIZE << (cls))
+#define TC_PAYLOAD(cls) 					(TC_BLOCK(cls) - TC_HEADER)
+#define TC_DIRECT 							0x80000000u 		// code flag: not a class block, low bits hold the payload size
+#define TC_NO_OWNER 						0 					// owner of blocks served without a cache
+
+// Magazines hold at most TC_MAG_BYTES and TC_MAG_DEPTH blocks of each class. Classes too
+// large for two blocks of them are not cached at all.
+#define TC_DEPTH(cls) 						((TC_MAG_BYTES / TC_BLOCK(cls) > TC_MAG_DEPTH) ? TC_MAG_DEPTH : TC_MAG_BYTES / TC_BLOCK(cls))
+#define TC_BATCH(cls) 						(TC_DEPTH(cls) >> 1)
+#define TC_CACHED(cls) 						((cls) < TC_CLASSES && TC_DEPTH(cls) >= 2)
+
+#if TC_MAX_THREADS * TC_CLASSES * TC_MAG_BYTES > ARENA_BYTES
+#error "The thread caches could hold more than the heap: TC_MAX_THREADS * TC_CLASSES * TC_MAG_BYTES exceeds ARENA_BYTES."
+#endif
+
+#define ATOMIC_ADD(P, N) 					__atomic_add_fetch((P), (N), __ATOMIC_RELAXED)
+#define ATOMIC_READ(P) 						__atomic_load_n((P), __ATOMIC_RELAXED)
+
+typedef struct tc_header {
+	uint32_t 	owner; 									// cache slot + 1, or TC_NO_OWNER
+	uint32_t 	code; 									// size class, or TC_DIRECT | payload bytes
+} tc_header_t;
+
+typedef struct tc_cache {
+	uint8_t 	in_use; 								// slot claimed by a live thread
+	uint8_t 	count[TC_CLASSES];
+	void * 		mag[TC_CLASSES][TC_MAG_DEPTH];
+	void * 		remote; 								// blocks freed by other threads, linked through their payload
+	uint32_t 	drained; 								// the last drain request this thread has honoured
+	uint64_t 	ops;
+	uint64_t 	locks;
+} tc_cache_t;
+
+static tc_cache_t 			tcaches[TC_MAX_THREADS];
+static pthread_mutex_t 		tcmut 		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t 		tckey;
+static pthread_once_t 		tckey_once 	= PTHREAD_ONCE_INIT;
+static uint64_t 			direct_ops 	= 0; 	// operations of threads that found no free slot
+static uint64_t 			direct_locks = 0;
+static uint32_t 			drain_requests = 0; 	// bumped when the heap runs dry, see reclaim_locked
+
+static __thread tc_cache_t * 	my_cache 	= NULL;
+static __thread uint8_t 		my_no_slot 	= 0;
+
+
+static void tc_lock(tc_cache_t * c) {
+	pthread_mutex_lock(&tcmut);
+	ATOMIC_ADD(c ? &c->locks : &direct_locks, 1);
+}
+
+static void tc_unlock(void) {
+	pthread_mutex_unlock(&tcmut);
+}
+
+static inline tc_header_t * header_of(void * vp) {
+	return (tc_header_t *)((char *)vp - TC_HEADER);
+}
+
+// Smallest class whose payload holds nbytes, or TC_CLASSES when none does.
+static uint32_t class_of(unsigned nbytes) {
+	uint32_t cls = 0;
+
+	while(cls < TC_CLASSES && TC_PAYLOAD(cls) < nbytes) {
+		++cls;
+	}
+	return cls;
+}
+
+// Allocates one block from the backing allocator; the caller holds the lock.
+static void * backing_block(uint32_t bytes, uint32_t owner, uint32_t code) {
+	tc_header_t * hdr = (tc_header_t *)BACKING_MALLOC(bytes);
+
+	if(!hdr) {
+		return NULL;
+	}
+	hdr->owner = owner;
+	hdr->code = code;
+	return (char *)hdr + TC_HEADER;
+}
+
+// Returns count blocks of one class of c's magazine (its top) to the backing allocator.
+static void drain(tc_cache_t * c, uint32_t cls, uint32_t count) {
+	tc_lock(c);
+	while(count-- > 0 && c->count[cls] > 0) {
+		BACKING_FREE(header_of(c->mag[cls][--c->count[cls]]));
+	}
+	tc_unlock();
+}
+
+// Moves everything on c's remote-free queue into its magazines; what does not fit is
+// returned to the backing allocator under a single lock.
+static void collect_remote(tc_cache_t * c) {
+	void * vp = __atomic_exchange_n(&c->remote, NULL, __ATOMIC_ACQUIRE);
+	void * overflow = NULL;
+	void * next;
+	uint32_t cls;
+
+	for(; vp; vp = next) {
+		next = *(void **)vp;
+		cls = header_of(vp)->code;
+		if(c->count[cls] < TC_DEPTH(cls)) {
+			c->mag[cls][c->count[cls]++] = vp;
+		} else {
+			*(void **)vp = overflow;
+			overflow = vp;
+		}
+	}
+
+	if(overflow) {
+		tc_lock(c);
+		for(vp = overflow; vp; vp = next) {
+			next = *(void **)vp;
+			BACKING_FREE(header_of(vp));
+		}
+		tc_unlock();
+	}
+}
+
+// Empties all of c's magazines into the backing allocator; the caller holds the lock.
+static void flush_locked(tc_cache_t * c) {
+	uint32_t cls;
+
+	for(cls = 0; cls < TC_CLASSES; ++cls) {
+		while(c->count[cls] > 0) {
+			BACKING_FREE(header_of(c->mag[cls][--c->count[cls]]));
+		}
+	}
+}
+
+// Gives the heap back all it can when a request finds it dry: c's magazines (if any), and
+// every thread's remote-free queue, which no magazine points into. Other threads' magazines
+// are theirs alone, so they are only asked to empty them at their next call. The caller
+// holds the lock.
+static void reclaim_locked(tc_cache_t * c) {
+	void * vp;
+	void * next;
+	int i;
+
+	if(c) {
+		flush_locked(c);
+	}
+	for(i = 0; i < TC_MAX_THREADS; ++i) {
+		for(vp = __atomic_exchange_n(&tcaches[i].remote, NULL, __ATOMIC_ACQUIRE); vp; vp = next) {
+			next = *(void **)vp;
+			BACKING_FREE(header_of(vp));
+		}
+	}
+	__atomic_add_fetch(&drain_requests, 1, __ATOMIC_RELEASE);
+}
+
+// Empties c's magazines if another thread has found the heap dry since c last looked.
+static inline void honour_drain(tc_cache_t * c) {
+	uint32_t requests = __atomic_load_n(&drain_requests, __ATOMIC_ACQUIRE);
+
+	if(c->drained != requests) {
+		c->drained = requests;
+		collect_remote(c);
+		tc_lock(c);
+		flush_locked(c);
+		tc_unlock();
+	}
+}
+
+// Fills an empty magazine: first from the remote-free queue, then with up to TC_BATCH
+// blocks from the backing allocator. When the heap cannot supply a single block, all
+// that can be reclaimed goes back into it (the blocks may merge into something larger)
+// and the batch is retried.
+static void refill(tc_cache_t * c, uint32_t cls) {
+	uint32_t owner = (uint32_t)(c - tcaches) + 1;
+	void * vp;
+
+	collect_remote(c);
+	if(c->count[cls] > 0) {
+		return;
+	}
+
+	tc_lock(c);
+	while(c->count[cls] < TC_BATCH(cls) && (vp = backing_block(TC_BLOCK(cls), owner, cls))) {
+		c->mag[cls][c->count[cls]++] = vp;
+	}
+	if(c->count[cls] == 0) {
+		reclaim_locked(c);
+		while(c->count[cls] < TC_BATCH(cls) && (vp = backing_block(TC_BLOCK(cls), owner, cls))) {
+			c->mag[cls][c->count[cls]++] = vp;
+		}
+	}
+	tc_unlock();
+}
+
+// Runs when a thread with a cache exits: its blocks go back to the heap, and the slot to
+// the next thread. Remote frees racing with this land on the slot's queue and are picked
+// up by its next owner.
+static void release_cache(void * arg) {
+	tc_cache_t * c = (tc_cache_t *)arg;
+
+	collect_remote(c);
+	tc_lock(c);
+	flush_locked(c);
+	tc_unlock();
+	__atomic_store_n(&c->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void) {
+	pthread_key_create(&tckey, release_cache);
+}
+
+// The calling thread's cache, claiming a free slot on first use (NULL when all are taken).
+static tc_cache_t * my_tcache(void) {
+	uint8_t expected;
+	int i;
+
+	if(my_cache || my_no_slot) {
+		return my_cache;
+	}
+
+	pthread_once(&tckey_once, make_key);
+	for(i = 0; i < TC_MAX_THREADS; ++i) {
+		expected = 0;
+		if(__atomic_compare_exchange_n(&tcaches[i].in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			my_cache = &tcaches[i];
+			my_cache->drained = __atomic_load_n(&drain_requests, __ATOMIC_ACQUIRE);
+			pthread_setspecific(tckey, my_cache);
+			return my_cache;
+		}
+	}
+	my_no_slot = 1;
+	return NULL;
+}
+
+
+void * tc_malloc(unsigned nbytes) {
+	tc_cache_t * c = my_tcache();
+	uint32_t cls = class_of(nbytes);
+	void * vp;
+
+	ATOMIC_ADD(c ? &c->ops : &direct_ops, 1);
+
+	if(c) {
+		honour_drain(c);
+	}
+	if(TC_CACHED(cls) && c) {
+		if(c->count[cls] == 0) {
+			refill(c, cls);
+		}
+		return (c->count[cls] > 0) ? c->mag[cls][--c->count[cls]] : NULL;
+	}
+
+	// The payload size must leave room for the header and stay clear of the TC_DIRECT bit.
+	if(nbytes > TC_DIRECT - 1 - TC_HEADER) {
+		return NULL;
+	}
+
+	// Large requests, uncached classes and threads without a cache go straight to the heap.
+	// If it is out of space, everything reclaim_locked can get back goes first and the
+	// request is retried.
+	tc_lock(c);
+	if(cls < TC_CLASSES) {
+		vp = backing_block(TC_BLOCK(cls), TC_NO_OWNER, cls);
+		if(!vp) {
+			reclaim_locked(c);
+			vp = backing_block(TC_BLOCK(cls), TC_NO_OWNER, cls);
+		}
+	} else {
+		vp = backing_block(nbytes + TC_HEADER, TC_NO_OWNER, TC_DIRECT | nbytes);
+		if(!vp) {
+			reclaim_locked(c);
+			vp = backing_block(nbytes + TC_HEADER, TC_NO_OWNER, TC_DIRECT | nbytes);
+		}
+	}
+	tc_unlock();
+	return vp;
+}
+
+void tc_free(void * vp) {
+	tc_cache_t * c = my_tcache();
+	tc_header_t * hdr;
+	tc_cache_t * owner;
+	uint32_t cls;
+
+	if(!vp) {
+		return;
+	}
+	ATOMIC_ADD(c ? &c->ops : &direct_ops, 1);
+	if(c) {
+		honour_drain(c);
+	}
+
+	hdr = header_of(vp);
+	cls = hdr->code;
+
+	// Blocks served without a cache, and those of threads that have since exited, go
+	// straight back to the heap.
+	owner = (hdr->owner == TC_NO_OWNER) ? NULL : &tcaches[hdr->owner - 1];
+	if(!owner || (owner != c && !__atomic_load_n(&owner->in_use, __ATOMIC_ACQUIRE))) {
+		tc_lock(c);
+		BACKING_FREE(hdr);
+		tc_unlock();
+		return;
+	}
+
+	if(owner != c) {
+		*(void **)vp = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&owner->remote, (void **)vp, vp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		}
+		return;
+	}
+
+	if(c->count[cls] == TC_DEPTH(cls)) {
+		drain(c, cls, TC_BATCH(cls));
+	}
+	c->mag[cls][c->count[cls]++] = vp;
+}
+
+void * tc_realloc(void * vp, unsigned newbytes) {
+	void * newp;
+	uint32_t code, oldbytes;
+
+	/* behavior on corner cases conforms to SUSv2 */
+	if(!vp) {
+		return tc_malloc(newbytes);
+	}
+	if(newbytes == 0) {
+		tc_free(vp);
+		return NULL;
+	}
+
+	code = header_of(vp)->code;
+	oldbytes = (code & TC_DIRECT) ? (code & ~TC_DIRECT) : TC_PAYLOAD(code);
+	if(!(code & TC_DIRECT) && newbytes <= oldbytes) {
+		return vp;
+	}
+
+	if((newp = tc_malloc(newbytes)) == NULL) {
+		return NULL;
+	}
+	memcpy(newp, vp, (oldbytes < newbytes) ? oldbytes : newbytes);
+	tc_free(vp);
+	return newp;
+}
+
+void * tc_calloc(unsigned nelem, unsigned elsize) {
+	unsigned nbytes = nelem * elsize;
+	void * vp = tc_malloc(nbytes);
+
+	if(vp) {
+		memset(vp, 0, nbytes);
+	}
+	return vp;
+}
+
+// Returns the calling thread's cached blocks, and those other threads freed for it, to
+// the heap.
+void tc_flush(void) {
+	tc_cache_t * c = my_tcache();
+
+	if(c) {
+		collect_remote(c);
+		tc_lock(c);
+		flush_locked(c);
+		tc_unlock();
+	}
+}
+
+// Operations served and heap-lock acquisitions so far, over all threads. Without the
+// cache every operation takes the lock once.
+void tc_counts(uint64_t * ops, uint64_t * locks) {
+	int i;
+
+	*ops = ATOMIC_READ(&direct_ops);
+	*locks = ATOMIC_READ(&direct_locks);
+	for(i = 0; i < TC_MAX_THREADS; ++i) {
+		*ops += ATOMIC_READ(&tcaches[i].ops);
+		*locks += ATOMIC_READ(&tcaches[i].locks);
+	}
+}
+
+void tc_report(void) {
+	uint64_t ops, locks;
+
+	tc_counts(&ops, &locks);
+	printf("thread cache: %llu ops, %llu lock acquisitions (%.3f per op, %.3f saved per op)\n",
+		(unsigned long long)ops, (unsigned long long)locks,
+		ops ? (double)locks / ops : 0.0, ops ? 1.0 - (double)locks / ops : 0.0);
+}
\ No newline at end of file
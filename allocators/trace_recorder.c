@@ -0,0 +1,243 @@
+//===-- trace_recorder.c --------------------------------------*- C -*--------===//
+// A recording shim for any one of the five allocators: every call is passed on
+// to TRACE_SCHEME and appended to a binary trace for tools/replay.c.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// The program calls tr_malloc, tr_free, tr_realloc and tr_calloc in place of the
+// scheme's own entry points (-DTRACE_SCHEME=bit, ...). Records are buffered TRACE_BUFFER
+// at a time and written as trace_rec_t (see memutils.h). Pointers are turned into object
+// numbers through an open-addressing table of TRACE_MAX_LIVE entries, so a trace replays
+// on any allocator no matter where the recorded one put its blocks.
+//
+// The file is $LIBMEM_TRACE (or libmem.trace) unless tr_open names one first, and is
+// closed at exit. Calls from several threads are serialized by one mutex.
+//
+// This shim targets hosts (it uses stdio and pthreads), not HLS.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "memutils.h"
+
+#define SCHEME_CALL_(scheme, fn) 			scheme##_##fn
+#define SCHEME_CALL(scheme, fn) 			SCHEME_CALL_(scheme, fn)
+#define SCHEME_MALLOC 						SCHEME_CALL(TRACE_SCHEME, malloc)
+#define SCHEME_REALLOC 						SCHEME_CALL(TRACE_SCHEME, realloc)
+#define SCHEME_CALLOC 						SCHEME_CALL(TRACE_SCHEME, calloc)
+#define SCHEME_FREE 						SCHEME_CALL(TRACE_SCHEME, free)
+
+#if (TRACE_MAX_LIVE & (TRACE_MAX_LIVE - 1)) != 0
+#error "TRACE_MAX_LIVE must be a power of two."
+#endif
+
+// Live blocks: pointer -> object number, linear probing, deletions shift the cluster back.
+typedef struct {
+	void * 		ptr;
+	uint32_t 	id;
+} trace_slot_t;
+
+static trace_slot_t 		live[TRACE_MAX_LIVE];
+static uint32_t 			live_count 	= 0;
+static uint32_t 			next_id 	= 1;
+
+static trace_rec_t 			buffer[TRACE_BUFFER];
+static uint32_t 			buffered 	= 0;
+static FILE * 				trace_file 	= NULL;
+static uint8_t 				trace_done 	= 0; 		// closed, or failed to open: stop recording
+static struct timespec 		started;
+
+static pthread_mutex_t 		trmut 		= PTHREAD_MUTEX_INITIALIZER;
+
+
+static inline uint32_t slot_of(void * ptr) {
+	return (uint32_t)(((uintptr_t)ptr >> 3) * 2654435761u) & (TRACE_MAX_LIVE - 1);
+}
+
+static void live_insert(void * ptr, uint32_t id) {
+	uint32_t i = slot_of(ptr);
+
+	if(live_count + 1 >= TRACE_MAX_LIVE) {
+		fprintf(stderr, "trace_recorder: more than %d live blocks, dropping one\n", TRACE_MAX_LIVE - 1);
+		return;
+	}
+	while(live[i].ptr) {
+		i = (i + 1) & (TRACE_MAX_LIVE - 1);
+	}
+	live[i].ptr = ptr;
+	live[i].id = id;
+	++live_count;
+}
+
+// Removes ptr and returns its object number (0 when it was never recorded).
+static uint32_t live_remove(void * ptr) {
+	uint32_t i = slot_of(ptr), j, home, id;
+
+	while(live[i].ptr != ptr) {
+		if(!live[i].ptr) {
+			return 0;
+		}
+		i = (i + 1) & (TRACE_MAX_LIVE - 1);
+	}
+	id = live[i].id;
+	--live_count;
+
+	// Pull later entries of the cluster back into the hole if their home slot allows it.
+	for(j = (i + 1) & (TRACE_MAX_LIVE - 1); live[j].ptr; j = (j + 1) & (TRACE_MAX_LIVE - 1)) {
+		home = slot_of(live[j].ptr);
+		if(((j - home) & (TRACE_MAX_LIVE - 1)) >= ((j - i) & (TRACE_MAX_LIVE - 1))) {
+			live[i] = live[j];
+			i = j;
+		}
+	}
+	live[i].ptr = NULL;
+	return id;
+}
+
+static void flush_buffer(void) {
+	if(trace_file && buffered > 0) {
+		fwrite(buffer, sizeof(trace_rec_t), buffered, trace_file);
+	}
+	buffered = 0;
+}
+
+// Opens the trace; the caller holds the lock.
+static int open_locked(const char * path) {
+	trace_header_t header = { TRACE_MAGIC, TRACE_VERSION };
+
+	if(trace_file) {
+		return 0;
+	}
+	trace_file = fopen(path, "wb");
+	if(!trace_file || fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+		fprintf(stderr, "trace_recorder: cannot write %s, not recording\n", path);
+		trace_done = 1;
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	atexit(tr_close);
+	return 0;
+}
+
+// Appends one record; the caller holds the lock.
+static void record(uint8_t op, uint32_t id, uint32_t size, uint8_t failed) {
+	struct timespec now;
+	trace_rec_t * r;
+
+	if(trace_done) {
+		return;
+	}
+	if(!trace_file) {
+		const char * path = getenv("LIBMEM_TRACE");
+		if(open_locked(path ? path : "libmem.trace") != 0) {
+			return;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	r = &buffer[buffered];
+	r->time_us 	= (uint32_t)((now.tv_sec - started.tv_sec) * 1000000 + (now.tv_nsec - started.tv_nsec) / 1000);
+	r->id 		= id;
+	r->size 	= size;
+	r->op 		= op;
+	r->failed 	= failed;
+	r->reserved = 0;
+	if(++buffered == TRACE_BUFFER) {
+		flush_buffer();
+	}
+}
+
+// Records an allocation that created a new object.
+static void record_new(uint8_t op, void * vp, uint32_t size) {
+	uint32_t id = next_id++;
+
+	record(op, id, size, vp == NULL);
+	if(vp) {
+		live_insert(vp, id);
+	}
+}
+
+int tr_open(const char * path) {
+	int ret;
+
+	pthread_mutex_lock(&trmut);
+	ret = open_locked(path);
+	pthread_mutex_unlock(&trmut);
+	return ret;
+}
+
+void tr_close(void) {
+	pthread_mutex_lock(&trmut);
+	flush_buffer();
+	if(trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	trace_done = 1;
+	pthread_mutex_unlock(&trmut);
+}
+
+void * tr_malloc(unsigned nbytes) {
+	void * vp;
+
+	pthread_mutex_lock(&trmut);
+	vp = SCHEME_MALLOC(nbytes);
+	record_new(TRACE_MALLOC, vp, nbytes);
+	pthread_mutex_unlock(&trmut);
+	return vp;
+}
+
+void * tr_calloc(unsigned nelem, unsigned elsize) {
+	void * vp;
+
+	pthread_mutex_lock(&trmut);
+	vp = SCHEME_CALLOC(nelem, elsize);
+	record_new(TRACE_CALLOC, vp, nelem * elsize);
+	pthread_mutex_unlock(&trmut);
+	return vp;
+}
+
+void tr_free(void * vp) {
+	uint32_t id;
+
+	if(!vp) {
+		return;
+	}
+	pthread_mutex_lock(&trmut);
+	SCHEME_FREE(vp);
+	id = live_remove(vp);
+	if(id) {
+		record(TRACE_FREE, id, 0, 0);
+	}
+	pthread_mutex_unlock(&trmut);
+}
+
+// realloc(NULL, n) is recorded as a malloc. A failed realloc leaves the object where it
+// was; a realloc to 0 bytes frees it in every scheme but lin.
+void * tr_realloc(void * vp, unsigned newbytes) {
+	void * newp;
+	uint32_t id;
+
+	pthread_mutex_lock(&trmut);
+	newp = SCHEME_REALLOC(vp, newbytes);
+	if(!vp) {
+		record_new(TRACE_MALLOC, newp, newbytes);
+	} else {
+		id = live_remove(vp);
+		if(id) {
+			record(TRACE_REALLOC, id, newbytes, newp == NULL && newbytes != 0);
+		}
+		if(newp) {
+			live_insert(newp, id ? id : next_id++);
+		} else if(newbytes != 0 && id) {
+			live_insert(vp, id);
+		}
+	}
+	pthread_mutex_unlock(&trmut);
+	return newp;
+}
@@ -0,0 +1,331 @@
+//===-- bench.c -----------------------------------------------*- C -*--------===//
+// Host microbenchmarks for the malloc, free, realloc and calloc of every
+// allocator, as a regression baseline for performance changes.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Build:
+//   cc -O2 -Iallocators tools/bench.c allocators/libgnumem.c allocators/liblinmem.c
+//      allocators/libbitmem.c allocators/libbudmem.c allocators/liblutmem.c -o bench
+// Any allocator flags (-D__GNU_BINNED__, -D__BUDDY_FREELIST__, ...) go on the same line.
+//
+// Usage:  bench [-b heap_bytes] [-n steps] [-k pool] [-m max_size] [-s seed] [-S scheme] [-p pattern]
+//
+// Every scheme runs every pattern on a fresh heap of heap_bytes (default 131072) from
+// xx_heap_init, holding at most pool blocks (default 256):
+//   fixed    blocks of 64 bytes allocated and freed in random order
+//   random   random sizes up to max_size (default 512); a quarter of the allocations are
+//            callocs, and a quarter of the steps that land on a live block reallocate it
+//   lifo     pool blocks of random size allocated, then freed newest first
+//   fifo     a queue: each step frees the oldest block and allocates a new one
+//   frag     16- and 256-byte blocks interleaved, then each 16-byte block freed and
+//            replaced by a 48-byte one that does not fit its hole
+// Each pattern runs twice with the same seed: untimed for throughput, then with every
+// call timed for the per-operation p50/p99/max latency (in ns, including the cost of
+// reading the clock, which is printed first). A failed call counts as an operation and
+// as a failure.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "schemes.h"
+
+#define MAX_POOL 			4096
+#define OPS 				4
+
+enum { OP_MALLOC, OP_FREE, OP_REALLOC, OP_CALLOC };
+static const char * op_names[OPS] = { "malloc", "free", "realloc", "calloc" };
+
+// One run of a pattern: the scheme and heap, and where the counts and samples go.
+typedef struct {
+	const scheme_t * 	s;
+	void * 				h;
+	int 				timed;
+	uint64_t 			count[OPS];
+	uint64_t 			failures[OPS];
+	uint32_t * 			samples[OPS];
+	uint64_t 			nsamples[OPS];
+} run_t;
+
+static unsigned long 	steps = 100000;
+static unsigned 		pool = 256;
+static unsigned 		max_size = 512;
+static unsigned 		seed = 1;
+static uint64_t 		sample_cap;
+
+static inline uint64_t now_ns(void) {
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Runs one call (a statement), timing it when the run is timed.
+#define CALL(run, op, stmt) 																\
+	do { 																					\
+		if((run)->timed) { 																	\
+			uint64_t _t0 = now_ns(); 														\
+			stmt; 																			\
+			uint64_t _dt = now_ns() - _t0; 													\
+			if((run)->nsamples[op] < sample_cap) { 											\
+				(run)->samples[op][(run)->nsamples[op]++] = (_dt > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)_dt; \
+			} 																				\
+		} else { 																			\
+			stmt; 																			\
+		} 																					\
+		++(run)->count[op]; 																\
+	} while(0)
+
+static void * do_malloc(run_t * r, unsigned n) {
+	void * vp;
+
+	CALL(r, OP_MALLOC, vp = r->s->alloc(r->h, n));
+	r->failures[OP_MALLOC] += !vp;
+	return vp;
+}
+
+static void * do_calloc(run_t * r, unsigned n) {
+	void * vp;
+
+	CALL(r, OP_CALLOC, vp = r->s->calloc(r->h, n, 1));
+	r->failures[OP_CALLOC] += !vp;
+	return vp;
+}
+
+// A failed realloc leaves the block in place.
+static void * do_realloc(run_t * r, void * p, unsigned n) {
+	void * vp;
+
+	CALL(r, OP_REALLOC, vp = r->s->realloc(r->h, p, n));
+	r->failures[OP_REALLOC] += !vp;
+	return vp ? vp : p;
+}
+
+static void do_free(run_t * r, void * p) {
+	if(p) {
+		CALL(r, OP_FREE, r->s->release(r->h, p));
+	}
+}
+
+static inline unsigned random_size(void) {
+	return 1 + (unsigned)(rand() % max_size);
+}
+
+static void pattern_fixed(run_t * r) {
+	void * live[MAX_POOL] = { 0 };
+	unsigned long i;
+
+	for(i = 0; i < steps; ++i) {
+		unsigned slot = rand() % pool;
+
+		if(live[slot]) {
+			do_free(r, live[slot]);
+			live[slot] = NULL;
+		} else {
+			live[slot] = do_malloc(r, 64);
+		}
+	}
+	for(i = 0; i < pool; ++i) {
+		do_free(r, live[i]);
+	}
+}
+
+static void pattern_random(run_t * r) {
+	void * live[MAX_POOL] = { 0 };
+	unsigned long i;
+
+	for(i = 0; i < steps; ++i) {
+		unsigned slot = rand() % pool;
+		unsigned pick = rand() & 3;
+
+		if(!live[slot]) {
+			live[slot] = (pick == 0) ? do_calloc(r, random_size()) : do_malloc(r, random_size());
+		} else if(pick == 0) {
+			live[slot] = do_realloc(r, live[slot], random_size());
+		} else {
+			do_free(r, live[slot]);
+			live[slot] = NULL;
+		}
+	}
+	for(i = 0; i < pool; ++i) {
+		do_free(r, live[i]);
+	}
+}
+
+static void pattern_lifo(run_t * r) {
+	void * live[MAX_POOL];
+	unsigned long done = 0;
+	unsigned i;
+
+	while(done < steps) {
+		for(i = 0; i < pool; ++i) {
+			live[i] = do_malloc(r, random_size());
+		}
+		for(i = pool; i > 0; --i) {
+			do_free(r, live[i - 1]);
+		}
+		done += 2 * pool;
+	}
+}
+
+static void pattern_fifo(run_t * r) {
+	void * live[MAX_POOL];
+	unsigned long i;
+	unsigned head = 0;
+
+	for(i = 0; i < pool; ++i) {
+		live[i] = do_malloc(r, random_size());
+	}
+	for(i = 0; i < steps; ++i) {
+		do_free(r, live[head]);
+		live[head] = do_malloc(r, random_size());
+		head = (head + 1) % pool;
+	}
+	for(i = 0; i < pool; ++i) {
+		do_free(r, live[i]);
+	}
+}
+
+static void pattern_frag(run_t * r) {
+	void * live[MAX_POOL];
+	unsigned long done = 0;
+	unsigned i;
+
+	while(done < steps) {
+		for(i = 0; i < pool; ++i) {
+			live[i] = do_malloc(r, (i & 1) ? 256 : 16);
+		}
+		for(i = 0; i < pool; i += 2) {
+			do_free(r, live[i]);
+			live[i] = do_malloc(r, 48);
+		}
+		for(i = 0; i < pool; ++i) {
+			do_free(r, live[i]);
+		}
+		done += 3 * pool;
+	}
+}
+
+typedef struct {
+	const char * 	name;
+	void 			(*run)(run_t *);
+} pattern_t;
+
+static const pattern_t patterns[] = {
+	{ "fixed", 	pattern_fixed },
+	{ "random", pattern_random },
+	{ "lifo", 	pattern_lifo },
+	{ "fifo", 	pattern_fifo },
+	{ "frag", 	pattern_frag },
+};
+
+static int cmp_u32(const void * a, const void * b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char ** argv) {
+	size_t heap_bytes = 131072;
+	const char * only_scheme = NULL, * only_pattern = NULL;
+	char * region;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:n:k:m:s:S:p:")) != -1) {
+		switch(opt) {
+			case 'b': heap_bytes = strtoul(optarg, NULL, 0); 	break;
+			case 'n': steps = strtoul(optarg, NULL, 0); 		break;
+			case 'k': pool = strtoul(optarg, NULL, 0); 			break;
+			case 'm': max_size = strtoul(optarg, NULL, 0); 		break;
+			case 's': seed = strtoul(optarg, NULL, 0); 			break;
+			case 'S': only_scheme = optarg; 					break;
+			case 'p': only_pattern = optarg; 					break;
+			default:
+				fprintf(stderr, "usage: %s [-b heap_bytes] [-n steps] [-k pool] [-m max_size] [-s seed] [-S scheme] [-p pattern]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(pool < 2 || pool > MAX_POOL || max_size < 1 || steps < 1) {
+		fprintf(stderr, "bench: need 2 <= pool <= %d, max_size >= 1 and steps >= 1\n", MAX_POOL);
+		return 1;
+	}
+
+	// Every pattern makes at most about 3 * steps + 3 * pool calls of one kind.
+	sample_cap = 3 * (uint64_t)steps + 3 * pool;
+	region = malloc(heap_bytes);
+	run_t timed = { 0 };
+	for(int op = 0; op < OPS; ++op) {
+		timed.samples[op] = malloc(sample_cap * sizeof(uint32_t));
+		if(!timed.samples[op]) {
+			fprintf(stderr, "bench: out of memory for %llu samples\n", (unsigned long long)sample_cap);
+			return 1;
+		}
+	}
+	if(!region) {
+		fprintf(stderr, "bench: cannot allocate a %zu-byte region\n", heap_bytes);
+		return 1;
+	}
+
+	uint64_t t0 = now_ns(), t1 = now_ns();
+	printf("heap %zu bytes, %lu steps, pool %u, sizes 1..%u, seed %u, clock read %llu ns\n",
+		heap_bytes, steps, pool, max_size, seed, (unsigned long long)(t1 - t0));
+	printf("%-6s %-7s %-8s %10s %12s %8s %8s %10s %9s\n",
+		"scheme", "pattern", "op", "calls", "ops/s", "p50", "p99", "max", "failures");
+
+	for(unsigned k = 0; k < SCHEME_COUNT; ++k) {
+		const scheme_t * s = &schemes[k];
+
+		if(only_scheme && strcmp(only_scheme, s->name) != 0) {
+			continue;
+		}
+		if(!s->init(region, heap_bytes)) {
+			printf("%-6s (a %zu-byte region cannot hold this heap)\n", s->name, heap_bytes);
+			continue;
+		}
+		for(unsigned p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p) {
+			run_t plain = { s, s->init(region, heap_bytes), 0 };
+			uint64_t calls = 0, start;
+			double secs;
+
+			if(only_pattern && strcmp(only_pattern, patterns[p].name) != 0) {
+				continue;
+			}
+
+			srand(seed);
+			start = now_ns();
+			patterns[p].run(&plain);
+			secs = (now_ns() - start) / 1e9;
+			for(int op = 0; op < OPS; ++op) {
+				calls += plain.count[op];
+			}
+
+			timed.s = s;
+			timed.h = s->init(region, heap_bytes);
+			timed.timed = 1;
+			memset(timed.count, 0, sizeof(timed.count));
+			memset(timed.failures, 0, sizeof(timed.failures));
+			memset(timed.nsamples, 0, sizeof(timed.nsamples));
+			srand(seed);
+			patterns[p].run(&timed);
+
+			printf("%-6s %-7s %-8s %10llu %12.0f\n", s->name, patterns[p].name, "all",
+				(unsigned long long)calls, secs > 0 ? calls / secs : 0.0);
+			for(int op = 0; op < OPS; ++op) {
+				uint64_t n = timed.nsamples[op];
+				uint32_t * v = timed.samples[op];
+
+				if(n == 0) {
+					continue;
+				}
+				qsort(v, n, sizeof(uint32_t), cmp_u32);
+				printf("%-6s %-7s %-8s %10llu %12s %8u %8u %10u %9llu\n", s->name, patterns[p].name, op_names[op],
+					(unsigned long long)timed.count[op], "", v[n / 2], v[(n * 99) / 100], v[n - 1],
+					(unsigned long long)timed.failures[op]);
+			}
+		}
+	}
+	return 0;
+}
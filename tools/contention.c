@@ -0,0 +1,179 @@
+//===-- contention.c ------------------------------------------*- C -*--------===//
+// Measures how the LUT, buddy and bitmap allocators scale when several threads
+// share one heap.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Build (fine-grained locks):
+//   cc -O2 -D__LUT_CLASS_LOCKS__ -D__BUDDY_LEVEL_LOCKS__ -D__BIT_REGION_LOCKS__ -Iallocators
+//      tools/contention.c allocators/liblutmem.c allocators/libbudmem.c allocators/libbitmem.c -lpthread
+// Build the same file without the three flags to get the baseline, where every call
+// takes one global mutex (what MemCast's alloc_lock/alloc_unlock wrapping does).
+//
+// Usage:  contention [-t max_threads] [-n ops_per_thread] [-k live_blocks]
+//
+// For 1, 2, 4, ... max_threads threads, every thread repeatedly frees and reallocates
+// blocks of its own size class (16 bytes for thread 0, 32 for thread 1, ...), keeping
+// live_blocks of them live. Distinct classes are the case the per-class, per-level and
+// per-region locks are for: threads only meet on the same lock when their blocks land
+// in the same class, level or region. Prints the aggregate operations per second.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "memutils.h"
+
+#define MAX_THREADS 		64
+#define MAX_LIVE 			64
+#define SIZE_CLASSES 		7 			/* 16 .. 1024 bytes: the default lutclasses.h serves all of them */
+
+typedef struct {
+	const char *	name;
+	void * 			(*alloc)(unsigned);
+	void 			(*release)(void *);
+	int 			fine; 			/* built with its fine-grained locks */
+} scheme_t;
+
+static const scheme_t schemes[] = {
+#ifdef __LUT_CLASS_LOCKS__
+	{ "lut", lut_malloc, lut_free, 1 },
+#else
+	{ "lut", lut_malloc, lut_free, 0 },
+#endif
+#ifdef __BUDDY_LEVEL_LOCKS__
+	{ "bud", bud_malloc, bud_free, 1 },
+#else
+	{ "bud", bud_malloc, bud_free, 0 },
+#endif
+#ifdef __BIT_REGION_LOCKS__
+	{ "bit", bit_malloc, bit_free, 1 },
+#else
+	{ "bit", bit_malloc, bit_free, 0 },
+#endif
+};
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t start_line;
+
+static const scheme_t * scheme;
+static unsigned long 	ops_per_thread = 200000;
+static unsigned 		live_blocks = 4;
+static unsigned long 	failures[MAX_THREADS];
+
+static void * alloc_call(unsigned size) {
+	void * p;
+
+	if(scheme->fine) {
+		return scheme->alloc(size);
+	}
+	pthread_mutex_lock(&global_lock);
+	p = scheme->alloc(size);
+	pthread_mutex_unlock(&global_lock);
+	return p;
+}
+
+static void free_call(void * p) {
+	if(scheme->fine) {
+		scheme->release(p);
+		return;
+	}
+	pthread_mutex_lock(&global_lock);
+	scheme->release(p);
+	pthread_mutex_unlock(&global_lock);
+}
+
+static void * worker(void * arg) {
+	unsigned long t = (unsigned long)arg;
+	unsigned size = MIN_REQ_SIZE << (t % SIZE_CLASSES);
+	void * live[MAX_LIVE] = { 0 };
+	unsigned long i;
+
+	pthread_barrier_wait(&start_line);
+	for(i = 0; i < ops_per_thread; ++i) {
+		unsigned slot = i % live_blocks;
+
+		if(live[slot]) {
+			free_call(live[slot]);
+		}
+		live[slot] = alloc_call(size);
+		if(!live[slot]) {
+			++failures[t];
+		}
+	}
+	for(i = 0; i < live_blocks; ++i) {
+		if(live[i]) {
+			free_call(live[i]);
+		}
+	}
+	return NULL;
+}
+
+// Runs one round with n threads and returns its wall-clock time in seconds.
+static double run_round(unsigned n) {
+	pthread_t threads[MAX_THREADS];
+	struct timespec a, b;
+	unsigned long t;
+
+	pthread_barrier_init(&start_line, NULL, n + 1);
+	for(t = 0; t < n; ++t) {
+		pthread_create(&threads[t], NULL, worker, (void *)t);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	pthread_barrier_wait(&start_line);
+	for(t = 0; t < n; ++t) {
+		pthread_join(threads[t], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	pthread_barrier_destroy(&start_line);
+	return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+int main(int argc, char ** argv) {
+	unsigned max_threads = 8;
+	int opt;
+
+	while((opt = getopt(argc, argv, "t:n:k:")) != -1) {
+		switch(opt) {
+			case 't': max_threads = strtoul(optarg, NULL, 0); 		break;
+			case 'n': ops_per_thread = strtoul(optarg, NULL, 0); 	break;
+			case 'k': live_blocks = strtoul(optarg, NULL, 0); 		break;
+			default:
+				fprintf(stderr, "usage: %s [-t max_threads] [-n ops_per_thread] [-k live_blocks]\n", argv[0]);
+				return 1;
+		}
+	}
+	if(max_threads < 1 || max_threads > MAX_THREADS || live_blocks < 1 || live_blocks > MAX_LIVE) {
+		fprintf(stderr, "contention: need 1 <= max_threads <= %d and 1 <= live_blocks <= %d\n", MAX_THREADS, MAX_LIVE);
+		return 1;
+	}
+
+	printf("%-6s %-7s %8s %14s %10s %9s\n", "scheme", "locks", "threads", "ops/s", "speedup", "failures");
+	for(unsigned s = 0; s < sizeof(schemes) / sizeof(schemes[0]); ++s) {
+		double base = 0;
+
+		scheme = &schemes[s];
+		for(unsigned n = 1; n <= max_threads; n <<= 1) {
+			unsigned long failed = 0;
+			double secs, rate;
+
+			for(unsigned t = 0; t < n; ++t) {
+				failures[t] = 0;
+			}
+			secs = run_round(n);
+			rate = (double)n * ops_per_thread * 2 / secs; 	/* one free and one malloc per step */
+			if(n == 1) {
+				base = rate;
+			}
+			for(unsigned t = 0; t < n; ++t) {
+				failed += failures[t];
+			}
+			printf("%-6s %-7s %8u %14.0f %9.2fx %9lu\n", scheme->name, scheme->fine ? "fine" : "global",
+				n, rate, rate / base, failed);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+//===-- cost.c ------------------------------------------------*- C -*--------===//
+// Replays an allocation trace against every allocator and reports how many
+// metadata and arena words each kind of call loads and stores.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Build:
+//   cc -O2 -D__ACCESS_COUNT__ -Iallocators tools/cost.c allocators/libgnumem.c allocators/liblinmem.c
+//      allocators/libbitmem.c allocators/libbudmem.c allocators/liblutmem.c
+// Add the allocators' own flags (-D__GNU_BINNED__, -D__BUDDY_FREELIST__, ...) to cost a
+// variant.
+//
+// Usage:  cost [-b heap_bytes] [-s scheme] [-w ml,ms,al,as] trace
+//
+// Each scheme gets a fresh heap of heap_bytes (its state included, default 131072) from
+// xx_heap_init and plays the trace once (see tools/replay.c), reading xx_heap_get_cost()
+// after every call. Prints, per scheme and kind of call, the mean metadata loads and
+// stores and arena loads and stores, the median, 99th percentile and largest number of
+// words one call touched, and an estimate of the mean cycles per call: each count times
+// its weight from -w (the cycles one such access takes, default 1,1,1,1). -s limits the
+// run to one scheme. The schemes run are those of tools/schemes.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace_replay.h"
+
+static const char * op_names[COST_OPS] = { "malloc", "free", "realloc", "calloc" };
+
+/* trace record kind -> kind of call counted */
+static const int trace_cost_op[] = { -1, COST_MALLOC, COST_CALLOC, COST_REALLOC, COST_FREE };
+
+typedef struct {
+	uint64_t 	words[4]; 			/* the four counts, summed */
+	uint32_t * 	samples; 			/* words touched by each call */
+	size_t 		n;
+} op_cost_t;
+
+static op_cost_t 		costs[COST_OPS];
+
+// Sizes the per-call samples of every kind of call for the trace loaded.
+static int alloc_samples(void) {
+	for(int i = 0; i < COST_OPS; ++i) {
+		costs[i].samples = malloc((nrecs ? nrecs : 1) * sizeof(uint32_t));
+		if(!costs[i].samples) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int by_words(const void * a, const void * b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Plays the whole trace once against heap h, filing the counts of every call in costs[].
+static void replay_counted(const scheme_t * s, void * h) {
+	mem_cost_t c;
+	size_t i;
+
+	memset(objects, 0, (max_id + 1) * sizeof(void *));
+	for(i = 0; i < COST_OPS; ++i) {
+		memset(costs[i].words, 0, sizeof(costs[i].words));
+		costs[i].n = 0;
+	}
+	for(i = 0; i < nrecs; ++i) {
+		const trace_rec_t * r = &recs[i];
+		void * vp;
+		int op;
+
+		if(play_record(s, h, r, &vp) < 0) {
+			continue;
+		}
+		objects[r->id] = vp;
+		op = trace_cost_op[r->op];
+
+		s->cost(h, &c);
+		for(int k = 0; k < 4; ++k) {
+			costs[op].words[k] += c.last[k];
+		}
+		costs[op].samples[costs[op].n++] = c.last[0] + c.last[1] + c.last[2] + c.last[3];
+	}
+}
+
+int main(int argc, char ** argv) {
+	size_t heap_bytes = 131072;
+	double weight[4] = { 1, 1, 1, 1 };
+	const char * only = NULL;
+	char * region;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:s:w:")) != -1) {
+		switch(opt) {
+			case 'b': heap_bytes = strtoul(optarg, NULL, 0); 	break;
+			case 's': only = optarg; 							break;
+			case 'w':
+				if(sscanf(optarg, "%lf,%lf,%lf,%lf", &weight[0], &weight[1], &weight[2], &weight[3]) != 4) {
+					fprintf(stderr, "cost: -w takes four comma-separated weights\n");
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-b heap_bytes] [-s scheme] [-w ml,ms,al,as] trace\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-b heap_bytes] [-s scheme] [-w ml,ms,al,as] trace\n", argv[0]);
+		return 1;
+	}
+	if(load_trace("cost", argv[optind]) != 0 || alloc_samples() != 0) {
+		return 1;
+	}
+	region = malloc(heap_bytes);
+	if(!region) {
+		fprintf(stderr, "cost: cannot allocate a %zu-byte region\n", heap_bytes);
+		return 1;
+	}
+
+	printf("%zu records, %u objects, %zu-byte heaps, weights %g,%g,%g,%g\n", nrecs, max_id, heap_bytes,
+		weight[0], weight[1], weight[2], weight[3]);
+	printf("%-6s %-8s %9s %8s %8s %8s %8s %7s %7s %7s %9s\n", "scheme", "op", "calls",
+		"meta-ld", "meta-st", "arena-ld", "arena-st", "p50", "p99", "max", "cycles");
+	for(unsigned k = 0; k < SCHEME_COUNT; ++k) {
+		const scheme_t * s = &schemes[k];
+		void * h;
+
+		if(only && strcmp(only, s->name) != 0) {
+			continue;
+		}
+		h = s->init(region, heap_bytes);
+		if(!h) {
+			printf("%-6s (a %zu-byte region cannot hold this heap)\n", s->name, heap_bytes);
+			continue;
+		}
+		replay_counted(s, h);
+
+		for(int op = 0; op < COST_OPS; ++op) {
+			op_cost_t * o = &costs[op];
+			double mean[4], cycles = 0;
+
+			if(o->n == 0) {
+				continue;
+			}
+			qsort(o->samples, o->n, sizeof(uint32_t), by_words);
+			for(int i = 0; i < 4; ++i) {
+				mean[i] = (double)o->words[i] / o->n;
+				cycles += mean[i] * weight[i];
+			}
+			printf("%-6s %-8s %9zu %8.1f %8.1f %8.1f %8.1f %7u %7u %7u %9.1f\n", s->name, op_names[op], o->n,
+				mean[0], mean[1], mean[2], mean[3], o->samples[o->n / 2], o->samples[(o->n * 99) / 100],
+				o->samples[o->n - 1], cycles);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+//===-- heapmap.c ---------------------------------------------*- C -*--------===//
+// Replays an allocation trace against the allocators and prints their heap maps:
+// where the free space is, and why a request failed while bytes were still free.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Build:
+//   cc -O2 -D__HEAP_MAP__ -Iallocators tools/heapmap.c allocators/libgnumem.c allocators/liblinmem.c
+//      allocators/libbitmem.c allocators/libbudmem.c allocators/liblutmem.c
+// Add -DARENA_BYTES=... -DMIN_REQ_SIZE=... (to the allocators and this file alike) to try
+// another sizing against the same trace.
+//
+// Usage:  heapmap [-b heap_bytes] [-e every] [-s scheme] trace
+//
+// Each scheme gets a fresh heap of heap_bytes (its state included, default 131072) from
+// xx_heap_init and plays the trace once (see tools/replay.c). Its xx_heap_map() is printed
+// right after the first call that failed, with the request that failed, then once more
+// at the end of the trace; -e also prints it every so many records. -s limits the run
+// to one scheme. The schemes run are those of tools/schemes.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace_replay.h"
+
+static void show(const scheme_t * s, void * h, const char * when) {
+	mem_map_t m;
+
+	s->map(h, &m);
+	printf("%s, %s: ", s->name, when);
+	mem_map_print(&m, stdout);
+}
+
+// Plays the whole trace once against heap h, printing its map as described above.
+static void replay_mapped(const scheme_t * s, void * h, size_t every) {
+	uint64_t failures = 0;
+	char when[96];
+	size_t i;
+
+	memset(objects, 0, (max_id + 1) * sizeof(void *));
+	for(i = 0; i < nrecs; ++i) {
+		const trace_rec_t * r = &recs[i];
+		void * vp;
+		int failed = play_record(s, h, r, &vp);
+
+		if(failed < 0) {
+			continue;
+		}
+		objects[r->id] = vp;
+
+		if(failed && failures++ == 0) {
+			snprintf(when, sizeof(when), "first failure at record %zu (%s of %u bytes)", i, trace_op_name(r->op), r->size);
+			show(s, h, when);
+		} else if(every && (i + 1) % every == 0) {
+			snprintf(when, sizeof(when), "after record %zu", i);
+			show(s, h, when);
+		}
+	}
+	snprintf(when, sizeof(when), "end of trace (%llu failures)", (unsigned long long)failures);
+	show(s, h, when);
+}
+
+int main(int argc, char ** argv) {
+	size_t heap_bytes = 131072, every = 0;
+	const char * only = NULL;
+	char * region;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:e:s:")) != -1) {
+		switch(opt) {
+			case 'b': heap_bytes = strtoul(optarg, NULL, 0); 	break;
+			case 'e': every = strtoul(optarg, NULL, 0); 		break;
+			case 's': only = optarg; 							break;
+			default:
+				fprintf(stderr, "usage: %s [-b heap_bytes] [-e every] [-s scheme] trace\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-b heap_bytes] [-e every] [-s scheme] trace\n", argv[0]);
+		return 1;
+	}
+	if(load_trace("heapmap", argv[optind]) != 0) {
+		return 1;
+	}
+	region = malloc(heap_bytes);
+	if(!region) {
+		fprintf(stderr, "heapmap: cannot allocate a %zu-byte region\n", heap_bytes);
+		return 1;
+	}
+
+	printf("%zu records, %u objects, %zu-byte heaps\n", nrecs, max_id, heap_bytes);
+	for(unsigned k = 0; k < SCHEME_COUNT; ++k) {
+		const scheme_t * s = &schemes[k];
+		void * h;
+
+		if(only && strcmp(only, s->name) != 0) {
+			continue;
+		}
+		h = s->init(region, heap_bytes);
+		if(!h) {
+			printf("%s: a %zu-byte region cannot hold this heap\n", s->name, heap_bytes);
+			continue;
+		}
+		replay_mapped(s, h, every);
+	}
+	return 0;
+}
@@ -0,0 +1,176 @@
+//===-- lutgen.c ----------------------------------------------*- C -*--------===//
+// Generates allocators/lutclasses.h (the size classes of liblutmem.c) from a
+// request-size profile.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Usage:  lutgen [-b arena_bytes] [-m min_slot_bytes] < profile > lutclasses.h
+//
+// The profile holds one "<size> <count>" pair per line, where count is the number of
+// objects of that size live at the peak of the program (raw request counts also work,
+// only the ratios matter). Sizes are rounded up to a power of two no smaller than the
+// minimum slot size, and each class receives a share of the arena proportional to the
+// bytes its objects need, rounded down to a whole radix granule (but never below one).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MAX_LOG2 			31
+#define MAX_RADIX_ENTRIES 	512
+
+static double 	demand[MAX_LOG2 + 1];
+static uint32_t slots[MAX_LOG2 + 1];
+static uint32_t region[MAX_LOG2 + 1];
+
+static uint32_t ceil_log2(uint32_t v) {
+	uint32_t r = 0;
+	while((1u << r) < v) {
+		++r;
+	}
+	return r;
+}
+
+static void emit_list(const char * type, const char * name, const char * size, const uint32_t * v, uint32_t n) {
+	printf("static const %s %s[%s] = {", type, name, size);
+	for(uint32_t i = 0; i < n; ++i) {
+		printf("%s%u%s", (i % 16) ? " " : "\n\t", v[i], (i + 1 < n) ? "," : "");
+	}
+	printf("\n};\n\n");
+}
+
+int main(int argc, char ** argv) {
+	uint32_t arena_bytes = 65536;
+	uint32_t min_log2 = 3;
+	double total = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:m:")) != -1) {
+		switch(opt) {
+			case 'b': arena_bytes = strtoul(optarg, NULL, 0); 			break;
+			case 'm': min_log2 = ceil_log2(strtoul(optarg, NULL, 0)); 	break;
+			default:
+				fprintf(stderr, "usage: %s [-b arena_bytes] [-m min_slot_bytes] < profile\n", argv[0]);
+				return 1;
+		}
+	}
+
+	unsigned long size, count;
+	while(scanf("%lu %lu", &size, &count) == 2) {
+		uint32_t l = ceil_log2(size ? size : 1);
+		if(l < min_log2) {
+			l = min_log2;
+		}
+		if(l > MAX_LOG2 || (1ul << l) > arena_bytes) {
+			fprintf(stderr, "lutgen: dropping size %lu (larger than the arena)\n", size);
+			continue;
+		}
+		demand[l] += (double)count * (1u << l);
+		total += (double)count * (1u << l);
+	}
+
+	if(total == 0) {
+		fprintf(stderr, "lutgen: empty profile\n");
+		return 1;
+	}
+
+	// The radix granule is a power of two that keeps the class lookup table small.
+	uint32_t radix_shift = min_log2;
+	while((arena_bytes >> radix_shift) > MAX_RADIX_ENTRIES) {
+		++radix_shift;
+	}
+	uint32_t granule = 1u << radix_shift;
+
+	uint32_t classes = 0, used = 0;
+	for(uint32_t l = 0; l <= MAX_LOG2; ++l) {
+		if(demand[l] == 0) {
+			continue;
+		}
+		uint32_t bytes = (uint32_t)(arena_bytes * (demand[l] / total));
+		uint32_t align = ((1u << l) > granule) ? (1u << l) : granule;
+		region[l] = bytes & ~(align - 1);
+		if(region[l] == 0) {
+			region[l] = align;
+		}
+		slots[l] = region[l] >> l;
+		used += region[l];
+		++classes;
+	}
+
+	uint32_t shift[MAX_LOG2 + 1], nslots[MAX_LOG2 + 1], base[MAX_LOG2 + 1], wbase[MAX_LOG2 + 2];
+	uint32_t first[MAX_LOG2 + 2];
+	uint32_t c = 0, offset = 0, words = 0;
+	for(uint32_t l = 0; l <= MAX_LOG2; ++l) {
+		if(demand[l] == 0) {
+			continue;
+		}
+		shift[c] 	= l;
+		nslots[c] 	= slots[l];
+		base[c] 	= offset;
+		wbase[c] 	= words;
+		offset 		+= region[l];
+		words 		+= (slots[l] + 31) >> 5;
+		++c;
+	}
+	wbase[c] = words;
+
+	// First class able to hold a request of 2^i bytes (classes when none can).
+	for(uint32_t i = 0; i <= MAX_LOG2 + 1; ++i) {
+		uint32_t k = 0;
+		while(k < classes && shift[k] < i) {
+			++k;
+		}
+		first[i] = k;
+	}
+
+	uint32_t * radix = malloc(sizeof(uint32_t) * (used >> radix_shift));
+	for(uint32_t k = 0; k < classes; ++k) {
+		for(uint32_t g = base[k] >> radix_shift; g < (base[k] + (nslots[k] << shift[k])) >> radix_shift; ++g) {
+			radix[g] = k;
+		}
+	}
+
+	// Slots past the end of a class's last occupancy word start out taken.
+	uint32_t * occupancy = calloc(words, sizeof(uint32_t));
+	for(uint32_t k = 0; k < classes; ++k) {
+		if(nslots[k] & 0x1F) {
+			occupancy[wbase[k + 1] - 1] = ~((1u << (nslots[k] & 0x1F)) - 1);
+		}
+	}
+
+	printf("//===-- lutclasses.h ------------------------------------------*- C -*--------===//\n");
+	printf("// Size classes of the LUT allocator. Generated by tools/lutgen.c, do not edit.\n");
+	printf("// %u classes, %u bytes of arena (%u requested).\n", classes, used, arena_bytes);
+	printf("//===-------------------------------------------------------------------------===//\n");
+	printf("#ifndef __LUTCLASSES_H__\n#define __LUTCLASSES_H__\n\n");
+	printf("#define LUT_CLASSES \t\t\t\t\t\t%u\n", classes);
+	printf("#define LUT_ARENA_BYTES \t\t\t\t\t%u\n", used);
+	printf("#define LUT_RADIX_SHIFT \t\t\t\t\t%u\n", radix_shift);
+	printf("#define LUT_OCCUPANCY_WORDS \t\t\t\t%u\n\n", words);
+
+	printf("/* log2 of the slot size of each class */\n");
+	emit_list("uint8_t ", "N_SHIFT_LEFTS__LT", "LUT_CLASSES", shift, classes);
+	printf("/* Number of slots in each class */\n");
+	emit_list("uint32_t", "N_SLOTS______LT", "LUT_CLASSES", nslots, classes);
+	printf("/* Byte offset of each class region within LUT_ARENA */\n");
+	emit_list("uint32_t", "N_CLASS_BASE___LT", "LUT_CLASSES", base, classes);
+	printf("/* First occupancy word of each class (and one past the last class) */\n");
+	emit_list("uint32_t", "N_WORD_BASE____LT", "LUT_CLASSES + 1", wbase, classes + 1);
+	printf("/* Smallest class whose slots hold 2^i bytes, LUT_CLASSES when there is none */\n");
+	emit_list("uint8_t ", "N_FIRST_CLASS__LT", "33", first, MAX_LOG2 + 2);
+	printf("/* Class owning each 2^LUT_RADIX_SHIFT byte granule of LUT_ARENA */\n");
+	emit_list("uint8_t ", "N_CLASS_RADIX__LT", "LUT_ARENA_BYTES >> LUT_RADIX_SHIFT", radix, used >> radix_shift);
+
+	printf("/* Initial occupancy: padding bits past the last slot of a class are set */\n");
+	printf("#define LUT_OCCUPANCY_INIT {");
+	for(uint32_t i = 0; i < words; ++i) {
+		printf("%s0x%08X%s", (i % 8) ? " " : " \\\n\t", occupancy[i], (i + 1 < words) ? "," : "");
+	}
+	printf(" \\\n}\n\n#endif\n");
+
+	free(radix);
+	free(occupancy);
+	return 0;
+}
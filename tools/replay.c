@@ -0,0 +1,152 @@
+//===-- replay.c ----------------------------------------------*- C -*--------===//
+// Replays an allocation trace (written by allocators/trace_recorder.c) against
+// every allocator and compares them.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// Build:
+//   cc -O2 -Iallocators tools/replay.c allocators/libgnumem.c allocators/liblinmem.c
+//      allocators/libbitmem.c allocators/libbudmem.c allocators/liblutmem.c
+//
+// Usage:  replay [-b heap_bytes] [-r repeats] [-s scheme] trace
+//
+// Each scheme gets a fresh heap of heap_bytes (its state included, default 131072) from
+// xx_heap_init, and the trace is played against it repeats times (default 10). Prints,
+// per scheme, the replay throughput, the peak arena usage (the highest byte any live
+// block reached, measured from the start of the region) and the first call that failed,
+// with how many bytes the program had live at that moment. Calls that failed when the
+// trace was recorded are replayed too. -s limits the run to one scheme.
+//
+// The schemes run are those of tools/schemes.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "trace_replay.h"
+
+typedef struct {
+	uint64_t 	failures;
+	int64_t 	first_failure; 		/* record index, -1 if none */
+	uint64_t 	live_at_failure; 	/* bytes the program had live then */
+	uint64_t 	peak; 				/* highest byte offset reached in the region */
+} result_t;
+
+static uint32_t * 		sizes; 			/* object number -> bytes asked for */
+
+// Plays the whole trace once against heap h; res (if given) collects failures and usage.
+static void replay_once(const scheme_t * s, void * h, char * region, result_t * res) {
+	uint64_t live = 0;
+	size_t i;
+
+	memset(objects, 0, (max_id + 1) * sizeof(void *));
+	for(i = 0; i < nrecs; ++i) {
+		const trace_rec_t * r = &recs[i];
+		void * vp;
+		int failed = play_record(s, h, r, &vp);
+
+		if(failed < 0) {
+			continue;
+		}
+
+		if(res) {
+			if(objects[r->id]) {
+				live -= sizes[r->id];
+			}
+			if(vp) {
+				uint32_t size = (failed || r->op == TRACE_FREE) ? sizes[r->id] : r->size;
+				uint64_t top = (uint64_t)((char *)vp - region) + size;
+
+				live += size;
+				sizes[r->id] = size;
+				if(top > res->peak) {
+					res->peak = top;
+				}
+			}
+			if(failed) {
+				if(res->failures++ == 0) {
+					res->first_failure = (int64_t)i;
+					res->live_at_failure = live;
+				}
+			}
+		}
+		objects[r->id] = vp;
+	}
+}
+
+int main(int argc, char ** argv) {
+	size_t heap_bytes = 131072;
+	unsigned repeats = 10;
+	const char * only = NULL;
+	char * region;
+	int opt;
+
+	while((opt = getopt(argc, argv, "b:r:s:")) != -1) {
+		switch(opt) {
+			case 'b': heap_bytes = strtoul(optarg, NULL, 0); 	break;
+			case 'r': repeats = strtoul(optarg, NULL, 0); 		break;
+			case 's': only = optarg; 							break;
+			default:
+				fprintf(stderr, "usage: %s [-b heap_bytes] [-r repeats] [-s scheme] trace\n", argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1 || repeats == 0) {
+		fprintf(stderr, "usage: %s [-b heap_bytes] [-r repeats] [-s scheme] trace\n", argv[0]);
+		return 1;
+	}
+	if(load_trace("replay", argv[optind]) != 0) {
+		return 1;
+	}
+	sizes = calloc(max_id + 1, sizeof(uint32_t));
+	if(!sizes) {
+		return 1;
+	}
+	region = malloc(heap_bytes);
+	if(!region) {
+		fprintf(stderr, "replay: cannot allocate a %zu-byte region\n", heap_bytes);
+		return 1;
+	}
+
+	printf("%zu records, %u objects, %zu-byte heaps\n", nrecs, max_id, heap_bytes);
+	printf("%-6s %14s %10s %9s  %s\n", "scheme", "ops/s", "peak", "failures", "first failure");
+	for(unsigned k = 0; k < SCHEME_COUNT; ++k) {
+		const scheme_t * s = &schemes[k];
+		result_t res = { 0, -1, 0, 0 };
+		struct timespec a, b;
+		double secs;
+		void * h;
+
+		if(only && strcmp(only, s->name) != 0) {
+			continue;
+		}
+		if(!s->init(region, heap_bytes)) {
+			printf("%-6s (a %zu-byte region cannot hold this heap)\n", s->name, heap_bytes);
+			continue;
+		}
+
+		// One pass for the measurements, then the timed passes on fresh heaps.
+		replay_once(s, s->init(region, heap_bytes), region, &res);
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		for(unsigned r = 0; r < repeats; ++r) {
+			h = s->init(region, heap_bytes);
+			replay_once(s, h, region, NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &b);
+		secs = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+
+		printf("%-6s %14.0f %10llu %9llu  ", s->name, secs > 0 ? (double)nrecs * repeats / secs : 0.0,
+			(unsigned long long)res.peak, (unsigned long long)res.failures);
+		if(res.first_failure < 0) {
+			printf("none\n");
+		} else {
+			const trace_rec_t * r = &recs[res.first_failure];
+			printf("record %lld (%s of %u bytes at %u us, %llu bytes live)\n", (long long)res.first_failure,
+				trace_op_name(r->op), r->size, r->time_us, (unsigned long long)res.live_at_failure);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+//===-- schemes.h ---------------------------------------------*- C -*--------===//
+// The table of allocators the host tools run: one untyped entry per scheme,
+// adapting its typed xx_heap_* calls.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+//
+// A new allocator takes one SCHEME() line and one ENTRY() in schemes[]. The cost and map
+// entries exist only with __ACCESS_COUNT__ and __HEAP_MAP__, as xx_heap_get_cost() and
+// xx_heap_map() do.
+//
+#ifndef __SCHEMES_H__
+#define __SCHEMES_H__
+
+#include <stddef.h>
+#include "memutils.h"
+
+typedef struct {
+	const char * 	name;
+	void * 			(*init)(void *, size_t);
+	void * 			(*alloc)(void *, unsigned);
+	void * 			(*calloc)(void *, unsigned, unsigned);
+	void * 			(*realloc)(void *, void *, unsigned);
+	void 			(*release)(void *, void *);
+#ifdef __ACCESS_COUNT__
+	void 			(*cost)(void *, mem_cost_t *);
+#endif
+#ifdef __HEAP_MAP__
+	void 			(*map)(void *, mem_map_t *);
+#endif
+} scheme_t;
+
+#ifdef __ACCESS_COUNT__
+#define SCHEME_COST(x) 	static void   x##_count(void * h, mem_cost_t * c) 		{ x##_heap_get_cost(h, c); }
+#define ENTRY_COST(x) 	, x##_count
+#else
+#define SCHEME_COST(x)
+#define ENTRY_COST(x)
+#endif
+#ifdef __HEAP_MAP__
+#define SCHEME_MAP(x) 	static void   x##_walk(void * h, mem_map_t * m) 		{ x##_heap_map(h, m); }
+#define ENTRY_MAP(x) 	, x##_walk
+#else
+#define SCHEME_MAP(x)
+#define ENTRY_MAP(x)
+#endif
+
+// Adapters from the typed xx_heap_* calls to the untyped table.
+#define SCHEME(x) 																						\
+	static void * x##_init(void * b, size_t n) 				{ return x##_heap_init(b, n); } 			\
+	static void * x##_alloc(void * h, unsigned n) 			{ return x##_heap_malloc(h, n); } 			\
+	static void * x##_zalloc(void * h, unsigned n, unsigned e) { return x##_heap_calloc(h, n, e); } 	\
+	static void * x##_resize(void * h, void * p, unsigned n) { return x##_heap_realloc(h, p, n); } 	\
+	static void   x##_release(void * h, void * p) 			{ x##_heap_free(h, p); } 					\
+	SCHEME_COST(x) 																						\
+	SCHEME_MAP(x)
+
+SCHEME(gnu)
+SCHEME(lin)
+SCHEME(bit)
+SCHEME(bud)
+SCHEME(lut)
+
+#define ENTRY(x) 	{ #x, x##_init, x##_alloc, x##_zalloc, x##_resize, x##_release ENTRY_COST(x) ENTRY_MAP(x) }
+
+static const scheme_t schemes[] = {
+	ENTRY(gnu),
+	ENTRY(lin),
+	ENTRY(bit),
+	ENTRY(bud),
+	ENTRY(lut),
+};
+
+#define SCHEME_COUNT 	(sizeof(schemes) / sizeof(schemes[0]))
+
+#endif
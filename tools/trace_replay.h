@@ -0,0 +1,92 @@
+//===-- trace_replay.h ----------------------------------------*- C -*--------===//
+// Loading an allocation trace (written by allocators/trace_recorder.c) and
+// playing its records against a scheme of schemes.h, for the host tools.
+// Written By: Nicholas V. Giamblanco
+//===-------------------------------------------------------------------------===//
+#ifndef __TRACE_REPLAY_H__
+#define __TRACE_REPLAY_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "schemes.h"
+
+static trace_rec_t * 	recs;
+static size_t 			nrecs;
+static uint32_t 		max_id;
+static void ** 			objects; 		/* object number -> current block */
+
+static inline const char * trace_op_name(uint8_t op) {
+	static const char * names[] = { "?", "malloc", "calloc", "realloc", "free" };
+
+	return names[(op <= TRACE_FREE) ? op : 0];
+}
+
+// Reads the trace at path into recs[] and sizes objects[] for its highest object number.
+// Complaints go to stderr under the tool's name; returns 0 on success.
+static int load_trace(const char * tool, const char * path) {
+	trace_header_t header;
+	FILE * f = fopen(path, "rb");
+	long bytes;
+	size_t i;
+
+	if(!f) {
+		fprintf(stderr, "%s: cannot open %s\n", tool, path);
+		return -1;
+	}
+	if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+		fprintf(stderr, "%s: %s is not a version %d libmem trace\n", tool, path, TRACE_VERSION);
+		fclose(f);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	bytes = ftell(f) - (long)sizeof(header);
+	fseek(f, sizeof(header), SEEK_SET);
+
+	nrecs = bytes / sizeof(trace_rec_t);
+	recs = malloc((nrecs ? nrecs : 1) * sizeof(trace_rec_t));
+	if(!recs || fread(recs, sizeof(trace_rec_t), nrecs, f) != nrecs) {
+		fprintf(stderr, "%s: short read on %s\n", tool, path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	for(i = 0; i < nrecs; ++i) {
+		if(recs[i].id > max_id) {
+			max_id = recs[i].id;
+		}
+	}
+	objects = calloc(max_id + 1, sizeof(void *));
+	return objects ? 0 : -1;
+}
+
+// Plays record r against heap h. *vp gets the block the object holds afterwards: the new
+// one, the old one when a realloc failed, NULL after a free or a failed allocation. The
+// caller stores it in objects[r->id] once it has looked at the old one. Returns 1 if the
+// call failed, 0 if not, -1 for a record that is not a call.
+static int play_record(const scheme_t * s, void * h, const trace_rec_t * r, void ** vp) {
+	*vp = NULL;
+	switch(r->op) {
+		case TRACE_MALLOC:
+			*vp = s->alloc(h, r->size);
+			return !*vp;
+		case TRACE_CALLOC:
+			*vp = s->calloc(h, r->size, 1);
+			return !*vp;
+		case TRACE_REALLOC:
+			*vp = s->realloc(h, objects[r->id], r->size);
+			if(!*vp && r->size != 0) {
+				*vp = objects[r->id];
+				return 1;
+			}
+			return 0;
+		case TRACE_FREE:
+			s->release(h, objects[r->id]);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+#endif
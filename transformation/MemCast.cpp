@@ -12,14 +12,21 @@
  *
  *		{malloc,calloc,realloc,free}() -->[MemCast.cpp]--> [x_]{malloc,calloc,realloc,free}()
  *
+ * memalign() and aligned_alloc() map to [x_]memalign() and [x_]aligned_alloc() the same way;
+ * posix_memalign() is first rewritten into a memalign() call (see lowerPosixMemalign).
+ *
  * Where x is a prefix from 1 of 5 allocaton schemes.
  * Five allocation schemes are available:
  * [gnu_] dlmalloc() (used by GNU unix-like OS)
  * [lin_] linear allocator.
  * [bit_] bitmap allocator.
- * [lut_] LUT allocator. 
+ * [lut_] LUT allocator. (a hybrid build, -D__LUT_HYBRID__, also links its gnu/bit/bud backing allocator)
  * [bud_] Buddy allocator.
  *
+ * Multithreaded programs on one heap can set THREAD_CACHE to call tc_{malloc,...}() from
+ * thread_cache.c instead: per-thread magazines in front of the selected scheme, which take
+ * the heap lock once per batch rather than once per call.
+ *
  *
  * This pass uses Valgrind to dynamically profile the C application, and determine the total
  * heap usage required for the program to run. Valgrind was modified to 'spit-out' a Makefile
@@ -98,7 +105,7 @@
 #include "utils.h"
 
 
-#define NUMFUNCS 3
+#define NUMFUNCS 5
 #define MAX_INSPECTION_THRESH 1000	// Stops this analysis from blowing up on large files.
 
 using namespace llvm;
@@ -249,9 +256,10 @@ namespace legup{
 		int allocator 			= LEGUP_CONFIG->getParameterInt("ALLOC_SCHEME");
 		int isLazy 				= LEGUP_CONFIG->getParameterInt("LAZY_FREE");
 		unsigned MAX_PARTITION 	= LEGUP_CONFIG->getParameterInt("NUM_HEAPS");
+		int threadCache 		= LEGUP_CONFIG->getParameterInt("THREAD_CACHE");
     	
     	//==-- Allocator Keywords.
-    	const std::string allocators[NUMFUNCS] = { "malloc", "realloc", "calloc" };
+    	const std::string allocators[NUMFUNCS] = { "malloc", "realloc", "calloc", "memalign", "aligned_alloc" };
     	const std::string free = "free";
 
     	//==-- Path to allocator library.
@@ -471,6 +479,8 @@ namespace legup{
 				RecursiveDFSSearchForSAR(M);
 			}
 
+			lowerPosixMemalign(M);
+
 			if(!populateAllocatorMaps(M)) {
 				return false;
 			}
@@ -597,6 +607,53 @@ namespace legup{
 			return false;
 		}
 
+		// posix_memalign(&p, alignment, size) hands its block back through p, which neither the
+		// allocators nor the malloc-free pairing below deal with. Each call is rewritten as
+		//
+		//		p = memalign(alignment, size); ret = (p == NULL) ? ENOMEM : 0;
+		//
+		// so that the block is an ordinary allocator result from here on.
+		void lowerPosixMemalign(Module &M) {
+			Function * posix = M.getFunction("posix_memalign");
+			std::vector<CallInst *> calls;
+
+			if(!posix) {
+				return;
+			}
+			for(auto U : posix->users()) {
+				if(isa<CallInst>(U)) {
+					calls.push_back(dyn_cast<CallInst>(U));
+				}
+			}
+
+			for(CallInst * CI : calls) {
+				Value * memptr = CI->getArgOperand(0);
+				Value * alignment = CI->getArgOperand(1);
+				Value * size = CI->getArgOperand(2);
+				PointerType * BytePtr = llvm::Type::getInt8PtrTy(M.getContext());
+				Constant * memalign = M.getOrInsertFunction("memalign", BytePtr, alignment->getType(), size->getType(), NULL);
+
+				IRBuilder<> B(CI);
+				Value * block = B.CreateCall2(memalign, alignment, size);
+				B.CreateStore(block, B.CreateBitCast(memptr, BytePtr->getPointerTo()));
+				Value * failed = B.CreateICmpEQ(block, ConstantPointerNull::get(BytePtr));
+				Value * ret = B.CreateSelect(failed, ConstantInt::get(CI->getType(), ENOMEM), ConstantInt::get(CI->getType(), 0));
+
+				errs() << "  +-- Rewriting " << *CI << " as memalign()\n";
+				CI->replaceAllUsesWith(ret);
+				CI->eraseFromParent();
+			}
+			if(posix->use_empty()) {
+				posix->eraseFromParent();
+			}
+		}
+
+		// thread_cache.c has no aligned entry points (its blocks carry a header in front of the
+		// payload), so a program that calls memalign() or aligned_alloc() keeps the locked calls.
+		bool usesAlignedAlloc(Module &M) {
+			return M.getFunction("memalign") != NULL || M.getFunction("aligned_alloc") != NULL;
+		}
+
 		/*=--------------------------------------------------------------------------------------------
 		Parameters: Module &M : bitcode module.
 		** This functions locates dynamic memory calls and stores their locations in a map 
@@ -1013,6 +1070,77 @@ namespace legup{
 			instr->setMetadata(metadataName, N);
 		}		
 
+		// thread_cache.bc is compiled against gnu_{malloc,free}; point those at the selected
+		// scheme and link the cache in, so that tc_{malloc,...}() front the single heap.
+		void linkThreadCache(Linker * L, std::string tag, LLVMContext &Context) {
+			SMDiagnostic Err;
+			std::string cache_loc = abs_path_to_alloc+"/thread_cache.bc";
+			Module * cache = ParseIRFile(cache_loc.c_str(), Err, Context);
+			if (!cache) {
+				Err.print("Could not find the thread cache, thread_cache.bc\n", errs());
+				assert(false);
+			}
+
+			const std::string backing[] = { "malloc", "free" };
+			for(int i = 0; i < 2; ++i) {
+				Function * F = cache->getFunction("gnu_"+backing[i]);
+				if(F && F->isDeclaration() && tag != "gnu") {
+					F->setName(tag+"_"+backing[i]);
+				}
+			}
+
+			std::string * Merr = new std::string;
+			bool failed = L->linkInModule(cache, 1, Merr);
+			if(failed) {
+				errs() << "Link Error.\n";
+				errs() << *Merr << "\n";
+				assert(0);
+			}
+			errs() << "==> Fronting lib" << tag << "mem with per-thread caches\n";
+		}
+
+		// A library built for concurrent use (libbitmem with __BIT_CONCURRENT__ or
+		// __BIT_REGION_LOCKS__, libbudmem with __BUDDY_LEVEL_LOCKS__, liblutmem with
+		// __LUT_CLASS_LOCKS__) defines <tag>_threadsafe(); its calls need no
+		// alloc_lock/alloc_unlock around them.
+		bool isThreadSafe(Module * alloc_scheme, std::string tag) {
+			Function * marker = alloc_scheme->getFunction(tag+"_threadsafe");
+			return marker && !marker->isDeclaration();
+		}
+
+		// liblutmem built with __LUT_HYBRID__ lays its own heap of the backing scheme (gnu, bit
+		// or bud) over its region, so it declares that scheme's <scheme>_heap_init and
+		// <scheme>_heap_* calls. Whichever scheme it declares is linked into the library.
+		void linkBackingScheme(Module * alloc_scheme, LLVMContext &Context) {
+			const std::string backings[3] = { "gnu", "bit", "bud" };
+			SMDiagnostic Err;
+
+			for(int i = 0; i < 3; ++i) {
+				Function * backing_init = alloc_scheme->getFunction(backings[i]+"_heap_init");
+				if(!backing_init || !backing_init->isDeclaration()) {
+					continue;
+				}
+
+				std::string backing_loc = abs_path_to_alloc+"/lib"+backings[i]+"mem.bc";
+				Module * backing = ParseIRFile(backing_loc.c_str(), Err, Context);
+				if (!backing) {
+					Err.print(("Could not find the backing allocation library: lib"+backings[i]+"mem\n").c_str(), errs());
+					assert(false);
+				}
+
+				Linker *BL = new Linker(alloc_scheme, false);
+				std::string * Merr = new std::string;
+				bool failed = BL->linkInModule(backing, 0, Merr);
+
+				if(failed) {
+					errs() << "Link Error.\n";
+					errs() << *Merr << "\n";
+					assert(0);
+				}
+				errs() << "==> Backing the LUT allocator with lib" << backings[i] << "mem\n";
+			}
+		}
+
 		void performSpecializedCasting(Module &M, std::string tag) {
 
 			Linker *L = new Linker(&M, false);	
@@ -1030,9 +1158,20 @@ namespace legup{
 				assert(false);
 			}
 
+			// A hybrid LUT library calls into a backing allocator; link it in now so that
+			// every heap cloned below carries its own copy.
+			if(tag == "lut") {
+				linkBackingScheme(alloc_scheme, Context);
+			}
+
 
-			// Next, if pthreads are used, get pthread API for malloc/free.
-			if(usingPthreads(M)) {
+			// Next, if pthreads are used, get pthread API for malloc/free (unless the
+			// library takes care of concurrent calls itself).
+			bool wrapLocks = usingPthreads(M) && !isThreadSafe(alloc_scheme, tag);
+			if(usingPthreads(M) && !wrapLocks) {
+				errs() << "==> lib" << tag << "mem is thread-safe, not wrapping calls in alloc_lock\n";
+			}
+			if(wrapLocks) {
 				std::string pthread_loc = abs_path_to_alloc+"/pthread_utils.bc";
 				pthread_utils = ParseIRFile(pthread_loc.c_str(), Err, Context);
 				if (!pthread_utils) {
@@ -1083,7 +1222,7 @@ namespace legup{
 				// If a malloc() is used within a threaded function, wrap the call in a mutex.
 				// We do NOT specifiy locks inside the malloc calls, since their internal operation is
 				// not paralleziable (data dependent flow.)
-				if(usingPthreads(M)) {
+				if(wrapLocks) {
 					for(int i = 0; i < maxHeaps; ++i) {
 						Module *PA = CloneModule(pthread_utils);
 						if(!PA) {
@@ -1134,7 +1273,7 @@ namespace legup{
 						errs() << "Replaced : "<< *MCI << "\n\n";
 
 						//surround malloc call with locks;
-						if(usingPthreads(M)) {
+						if(wrapLocks) {
 							Function * lock = M.getFunction("alloc_lock_"+std::to_string(i%maxHeaps));
 							Function * unlock = M.getFunction("alloc_unlock_"+std::to_string(i%maxHeaps));
 
@@ -1149,7 +1288,19 @@ namespace legup{
 
 			} else {
 
-				if(usingPthreads(M)) {
+				// With THREAD_CACHE, the program calls tc_*(), which takes the heap lock only to
+				// refill or drain its per-thread magazines; no call is wrapped.
+				bool useThreadCache = wrapLocks && threadCache && !usesAlignedAlloc(M);
+				if(wrapLocks && threadCache && !useThreadCache) {
+					errs() << "==> memalign()/aligned_alloc() in use, not fronting lib" << tag << "mem with per-thread caches\n";
+				}
+				std::string prefix = tag;
+				if(useThreadCache) {
+					linkThreadCache(L, tag, Context);
+					prefix = "tc";
+				}
+
+				if(wrapLocks && !useThreadCache) {
 					populateAllocatorMaps(M);
 					std::string * Merr = new std::string;					
 
@@ -1179,15 +1330,15 @@ namespace legup{
 				Function * freeFun = M.getFunction(free);
 				if(freeFun) {
 					std::string rfree = free;
-					if(isLazy) {
+					if(isLazy && !useThreadCache) {
 						rfree = "lazyfree";
 					} 
-					freeFun->setName(tag+"_"+rfree);
+					freeFun->setName(prefix+"_"+rfree);
 				}
 				for(int i = 0; i < NUMFUNCS; ++i) {
 					Function * memfunc = M.getFunction(allocators[i]);
 					if(memfunc != NULL){
-						memfunc->setName(tag+"_"+allocators[i]);
+						memfunc->setName(prefix+"_"+allocators[i]);
 					}
 				}
 				// 1-> preserve module